@@ -25,8 +25,27 @@ SOFTWARE.
 */
 
 #include <math.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
+#include "noise.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || \
+    (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define NOISE_SSE2 1
+#include <emmintrin.h>
+#endif
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__)) && \
+    (defined(__clang__) || __GNUC__ >= 5)
+#define NOISE_AVX2 1
+#include <immintrin.h>
+#endif
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define NOISE_NEON 1
+#include <arm_neon.h>
+#endif
 
 #define F2 0.3660254037844386f
 #define G2 0.21132486540518713f
@@ -129,7 +148,38 @@ void seed(unsigned int x) {
     memcpy(PERM + 256, PERM, sizeof(unsigned char) * 256);
 }
 
-float noise2(float x, float y) {
+/* splitmix64, so seeded tables are the same on every libc */
+static uint32_t noise_random(uint64_t *state) {
+    uint64_t z = (*state += 0x9e3779b97f4a7c15ULL);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return (uint32_t)((z ^ (z >> 31)) >> 32);
+}
+
+void noise_init(Noise *noise) {
+    memcpy(noise->perm, PERM, sizeof(noise->perm));
+}
+
+void noise_seed(Noise *noise, unsigned int x) {
+    uint64_t state = x;
+    int i;
+    for (i = 0; i < 256; i++)
+        noise->perm[i] = i;
+    for (i = 255; i > 0; i--) {
+        uint32_t limit = 0xffffffffu - 0xffffffffu % (i + 1);
+        uint32_t r;
+        unsigned char a;
+        do {
+            r = noise_random(&state);
+        } while (r >= limit);
+        a = noise->perm[i];
+        noise->perm[i] = noise->perm[r % (i + 1)];
+        noise->perm[r % (i + 1)] = a;
+    }
+    memcpy(noise->perm + 256, noise->perm, 256);
+}
+
+static float noise2(const unsigned char *perm, float x, float y) {
     int i1, j1, I, J, c;
     float s = (x + y) * F2;
     float i = floorf(x + s);
@@ -153,9 +203,9 @@ float noise2(float x, float y) {
 
     I = (int) i & 255;
     J = (int) j & 255;
-    g[0] = PERM[I + PERM[J]] % 12;
-    g[1] = PERM[I + i1 + PERM[J + j1]] % 12;
-    g[2] = PERM[I + 1 + PERM[J + 1]] % 12;
+    g[0] = perm[I + perm[J]] % 12;
+    g[1] = perm[I + i1 + perm[J + j1]] % 12;
+    g[2] = perm[I + 1 + perm[J + 1]] % 12;
 
     for (c = 0; c <= 2; c++) {
         f[c] = 0.5f - xx[c]*xx[c] - yy[c]*yy[c];
@@ -171,7 +221,9 @@ float noise2(float x, float y) {
     return (noise[0] + noise[1] + noise[2]) * 70.0f;
 }
 
-float noise3(float x, float y, float z) {
+static float noise3(
+    const unsigned char *perm, float x, float y, float z)
+{
     int c, o1[3], o2[3], g[4], I, J, K;
     float f[4], noise[4] = {0.0f, 0.0f, 0.0f, 0.0f};
     float s = (x + y + z) * F3;
@@ -219,10 +271,10 @@ float noise3(float x, float y, float z) {
     I = (int) i & 255; 
     J = (int) j & 255; 
     K = (int) k & 255;
-    g[0] = PERM[I + PERM[J + PERM[K]]] % 12;
-    g[1] = PERM[I + o1[0] + PERM[J + o1[1] + PERM[o1[2] + K]]] % 12;
-    g[2] = PERM[I + o2[0] + PERM[J + o2[1] + PERM[o2[2] + K]]] % 12;
-    g[3] = PERM[I + 1 + PERM[J + 1 + PERM[K + 1]]] % 12; 
+    g[0] = perm[I + perm[J + perm[K]]] % 12;
+    g[1] = perm[I + o1[0] + perm[J + o1[1] + perm[o1[2] + K]]] % 12;
+    g[2] = perm[I + o2[0] + perm[J + o2[1] + perm[o2[2] + K]]] % 12;
+    g[3] = perm[I + 1 + perm[J + 1 + perm[K + 1]]] % 12; 
 
     for (c = 0; c <= 3; c++) {
         f[c] = 0.6f - pos[c][0] * pos[c][0] - pos[c][1] * pos[c][1] -
@@ -245,13 +297,13 @@ float simplex2(
     float freq = 1.0f;
     float amp = 1.0f;
     float max = 1.0f;
-    float total = noise2(x, y);
+    float total = noise2(PERM, x, y);
     int i;
     for (i = 1; i < octaves; i++) {
         freq *= lacunarity;
         amp *= persistence;
         max += amp;
-        total += noise2(x * freq, y * freq) * amp;
+        total += noise2(PERM, x * freq, y * freq) * amp;
     }
     return (1 + total / max) / 2;
 }
@@ -263,13 +315,267 @@ float simplex3(
     float freq = 1.0f;
     float amp = 1.0f;
     float max = 1.0f;
-    float total = noise3(x, y, z);
+    float total = noise3(PERM, x, y, z);
     int i;
     for (i = 1; i < octaves; ++i) {
         freq *= lacunarity;
         amp *= persistence;
         max += amp;
-        total += noise3(x * freq, y * freq, z * freq) * amp;
+        total += noise3(PERM, x * freq, y * freq, z * freq) * amp;
     }
     return (1 + total / max) / 2;
 }
+
+/* batches evaluate one octave over every point before the next, adding
+ * into out the same way simplex2 and simplex3 accumulate their total */
+
+static void noise2_batch_scalar(
+    const unsigned char *perm, const float *x, const float *y, int count,
+    float freq, float amp, int first, float *out)
+{
+    int n;
+    for (n = 0; n < count; n++) {
+        float value = noise2(perm, x[n] * freq, y[n] * freq);
+        out[n] = first ? value : out[n] + value * amp;
+    }
+}
+
+static void noise3_batch_scalar(
+    const unsigned char *perm,
+    const float *x, const float *y, const float *z, int count,
+    float freq, float amp, int first, float *out)
+{
+    int n;
+    for (n = 0; n < count; n++) {
+        float value = noise3(perm, x[n] * freq, y[n] * freq, z[n] * freq);
+        out[n] = first ? value : out[n] + value * amp;
+    }
+}
+
+#if NOISE_SSE2
+#define W 4
+#define VEC __m128
+#define VMASK __m128
+#define NOISE_FN(name) name##_sse2
+#define NOISE_TARGET
+#define V_LOAD(p) _mm_loadu_ps(p)
+#define V_STORE(p, v) _mm_storeu_ps(p, v)
+#define V_STORE_I(p, v) _mm_storeu_si128((__m128i *)(p), v)
+#define V_SET1(f) _mm_set1_ps(f)
+#define V_ADD(a, b) _mm_add_ps(a, b)
+#define V_SUB(a, b) _mm_sub_ps(a, b)
+#define V_MUL(a, b) _mm_mul_ps(a, b)
+#define V_ABS(a) _mm_andnot_ps(_mm_set1_ps(-0.0f), a)
+#define V_GT(a, b) _mm_cmpgt_ps(a, b)
+#define V_GE(a, b) _mm_cmpge_ps(a, b)
+#define V_LT(a, b) _mm_cmplt_ps(a, b)
+#define V_MASK_AND(a, b) _mm_and_ps(a, b)
+#define V_MASK_OR(a, b) _mm_or_ps(a, b)
+#define V_MASK_NOT(a) _mm_xor_ps(a, _mm_castsi128_ps(_mm_set1_epi32(-1)))
+#define V_SELECT(m, a, b) _mm_or_ps(_mm_and_ps(m, a), _mm_andnot_ps(m, b))
+#define V_TRUNC(a) _mm_cvttps_epi32(a)
+#define V_I2F(a) _mm_cvtepi32_ps(a)
+#include "noise_kernel.h"
+#undef W
+#undef VEC
+#undef VMASK
+#undef NOISE_FN
+#undef NOISE_TARGET
+#undef V_LOAD
+#undef V_STORE
+#undef V_STORE_I
+#undef V_SET1
+#undef V_ADD
+#undef V_SUB
+#undef V_MUL
+#undef V_ABS
+#undef V_GT
+#undef V_GE
+#undef V_LT
+#undef V_MASK_AND
+#undef V_MASK_OR
+#undef V_MASK_NOT
+#undef V_SELECT
+#undef V_TRUNC
+#undef V_I2F
+#endif
+
+#if NOISE_AVX2
+#define W 8
+#define VEC __m256
+#define VMASK __m256
+#define NOISE_FN(name) name##_avx2
+#define NOISE_TARGET __attribute__((target("avx2")))
+#define V_LOAD(p) _mm256_loadu_ps(p)
+#define V_STORE(p, v) _mm256_storeu_ps(p, v)
+#define V_STORE_I(p, v) _mm256_storeu_si256((__m256i *)(p), v)
+#define V_SET1(f) _mm256_set1_ps(f)
+#define V_ADD(a, b) _mm256_add_ps(a, b)
+#define V_SUB(a, b) _mm256_sub_ps(a, b)
+#define V_MUL(a, b) _mm256_mul_ps(a, b)
+#define V_ABS(a) _mm256_andnot_ps(_mm256_set1_ps(-0.0f), a)
+#define V_GT(a, b) _mm256_cmp_ps(a, b, _CMP_GT_OQ)
+#define V_GE(a, b) _mm256_cmp_ps(a, b, _CMP_GE_OQ)
+#define V_LT(a, b) _mm256_cmp_ps(a, b, _CMP_LT_OQ)
+#define V_MASK_AND(a, b) _mm256_and_ps(a, b)
+#define V_MASK_OR(a, b) _mm256_or_ps(a, b)
+#define V_MASK_NOT(a) \
+    _mm256_xor_ps(a, _mm256_castsi256_ps(_mm256_set1_epi32(-1)))
+#define V_SELECT(m, a, b) _mm256_blendv_ps(b, a, m)
+#define V_TRUNC(a) _mm256_cvttps_epi32(a)
+#define V_I2F(a) _mm256_cvtepi32_ps(a)
+#include "noise_kernel.h"
+#undef W
+#undef VEC
+#undef VMASK
+#undef NOISE_FN
+#undef NOISE_TARGET
+#undef V_LOAD
+#undef V_STORE
+#undef V_STORE_I
+#undef V_SET1
+#undef V_ADD
+#undef V_SUB
+#undef V_MUL
+#undef V_ABS
+#undef V_GT
+#undef V_GE
+#undef V_LT
+#undef V_MASK_AND
+#undef V_MASK_OR
+#undef V_MASK_NOT
+#undef V_SELECT
+#undef V_TRUNC
+#undef V_I2F
+#endif
+
+#if NOISE_NEON
+#define W 4
+#define VEC float32x4_t
+#define VMASK uint32x4_t
+#define NOISE_FN(name) name##_neon
+#define NOISE_TARGET
+#define V_LOAD(p) vld1q_f32(p)
+#define V_STORE(p, v) vst1q_f32(p, v)
+#define V_STORE_I(p, v) vst1q_s32(p, v)
+#define V_SET1(f) vdupq_n_f32(f)
+#define V_ADD(a, b) vaddq_f32(a, b)
+#define V_SUB(a, b) vsubq_f32(a, b)
+#define V_MUL(a, b) vmulq_f32(a, b)
+#define V_ABS(a) vabsq_f32(a)
+#define V_GT(a, b) vcgtq_f32(a, b)
+#define V_GE(a, b) vcgeq_f32(a, b)
+#define V_LT(a, b) vcltq_f32(a, b)
+#define V_MASK_AND(a, b) vandq_u32(a, b)
+#define V_MASK_OR(a, b) vorrq_u32(a, b)
+#define V_MASK_NOT(a) vmvnq_u32(a)
+#define V_SELECT(m, a, b) vbslq_f32(m, a, b)
+#define V_TRUNC(a) vcvtq_s32_f32(a)
+#define V_I2F(a) vcvtq_f32_s32(a)
+#include "noise_kernel.h"
+#undef W
+#undef VEC
+#undef VMASK
+#undef NOISE_FN
+#undef NOISE_TARGET
+#undef V_LOAD
+#undef V_STORE
+#undef V_STORE_I
+#undef V_SET1
+#undef V_ADD
+#undef V_SUB
+#undef V_MUL
+#undef V_ABS
+#undef V_GT
+#undef V_GE
+#undef V_LT
+#undef V_MASK_AND
+#undef V_MASK_OR
+#undef V_MASK_NOT
+#undef V_SELECT
+#undef V_TRUNC
+#undef V_I2F
+#endif
+
+typedef void (*noise2_batch_func)(
+    const unsigned char *, const float *, const float *, int,
+    float, float, int, float *);
+typedef void (*noise3_batch_func)(
+    const unsigned char *, const float *, const float *, const float *, int,
+    float, float, int, float *);
+
+/* picked per call, the cpu check is a load of a cached flag */
+static noise2_batch_func noise2_batch_kernel(void) {
+#if NOISE_AVX2
+    if (__builtin_cpu_supports("avx2")) {
+        return noise2_batch_avx2;
+    }
+#endif
+#if NOISE_SSE2
+    return noise2_batch_sse2;
+#elif NOISE_NEON
+    return noise2_batch_neon;
+#else
+    return noise2_batch_scalar;
+#endif
+}
+
+static noise3_batch_func noise3_batch_kernel(void) {
+#if NOISE_AVX2
+    if (__builtin_cpu_supports("avx2")) {
+        return noise3_batch_avx2;
+    }
+#endif
+#if NOISE_SSE2
+    return noise3_batch_sse2;
+#elif NOISE_NEON
+    return noise3_batch_neon;
+#else
+    return noise3_batch_scalar;
+#endif
+}
+
+void simplex2_batch(
+    const Noise *noise, const float *x, const float *y, int count,
+    int octaves, float persistence, float lacunarity, float *out)
+{
+    noise2_batch_func kernel = noise2_batch_kernel();
+    const unsigned char *perm = noise ? noise->perm : PERM;
+    float freq = 1.0f;
+    float amp = 1.0f;
+    float max = 1.0f;
+    int i;
+    kernel(perm, x, y, count, freq, amp, 1, out);
+    for (i = 1; i < octaves; i++) {
+        freq *= lacunarity;
+        amp *= persistence;
+        max += amp;
+        kernel(perm, x, y, count, freq, amp, 0, out);
+    }
+    for (i = 0; i < count; i++) {
+        out[i] = (1 + out[i] / max) / 2;
+    }
+}
+
+void simplex3_batch(
+    const Noise *noise,
+    const float *x, const float *y, const float *z, int count,
+    int octaves, float persistence, float lacunarity, float *out)
+{
+    noise3_batch_func kernel = noise3_batch_kernel();
+    const unsigned char *perm = noise ? noise->perm : PERM;
+    float freq = 1.0f;
+    float amp = 1.0f;
+    float max = 1.0f;
+    int i;
+    kernel(perm, x, y, z, count, freq, amp, 1, out);
+    for (i = 1; i < octaves; i++) {
+        freq *= lacunarity;
+        amp *= persistence;
+        max += amp;
+        kernel(perm, x, y, z, count, freq, amp, 0, out);
+    }
+    for (i = 0; i < count; i++) {
+        out[i] = (1 + out[i] / max) / 2;
+    }
+}
@@ -27,8 +27,17 @@ SOFTWARE.
 #ifndef _noise_h_
 #define _noise_h_
 
+/* a permutation table of its own, for generating with several seeds at
+ * once; noise_init copies the built-in table */
+typedef struct {
+    unsigned char perm[512];
+} Noise;
+
 void seed(unsigned int x);
 
+void noise_init(Noise *noise);
+void noise_seed(Noise *noise, unsigned int x);
+
 float simplex2(
     float x, float y,
     int octaves, float persistence, float lacunarity);
@@ -37,4 +46,17 @@ float simplex3(
     float x, float y, float z,
     int octaves, float persistence, float lacunarity);
 
+/* evaluate count points at once, out must not alias the inputs; results
+ * match simplex2 and simplex3 called on each point as long as noise.c
+ * is built with -ffp-contract=off, a null noise uses the global table
+ * set by seed */
+void simplex2_batch(
+    const Noise *noise, const float *x, const float *y, int count,
+    int octaves, float persistence, float lacunarity, float *out);
+
+void simplex3_batch(
+    const Noise *noise,
+    const float *x, const float *y, const float *z, int count,
+    int octaves, float persistence, float lacunarity, float *out);
+
 #endif
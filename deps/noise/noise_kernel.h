@@ -0,0 +1,180 @@
+/*
+Batched noise kernels, included by noise.c once per instruction set.
+
+The includer defines VEC, VMASK, VINT, W (lanes), NOISE_FN(name),
+NOISE_TARGET and the V_* operations below. Each kernel evaluates one
+octave for W points at a time with the same operation order as noise2
+and noise3, so lanes match the scalar results; the permutation and
+gradient lookups into perm are done per lane.
+*/
+
+#define V_ONES(m) V_SELECT(m, V_SET1(1.0f), V_SET1(0.0f))
+
+/* floorf for |v| < 2^23, larger values are already integral */
+#define V_FLOOR(dst, v) \
+{ \
+    VEC _t = V_I2F(V_TRUNC(v)); \
+    _t = V_SUB(_t, V_ONES(V_GT(_t, v))); \
+    dst = V_SELECT(V_LT(V_ABS(v), V_SET1(8388608.0f)), _t, v); \
+}
+
+#define V_CORNER2(n, px, py, gx, gy) \
+{ \
+    VEC _f = V_SUB(V_SUB(V_SET1(0.5f), V_MUL(px, px)), V_MUL(py, py)); \
+    VEC _d = V_ADD(V_MUL(V_LOAD(gx), px), V_MUL(V_LOAD(gy), py)); \
+    n = V_SELECT(V_GT(_f, V_SET1(0.0f)), \
+        V_MUL(V_MUL(V_MUL(V_MUL(_f, _f), _f), _f), _d), V_SET1(0.0f)); \
+}
+
+#define V_CORNER3(n, p, g) \
+{ \
+    VEC _f = V_SUB(V_SUB(V_SUB(V_SET1(0.6f), V_MUL(p[0], p[0])), \
+        V_MUL(p[1], p[1])), V_MUL(p[2], p[2])); \
+    VEC _d = V_ADD(V_ADD(V_MUL(p[0], V_LOAD(g[0])), \
+        V_MUL(p[1], V_LOAD(g[1]))), V_MUL(p[2], V_LOAD(g[2]))); \
+    n = V_SELECT(V_GT(_f, V_SET1(0.0f)), \
+        V_MUL(V_MUL(V_MUL(V_MUL(_f, _f), _f), _f), _d), V_SET1(0.0f)); \
+}
+
+static NOISE_TARGET void NOISE_FN(noise2_batch)(
+    const unsigned char *perm, const float *x, const float *y, int count,
+    float freq, float amp, int first, float *out)
+{
+    int n = 0;
+    for (; n + W <= count; n += W) {
+        int k, ii[W], jj[W];
+        float o1[W], g[6][W];
+        VEC vx = V_MUL(V_LOAD(x + n), V_SET1(freq));
+        VEC vy = V_MUL(V_LOAD(y + n), V_SET1(freq));
+        VEC s = V_MUL(V_ADD(vx, vy), V_SET1(F2));
+        VEC i, j, t, x0, y0, x1, y1, x2, y2, i1, n0, n1, n2, sum;
+        V_FLOOR(i, V_ADD(vx, s));
+        V_FLOOR(j, V_ADD(vy, s));
+        t = V_MUL(V_ADD(i, j), V_SET1(G2));
+        x0 = V_SUB(vx, V_SUB(i, t));
+        y0 = V_SUB(vy, V_SUB(j, t));
+        i1 = V_ONES(V_GT(x0, y0));
+        x1 = V_ADD(V_SUB(x0, i1), V_SET1(G2));
+        y1 = V_ADD(V_SUB(y0, V_SUB(V_SET1(1.0f), i1)), V_SET1(G2));
+        x2 = V_SUB(V_ADD(x0, V_SET1(G2 * 2.0f)), V_SET1(1.0f));
+        y2 = V_SUB(V_ADD(y0, V_SET1(G2 * 2.0f)), V_SET1(1.0f));
+        V_STORE_I(ii, V_TRUNC(i));
+        V_STORE_I(jj, V_TRUNC(j));
+        V_STORE(o1, i1);
+        for (k = 0; k < W; k++) {
+            int I = ii[k] & 255;
+            int J = jj[k] & 255;
+            int a = o1[k] != 0.0f;
+            int g0 = perm[I + perm[J]] % 12;
+            int g1 = perm[I + a + perm[J + 1 - a]] % 12;
+            int g2 = perm[I + 1 + perm[J + 1]] % 12;
+            g[0][k] = GRAD3[g0][0]; g[1][k] = GRAD3[g0][1];
+            g[2][k] = GRAD3[g1][0]; g[3][k] = GRAD3[g1][1];
+            g[4][k] = GRAD3[g2][0]; g[5][k] = GRAD3[g2][1];
+        }
+        V_CORNER2(n0, x0, y0, g[0], g[1]);
+        V_CORNER2(n1, x1, y1, g[2], g[3]);
+        V_CORNER2(n2, x2, y2, g[4], g[5]);
+        sum = V_MUL(V_ADD(V_ADD(n0, n1), n2), V_SET1(70.0f));
+        if (first) {
+            V_STORE(out + n, sum);
+        }
+        else {
+            V_STORE(out + n,
+                V_ADD(V_LOAD(out + n), V_MUL(sum, V_SET1(amp))));
+        }
+    }
+    if (n < count) {
+        noise2_batch_scalar(perm,
+            x + n, y + n, count - n, freq, amp, first, out + n);
+    }
+}
+
+static NOISE_TARGET void NOISE_FN(noise3_batch)(
+    const unsigned char *perm,
+    const float *x, const float *y, const float *z, int count,
+    float freq, float amp, int first, float *out)
+{
+    int n = 0;
+    for (; n + W <= count; n += W) {
+        int c, k, ii[W], jj[W], kk[W];
+        float o[6][W], g[4][3][W];
+        VEC vx = V_MUL(V_LOAD(x + n), V_SET1(freq));
+        VEC vy = V_MUL(V_LOAD(y + n), V_SET1(freq));
+        VEC vz = V_MUL(V_LOAD(z + n), V_SET1(freq));
+        VEC s = V_MUL(V_ADD(V_ADD(vx, vy), vz), V_SET1(F3));
+        VEC i, j, l, t, o1[3], o2[3], p[4][3], nc[4], sum;
+        VMASK xy, yz, xz, m1x, m1y;
+        V_FLOOR(i, V_ADD(vx, s));
+        V_FLOOR(j, V_ADD(vy, s));
+        V_FLOOR(l, V_ADD(vz, s));
+        t = V_MUL(V_ADD(V_ADD(i, j), l), V_SET1(G3));
+        p[0][0] = V_SUB(vx, V_SUB(i, t));
+        p[0][1] = V_SUB(vy, V_SUB(j, t));
+        p[0][2] = V_SUB(vz, V_SUB(l, t));
+
+        /* the branches of noise3 expressed as masks: o1 is the
+         * largest axis, o2 every axis but the smallest */
+        xy = V_GE(p[0][0], p[0][1]);
+        yz = V_GE(p[0][1], p[0][2]);
+        xz = V_GE(p[0][0], p[0][2]);
+        m1x = V_MASK_AND(xy, xz);
+        m1y = V_MASK_AND(V_MASK_NOT(xy), yz);
+        o1[0] = V_ONES(m1x);
+        o1[1] = V_ONES(m1y);
+        o1[2] = V_ONES(V_MASK_NOT(V_MASK_OR(m1x, m1y)));
+        o2[0] = V_ONES(V_MASK_OR(xy, xz));
+        o2[1] = V_ONES(V_MASK_OR(V_MASK_NOT(xy), yz));
+        o2[2] = V_ONES(V_MASK_NOT(V_MASK_AND(yz, xz)));
+        for (c = 0; c <= 2; c++) {
+            p[3][c] = V_ADD(V_SUB(p[0][c], V_SET1(1.0f)),
+                V_SET1(3.0f * G3));
+            p[2][c] = V_ADD(V_SUB(p[0][c], o2[c]), V_SET1(2.0f * G3));
+            p[1][c] = V_ADD(V_SUB(p[0][c], o1[c]), V_SET1(G3));
+            V_STORE(o[c], o1[c]);
+            V_STORE(o[c + 3], o2[c]);
+        }
+        V_STORE_I(ii, V_TRUNC(i));
+        V_STORE_I(jj, V_TRUNC(j));
+        V_STORE_I(kk, V_TRUNC(l));
+        for (k = 0; k < W; k++) {
+            int I = ii[k] & 255;
+            int J = jj[k] & 255;
+            int K = kk[k] & 255;
+            int a0 = o[0][k] != 0.0f, a1 = o[1][k] != 0.0f;
+            int a2 = o[2][k] != 0.0f, b0 = o[3][k] != 0.0f;
+            int b1 = o[4][k] != 0.0f, b2 = o[5][k] != 0.0f;
+            int h[4];
+            h[0] = perm[I + perm[J + perm[K]]] % 12;
+            h[1] = perm[I + a0 + perm[J + a1 + perm[a2 + K]]] % 12;
+            h[2] = perm[I + b0 + perm[J + b1 + perm[b2 + K]]] % 12;
+            h[3] = perm[I + 1 + perm[J + 1 + perm[K + 1]]] % 12;
+            for (c = 0; c <= 3; c++) {
+                g[c][0][k] = GRAD3[h[c]][0];
+                g[c][1][k] = GRAD3[h[c]][1];
+                g[c][2][k] = GRAD3[h[c]][2];
+            }
+        }
+        for (c = 0; c <= 3; c++) {
+            V_CORNER3(nc[c], p[c], g[c]);
+        }
+        sum = V_MUL(V_ADD(V_ADD(V_ADD(nc[0], nc[1]), nc[2]), nc[3]),
+            V_SET1(32.0f));
+        if (first) {
+            V_STORE(out + n, sum);
+        }
+        else {
+            V_STORE(out + n,
+                V_ADD(V_LOAD(out + n), V_MUL(sum, V_SET1(amp))));
+        }
+    }
+    if (n < count) {
+        noise3_batch_scalar(perm,
+            x + n, y + n, z + n, count - n, freq, amp, first, out + n);
+    }
+}
+
+#undef V_ONES
+#undef V_FLOOR
+#undef V_CORNER2
+#undef V_CORNER3
@@ -12,6 +12,7 @@
 #endif
 
 #include "libretro.h"
+#include "tinycthread.h"
 #include "../src/util.h"
 
 static struct retro_log_callback logging;
@@ -113,6 +114,7 @@ void retro_get_system_av_info(struct retro_system_av_info *info)
 }
 
 static struct retro_rumble_interface rumble;
+static struct retro_perf_callback perf_cb;
 
 void retro_set_environment(retro_environment_t cb)
 {
@@ -132,6 +134,16 @@ void retro_set_environment(retro_environment_t cb)
          "Inverted aim; disabled|enabled" },
       { "craft_analog_sensitivity",
          "Right analog sensitivity; 0.0150|0.0175|0.0200|0.0225|0.0250|0.0275|0.0300|0.0325|0.0350|0.0375|0.0400|0.0425|0.0450|0.0475|0.0500" },
+      { "craft_greedy_meshing",
+         "Greedy meshing; disabled|enabled" },
+      { "craft_pregen_radius",
+         "Bake terrain around the player at load (restart); disabled|4|8|16|32" },
+      { "craft_block_storage",
+         "Block edit storage (restart); sqlite|region" },
+      { "craft_worker_threads",
+         "Chunk worker threads (restart); auto|1|2|3|4|6|8|12|16" },
+      { "craft_net_budget",
+         "Network time per frame (ms); 4|1|2|3|6|8|12|16|unlimited" },
       { "craft_deadzone_radius",
          "Analog deadzone size; 0.010|0.015|0.020|0.025|0.030|0.035|0.040|0.045|0.050|0.055|0.060|0.065|0.070|0.075|0.080|0.085|0.090|0.095|0.100|0.110|0.115|0.120|0.125|0.130|0.135|0.140|0.145|0.150|0.155|0.160|0.165|0.170|0.175|0.180|0.185|0.190|0.195|0.200" },
       { NULL, NULL },
@@ -146,6 +158,9 @@ void retro_set_environment(retro_environment_t cb)
 
    if (cb(RETRO_ENVIRONMENT_GET_LOG_INTERFACE, &logging))
       log_cb = logging.log;
+
+   if (!cb(RETRO_ENVIRONMENT_GET_PERF_INTERFACE, &perf_cb))
+      perf_cb.get_time_usec = NULL;
 }
 
 void retro_set_audio_sample(retro_audio_sample_t cb)
@@ -246,6 +261,51 @@ static void check_variables(bool first_time_startup)
          INVERTED_AIM = 1;
    }
 
+   var.key = "craft_greedy_meshing";
+
+   if (environ_cb(RETRO_ENVIRONMENT_GET_VARIABLE, &var) && var.value)
+   {
+      if (!strcmp(var.value, "disabled"))
+         GREEDY_MESHING = 0;
+      else if (!strcmp(var.value, "enabled"))
+         GREEDY_MESHING = 1;
+   }
+
+   var.key = "craft_pregen_radius";
+
+   if (environ_cb(RETRO_ENVIRONMENT_GET_VARIABLE, &var) && var.value)
+   {
+      if (!strcmp(var.value, "disabled"))
+         PREGEN_RADIUS = 0;
+      else
+         PREGEN_RADIUS = atoi(var.value);
+   }
+
+   var.key = "craft_block_storage";
+
+   if (environ_cb(RETRO_ENVIRONMENT_GET_VARIABLE, &var) && var.value)
+      BLOCK_REGIONS = !strcmp(var.value, "region");
+
+   var.key = "craft_worker_threads";
+
+   if (environ_cb(RETRO_ENVIRONMENT_GET_VARIABLE, &var) && var.value)
+   {
+      if (!strcmp(var.value, "auto"))
+         WORKER_THREADS = 0;
+      else
+         WORKER_THREADS = atoi(var.value);
+   }
+
+   var.key = "craft_net_budget";
+
+   if (environ_cb(RETRO_ENVIRONMENT_GET_VARIABLE, &var) && var.value)
+   {
+      if (!strcmp(var.value, "unlimited"))
+         NET_BUDGET = 0;
+      else
+         NET_BUDGET = atoi(var.value);
+   }
+
    var.key = "craft_analog_sensitivity";
 
    if (environ_cb(RETRO_ENVIRONMENT_GET_VARIABLE, &var) && var.value)
@@ -448,3 +508,18 @@ double glfwGetTime(void)
    double val = amount_frames;
    return val;
 }
+
+/* seconds on the frontend's clock, or on the monotonic clock when the
+ * frontend has no perf interface */
+double wall_clock(void)
+{
+   struct timespec ts;
+   if (perf_cb.get_time_usec)
+      return perf_cb.get_time_usec() / 1000000.0;
+#ifdef CLOCK_MONOTONIC
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+#else
+   clock_gettime(TIME_UTC, &ts);
+#endif
+   return ts.tv_sec + ts.tv_nsec / 1e9;
+}
@@ -7,6 +7,7 @@ import random
 import re
 import requests
 import sqlite3
+import struct
 import sys
 import threading
 import time
@@ -20,6 +21,9 @@ LOG_PATH = 'log.txt'
 
 CHUNK_SIZE = 32
 BUFFER_SIZE = 4096
+PROTOCOL_VERSION = 3
+CHUNK_DATA_SIZE = 4096
+FRAME_BIT = 0x80
 COMMIT_INTERVAL = 5
 
 AUTH_REQUIRED = True
@@ -39,6 +43,7 @@ ALLOWED_ITEMS = set([
 AUTHENTICATE = 'A'
 BLOCK = 'B'
 CHUNK = 'C'
+CHUNK_DATA = 'H'
 DISCONNECT = 'D'
 KEY = 'K'
 LIGHT = 'L'
@@ -51,6 +56,33 @@ TIME = 'E'
 VERSION = 'V'
 YOU = 'U'
 
+# payload layouts of framed messages (protocol 2): i is a zigzag varint,
+# x and z are zigzag varints relative to the chunk origin given by the
+# first two fields, f and d are little endian floats and doubles and s is
+# text running to the end of the payload
+SERVER_FRAMES = {
+    BLOCK: 'iixizi',
+    CHUNK: 'ii',
+    DISCONNECT: 'i',
+    KEY: 'iii',
+    LIGHT: 'iixizi',
+    NICK: 'is',
+    POSITION: 'ifffff',
+    REDRAW: 'ii',
+    SIGN: 'iixizis',
+    TALK: 's',
+    TIME: 'di',
+    YOU: 'ifffff',
+}
+CLIENT_FRAMES = {
+    BLOCK: 'iiii',
+    CHUNK: 'iii',
+    LIGHT: 'iiii',
+    POSITION: 'fffff',
+    SIGN: 'iiiis',
+    TALK: 's',
+}
+
 try:
     from config import *
 except ImportError:
@@ -69,6 +101,116 @@ def chunked(x):
 def packet(*args):
     return '%s\n' % ','.join(map(str, args))
 
+def encode_varint(value):
+    result = []
+    while value >= 0x80:
+        result.append(chr(value & 0x7f | 0x80))
+        value >>= 7
+    result.append(chr(value))
+    return ''.join(result)
+
+def decode_varint(data, index):
+    value = shift = 0
+    while True:
+        byte = ord(data[index])
+        index += 1
+        value |= (byte & 0x7f) << shift
+        if not byte & 0x80:
+            return value, index
+        shift += 7
+
+def frame(*args):
+    command, args = args[0], args[1:]
+    layout = SERVER_FRAMES[command]
+    payload = []
+    for kind, value in zip(layout, args):
+        if kind == 's':
+            payload.append(str(value))
+            continue
+        if kind == 'f':
+            payload.append(struct.pack('<f', float(value)))
+            continue
+        if kind == 'd':
+            payload.append(struct.pack('<d', float(value)))
+            continue
+        value = int(value)
+        if kind == 'x':
+            value -= args[0] * CHUNK_SIZE
+        elif kind == 'z':
+            value -= args[1] * CHUNK_SIZE
+        payload.append(encode_varint(zigzag(value)))
+    payload = ''.join(payload)
+    return '%s%s%s' % (
+        chr(ord(command) | FRAME_BIT), encode_varint(len(payload)), payload)
+
+def zigzag(value):
+    return value * 2 if value >= 0 else -value * 2 - 1
+
+def chunk_frame(p, q, key, blocks, lights, signs):
+    # protocol 3: a whole chunk sync as the key and counted lists of
+    # blocks, lights and signs relative to the chunk origin
+    x0, z0 = p * CHUNK_SIZE, q * CHUNK_SIZE
+    payload = [
+        encode_varint(zigzag(p)), encode_varint(zigzag(q)),
+        encode_varint(key)]
+    for rows in (blocks, lights):
+        payload.append(encode_varint(len(rows)))
+        for x, y, z, w in rows:
+            payload.append(''.join(encode_varint(zigzag(v))
+                for v in (x - x0, y, z - z0, w)))
+    payload.append(encode_varint(len(signs)))
+    for x, y, z, face, text in signs:
+        text = str(text)
+        payload.append(''.join(encode_varint(zigzag(v))
+            for v in (x - x0, y, z - z0, face)))
+        payload.append(encode_varint(len(text)))
+        payload.append(text)
+    payload = ''.join(payload)
+    return '%s%s%s' % (
+        chr(ord(CHUNK_DATA) | FRAME_BIT), encode_varint(len(payload)),
+        payload)
+
+def unframe(command, payload):
+    args = []
+    index = 0
+    for kind in CLIENT_FRAMES[command]:
+        if kind == 's':
+            args.append(payload[index:])
+            index = len(payload)
+        elif kind == 'f':
+            args.append(struct.unpack('<f', payload[index:index + 4])[0])
+            index += 4
+        else:
+            value, index = decode_varint(payload, index)
+            args.append(value >> 1 if not value & 1 else -(value >> 1) - 1)
+    if index != len(payload):
+        raise ValueError('bad frame')
+    return args
+
+def split_message(data):
+    # returns (command, payload, size) for the first complete message in data
+    # or None while it is still arriving; text lines are passed up whole
+    if data[0] < chr(FRAME_BIT):
+        index = data.find('\n')
+        if index < 0:
+            return None
+        line = data[:index]
+        if line.endswith('\r'):
+            line = line[:-1]
+        return None, line, index + 1
+    for index in range(1, min(len(data), 6)):
+        if not ord(data[index]) & 0x80:
+            break
+    else:
+        if len(data) < 6:
+            return None
+        raise ValueError('bad frame')
+    length, start = decode_varint(data, 1)
+    if len(data) < start + length:
+        return None
+    command = chr(ord(data[0]) & ~FRAME_BIT)
+    return command, data[start:start + length], start + length
+
 class RateLimiter(object):
     def __init__(self, rate, per):
         self.rate = float(rate)
@@ -109,19 +251,23 @@ class Handler(SocketServer.BaseRequestHandler):
         model = self.server.model
         model.enqueue(model.on_connect, self)
         try:
-            buf = []
+            buf = ''
             while True:
                 data = self.request.recv(BUFFER_SIZE)
                 if not data:
                     break
-                buf.extend(data.replace('\r\n', '\n'))
-                while '\n' in buf:
-                    index = buf.index('\n')
-                    line = ''.join(buf[:index])
-                    buf = buf[index + 1:]
-                    if not line:
+                buf += data
+                while buf:
+                    message = split_message(buf)
+                    if message is None:
+                        break
+                    command, payload, size = message
+                    buf = buf[size:]
+                    if command is None and not payload:
                         continue
-                    if line[0] == POSITION:
+                    if command is not None and command not in CLIENT_FRAMES:
+                        continue
+                    if (command or payload[0]) == POSITION:
                         if self.position_limiter.tick():
                             log('RATE', self.client_id)
                             self.stop()
@@ -131,7 +277,12 @@ class Handler(SocketServer.BaseRequestHandler):
                             log('RATE', self.client_id)
                             self.stop()
                             return
-                    model.enqueue(model.on_data, self, line)
+                    if command is None:
+                        model.enqueue(model.on_data, self, payload)
+                    else:
+                        model.enqueue(model.on_frame, self, command, payload)
+        except ValueError:
+            log('FRAME', self.client_id)
         finally:
             model.enqueue(model.on_disconnect, self)
     def finish(self):
@@ -163,8 +314,12 @@ class Handler(SocketServer.BaseRequestHandler):
     def send_raw(self, data):
         if data:
             self.queue.put(data)
+    def encode(self, *args):
+        if self.version > 1:
+            return frame(*args)
+        return packet(*args)
     def send(self, *args):
-        self.send_raw(packet(*args))
+        self.send_raw(self.encode(*args))
 
 class Model(object):
     def __init__(self, seed):
@@ -303,15 +458,30 @@ class Model(object):
         if command in self.commands:
             func = self.commands[command]
             func(client, *args)
+    def on_frame(self, client, command, payload):
+        try:
+            args = unframe(command, payload)
+        except (ValueError, IndexError, struct.error):
+            log('FRAME', client.client_id)
+            return
+        if command in self.commands:
+            func = self.commands[command]
+            func(client, *args)
     def on_disconnect(self, client):
         log('DISC', client.client_id, *client.client_address)
         self.clients.remove(client)
         self.send_disconnect(client)
         self.send_talk('%s has disconnected from the server.' % client.nick)
     def on_version(self, client, version):
+        version = int(version)
         if client.version is not None:
+            # a repeated V offers an upgrade, confirmed with the version
+            # in use as the last text line before framing starts
+            version = min(version, PROTOCOL_VERSION)
+            if version > client.version:
+                client.send_raw(packet(VERSION, version))
+                client.version = version
             return
-        version = int(version)
         if version != 1:
             client.stop()
             return
@@ -337,42 +507,52 @@ class Model(object):
         # TODO: has left message if was already authenticated
         self.send_talk('%s has joined the game.' % client.nick)
     def on_chunk(self, client, p, q, key=0):
-        packets = []
         p, q, key = map(int, (p, q, key))
         query = (
             'select rowid, x, y, z, w from block where '
-            'p = :p and q = :q and rowid > :key;'
+            'p = :p and q = :q and rowid > :key order by rowid;'
         )
-        rows = self.execute(query, dict(p=p, q=q, key=key))
-        max_rowid = 0
-        blocks = 0
-        for rowid, x, y, z, w in rows:
-            blocks += 1
-            packets.append(packet(BLOCK, p, q, x, y, z, w))
-            max_rowid = max(max_rowid, rowid)
+        rows = list(self.execute(query, dict(p=p, q=q, key=key)))
         query = (
             'select x, y, z, w from light where '
             'p = :p and q = :q;'
         )
-        rows = self.execute(query, dict(p=p, q=q))
-        lights = 0
-        for x, y, z, w in rows:
-            lights += 1
-            packets.append(packet(LIGHT, p, q, x, y, z, w))
+        lights = list(self.execute(query, dict(p=p, q=q)))
         query = (
             'select x, y, z, face, text from sign where '
             'p = :p and q = :q;'
         )
-        rows = self.execute(query, dict(p=p, q=q))
-        signs = 0
-        for x, y, z, face, text in rows:
-            signs += 1
-            packets.append(packet(SIGN, p, q, x, y, z, face, text))
-        if blocks:
-            packets.append(packet(KEY, p, q, max_rowid))
-        if blocks or lights or signs:
-            packets.append(packet(REDRAW, p, q))
-        packets.append(packet(CHUNK, p, q))
+        signs = list(self.execute(query, dict(p=p, q=q)))
+        if client.version > 2:
+            self.send_chunk_data(client, p, q, rows, lights, signs)
+            return
+        packets = []
+        max_rowid = 0
+        for rowid, x, y, z, w in rows:
+            packets.append(client.encode(BLOCK, p, q, x, y, z, w))
+            max_rowid = max(max_rowid, rowid)
+        for x, y, z, w in lights:
+            packets.append(client.encode(LIGHT, p, q, x, y, z, w))
+        for x, y, z, face, text in signs:
+            packets.append(client.encode(SIGN, p, q, x, y, z, face, text))
+        if rows:
+            packets.append(client.encode(KEY, p, q, max_rowid))
+        if rows or lights or signs:
+            packets.append(client.encode(REDRAW, p, q))
+        packets.append(client.encode(CHUNK, p, q))
+        client.send_raw(''.join(packets))
+    def send_chunk_data(self, client, p, q, rows, lights, signs):
+        # large syncs are split so a frame stays well inside the client's
+        # receive queue; lights, signs and the key ride with the last part,
+        # so a client cut off midway asks for the whole sync again
+        packets = []
+        max_rowid = rows[-1][0] if rows else 0
+        for start in range(0, max(len(rows), 1), CHUNK_DATA_SIZE):
+            part = rows[start:start + CHUNK_DATA_SIZE]
+            blocks = [row[1:] for row in part]
+            last = start + CHUNK_DATA_SIZE >= len(rows)
+            packets.append(chunk_frame(p, q, max_rowid if last else 0,
+                blocks, lights if last else [], signs if last else []))
         client.send_raw(''.join(packets))
     def on_block(self, client, x, y, z, w):
         x, y, z, w = map(int, (x, y, z, w))
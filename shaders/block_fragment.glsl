@@ -7,6 +7,7 @@ uniform float daylight;
 uniform int ortho;
 
 varying vec2 fragment_uv;
+varying vec2 fragment_tile;
 varying float fragment_ao;
 varying float fragment_light;
 varying float fog_factor;
@@ -16,7 +17,12 @@ varying float diffuse;
 const float pi = 3.14159265;
 
 void main() {
-    vec3 color = vec3(texture2D(sampler, fragment_uv));
+    vec2 uv = fragment_uv;
+    if (fragment_tile.x >= 0.0) {
+        uv = fragment_tile + 1.0 / 2048.0 +
+            fract(fragment_uv) * (0.0625 - 2.0 / 2048.0);
+    }
+    vec3 color = vec3(texture2D(sampler, uv));
     if (color == vec3(1.0, 0.0, 1.0)) {
         discard;
     }
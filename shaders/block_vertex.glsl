@@ -10,6 +10,7 @@ attribute vec3 normal;
 attribute vec4 uv;
 
 varying vec2 fragment_uv;
+varying vec2 fragment_tile;
 varying float fragment_ao;
 varying float fragment_light;
 varying float fog_factor;
@@ -21,7 +22,16 @@ const vec3 light_direction = normalize(vec3(-1.0, 1.0, -1.0));
 
 void main() {
     gl_Position = matrix * position;
-    fragment_uv = uv.xy;
+    if (uv.x < 0.0) {
+        vec2 t = -uv.xy - 1.0;
+        vec2 tile = floor(t / 64.0);
+        fragment_tile = tile * 0.0625;
+        fragment_uv = t - tile * 64.0;
+    }
+    else {
+        fragment_tile = vec2(-1.0);
+        fragment_uv = uv.xy;
+    }
     fragment_ao = 0.3 + (1.0 - uv.z) * 0.7;
     fragment_light = uv.w;
     diffuse = max(0.0, dot(normal, light_direction));
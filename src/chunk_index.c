@@ -0,0 +1,80 @@
+#include <stdlib.h>
+#include <string.h>
+#include "chunk_index.h"
+
+/* an empty bucket has slot -1 */
+static unsigned chunk_hash(ChunkIndex *index, int p, int q) {
+    unsigned h = (unsigned)p * 73856093u ^ (unsigned)q * 19349663u;
+    return (h ^ (h >> 16)) & index->mask;
+}
+
+static unsigned chunk_index_bucket(ChunkIndex *index, int p, int q) {
+    unsigned i = chunk_hash(index, p, q);
+    while (index->entries[i].slot >= 0) {
+        ChunkIndexEntry *entry = index->entries + i;
+        if (entry->p == p && entry->q == q) {
+            break;
+        }
+        i = (i + 1) & index->mask;
+    }
+    return i;
+}
+
+void chunk_index_alloc(ChunkIndex *index, int size) {
+    index->entries = (ChunkIndexEntry *)malloc(
+        sizeof(ChunkIndexEntry) * size);
+    index->mask = size - 1;
+    chunk_index_clear(index);
+}
+
+void chunk_index_free(ChunkIndex *index) {
+    free(index->entries);
+    index->entries = 0;
+    index->mask = 0;
+}
+
+void chunk_index_clear(ChunkIndex *index) {
+    unsigned i;
+    for (i = 0; i <= index->mask; i++) {
+        index->entries[i].slot = -1;
+    }
+}
+
+int chunk_index_get(ChunkIndex *index, int p, int q) {
+    return index->entries[chunk_index_bucket(index, p, q)].slot;
+}
+
+void chunk_index_set(ChunkIndex *index, int p, int q, int slot) {
+    ChunkIndexEntry *entry = index->entries +
+        chunk_index_bucket(index, p, q);
+    entry->p = p;
+    entry->q = q;
+    entry->slot = slot;
+}
+
+/* backward-shift deletion, so no tombstones build up */
+void chunk_index_remove(ChunkIndex *index, int p, int q) {
+    unsigned i = chunk_index_bucket(index, p, q);
+    unsigned j = i;
+    if (index->entries[i].slot < 0) {
+        return;
+    }
+    index->entries[i].slot = -1;
+    for (;;) {
+        unsigned k;
+        ChunkIndexEntry *entry;
+        j = (j + 1) & index->mask;
+        entry = index->entries + j;
+        if (entry->slot < 0) {
+            break;
+        }
+        k = chunk_hash(index, entry->p, entry->q);
+        // leave entries whose home bucket lies in (i, j]
+        if (i <= j ? (i < k && k <= j) : (i < k || k <= j)) {
+            continue;
+        }
+        index->entries[i] = *entry;
+        entry->slot = -1;
+        i = j;
+    }
+}
@@ -0,0 +1,24 @@
+#ifndef _chunk_index_h_
+#define _chunk_index_h_
+
+/* an open addressing table from chunk (p, q) to its slot in the chunk
+ * array; size is a power of two, kept at least twice the slot count */
+typedef struct {
+    int p;
+    int q;
+    int slot;
+} ChunkIndexEntry;
+
+typedef struct {
+    ChunkIndexEntry *entries;
+    unsigned mask;
+} ChunkIndex;
+
+void chunk_index_alloc(ChunkIndex *index, int size);
+void chunk_index_free(ChunkIndex *index);
+void chunk_index_clear(ChunkIndex *index);
+int chunk_index_get(ChunkIndex *index, int p, int q);
+void chunk_index_set(ChunkIndex *index, int p, int q, int slot);
+void chunk_index_remove(ChunkIndex *index, int p, int q);
+
+#endif
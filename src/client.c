@@ -12,26 +12,64 @@
 #endif
 #endif
 
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include "client.h"
 #include "tinycthread.h"
 
-#include <retro_timers.h>
-
 #define QUEUE_SIZE 1048576
 #define RECV_SIZE 4096
+#define SEGMENT_SIZE 65536
+#define SPARE_SEGMENTS 4
+#define FRAME_SIZE 1024
+/* the server splits chunk syncs into H frames of CHUNK_DATA_SIZE blocks,
+ * each at most four five byte varints; anything past twice that is not
+ * a message from a real server */
+#define CHUNK_DATA_SIZE 4096
+#define MAX_MESSAGE_SIZE (2 * CHUNK_DATA_SIZE * 20)
+
+#ifndef SHUT_RDWR
+#define SHUT_RDWR SD_BOTH
+#endif
+
+#define ZIGZAG(v) \
+    (((unsigned int)(v) << 1) ^ (unsigned int)((v) < 0 ? -1 : 0))
+
+typedef struct {
+    unsigned char data[FRAME_SIZE];
+    int size;
+} Frame;
+
+/* received bytes live in a chain of segments: the receive thread recvs
+ * straight into the last one and the main thread borrows runs of whole
+ * messages in place. only a message cut off by the end of a segment is
+ * copied, into the start of the next */
+typedef struct Segment {
+    struct Segment *next;
+    char *data;
+    int capacity;
+    int size;
+    int complete;
+    int taken;
+    int borrowed;
+} Segment;
 
 static int client_enabled = 0;
+static int protocol = 1;
 static int running = 0;
 static int sd = 0;
 static int bytes_sent = 0;
 static int bytes_received = 0;
-static char *queue = 0;
-static int qsize = 0;
+static int bytes_queued = 0;
+static Segment *head = 0;
+static Segment *tail = 0;
+static Segment *spare = 0;
+static int spare_count = 0;
 static thrd_t recv_thread;
 static mtx_t mutex;
+static cnd_t space;
 
 void client_enable(void)
 {
@@ -77,13 +115,183 @@ void client_send(char *data)
     }
 }
 
+static void frame_put_varint(Frame *frame, unsigned int value)
+{
+    if (frame->size + 5 > FRAME_SIZE)
+        return;
+    while (value >= 0x80) {
+        frame->data[frame->size++] = (value & 0x7f) | 0x80;
+        value >>= 7;
+    }
+    frame->data[frame->size++] = value;
+}
+
+static void frame_put_int(Frame *frame, int value)
+{
+    frame_put_varint(frame, ZIGZAG(value));
+}
+
+static void frame_put_float(Frame *frame, float value)
+{
+    uint32_t bits;
+    int i;
+    if (frame->size + 4 > FRAME_SIZE)
+        return;
+    memcpy(&bits, &value, sizeof(bits));
+    for (i = 0; i < 4; i++)
+        frame->data[frame->size++] = (bits >> (i * 8)) & 0xff;
+}
+
+static void frame_put_text(Frame *frame, const char *text)
+{
+    int length = strlen(text);
+    if (length > FRAME_SIZE - frame->size)
+        length = FRAME_SIZE - frame->size;
+    memcpy(frame->data + frame->size, text, length);
+    frame->size += length;
+}
+
+static void client_send_frame(int type, Frame *frame)
+{
+    unsigned char buffer[FRAME_SIZE + 6];
+    unsigned int value = frame->size;
+    int size = 0;
+    buffer[size++] = type | FRAME_BIT;
+    while (value >= 0x80) {
+        buffer[size++] = (value & 0x7f) | 0x80;
+        value >>= 7;
+    }
+    buffer[size++] = value;
+    memcpy(buffer + size, frame->data, frame->size);
+    if (client_sendall(sd, (char *)buffer, size + frame->size) == -1)
+    {
+        perror("client_sendall");
+        exit(1);
+    }
+}
+
+unsigned int frame_varint(FrameReader *reader)
+{
+    unsigned int value = 0;
+    int shift = 0;
+    while (reader->data < reader->end && shift < 32) {
+        unsigned char byte = *reader->data++;
+        value |= (unsigned int)(byte & 0x7f) << shift;
+        if (!(byte & 0x80))
+            return value;
+        shift += 7;
+    }
+    reader->error = 1;
+    return 0;
+}
+
+/* a list length; a list of that many entries of at least size bytes
+ * each that cannot fit in the rest of the payload is a bad frame */
+unsigned int frame_count(FrameReader *reader, int size)
+{
+    unsigned int count = frame_varint(reader);
+    if (count > (unsigned int)(reader->end - reader->data) / size) {
+        reader->error = 1;
+        return 0;
+    }
+    return count;
+}
+
+int frame_int(FrameReader *reader)
+{
+    unsigned int value = frame_varint(reader);
+    return (int)(value >> 1) ^ -(int)(value & 1);
+}
+
+float frame_float(FrameReader *reader)
+{
+    uint32_t bits = 0;
+    float value;
+    int i;
+    if (reader->end - reader->data < 4) {
+        reader->error = 1;
+        return 0;
+    }
+    for (i = 0; i < 4; i++)
+        bits |= (uint32_t)*reader->data++ << (i * 8);
+    memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+
+double frame_double(FrameReader *reader)
+{
+    uint64_t bits = 0;
+    double value;
+    int i;
+    if (reader->end - reader->data < 8) {
+        reader->error = 1;
+        return 0;
+    }
+    for (i = 0; i < 8; i++)
+        bits |= (uint64_t)*reader->data++ << (i * 8);
+    memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+
+/* text runs to the end of the payload */
+void frame_text(FrameReader *reader, char *text, int length)
+{
+    int size = reader->end - reader->data;
+    if (size > length - 1)
+        size = length - 1;
+    memcpy(text, reader->data, size);
+    text[size] = '\0';
+    reader->data = reader->end;
+}
+
+/* size of the complete message at data, 0 while it is still arriving,
+ * -1 for a length varint past five bytes or a message longer than
+ * MAX_MESSAGE_SIZE, after which the stream cannot be trusted */
+int client_message_size(const char *data, int length)
+{
+    const unsigned char *bytes = (const unsigned char *)data;
+    const char *end;
+    if (length <= 0)
+        return 0;
+    if (bytes[0] & FRAME_BIT) {
+        unsigned int size = 0;
+        int i;
+        for (i = 1; i < length; i++) {
+            size |= (unsigned int)(bytes[i] & 0x7f) << ((i - 1) * 7);
+            if (!(bytes[i] & 0x80)) {
+                if (size > MAX_MESSAGE_SIZE)
+                    return -1;
+                return size <= (unsigned int)(length - i - 1) ?
+                    i + 1 + size : 0;
+            }
+            if (i == 5)
+                return -1;
+        }
+        return 0;
+    }
+    end = memchr(data, '\n', length);
+    if (!end)
+        return length > MAX_MESSAGE_SIZE ? -1 : 0;
+    return end - data + 1;
+}
+
 void client_version(int version)
 {
     char buffer[1024];
     if (!client_enabled)
         return;
-    snprintf(buffer, 1024, "V,%d\n", version);
-    client_send(buffer);
+    /* a protocol 1 server drops any other version but ignores a repeated
+     * V, so newer versions are only offered after the first */
+    client_send("V,1\n");
+    if (version > 1) {
+        snprintf(buffer, 1024, "V,%d\n", version);
+        client_send(buffer);
+    }
+}
+
+void client_protocol(int version)
+{
+    protocol = version < PROTOCOL_VERSION ? version : PROTOCOL_VERSION;
 }
 
 void client_login(const char *username, const char *identity_token)
@@ -110,6 +318,17 @@ void client_position(float x, float y, float z, float rx, float ry)
     if (distance < 0.0001)
         return;
     px = x; py = y; pz = z; prx = rx; pry = ry;
+    if (protocol >= 2) {
+        Frame frame;
+        frame.size = 0;
+        frame_put_float(&frame, x);
+        frame_put_float(&frame, y);
+        frame_put_float(&frame, z);
+        frame_put_float(&frame, rx);
+        frame_put_float(&frame, ry);
+        client_send_frame('P', &frame);
+        return;
+    }
     snprintf(buffer, 1024, "P,%.2f,%.2f,%.2f,%.2f,%.2f\n", x, y, z, rx, ry);
     client_send(buffer);
 }
@@ -119,6 +338,15 @@ void client_chunk(int p, int q, int key)
     char buffer[1024];
     if (!client_enabled)
         return;
+    if (protocol >= 2) {
+        Frame frame;
+        frame.size = 0;
+        frame_put_int(&frame, p);
+        frame_put_int(&frame, q);
+        frame_put_int(&frame, key);
+        client_send_frame('C', &frame);
+        return;
+    }
     snprintf(buffer, 1024, "C,%d,%d,%d\n", p, q, key);
     client_send(buffer);
 }
@@ -128,6 +356,16 @@ void client_block(int x, int y, int z, int w)
     char buffer[1024];
     if (!client_enabled)
         return;
+    if (protocol >= 2) {
+        Frame frame;
+        frame.size = 0;
+        frame_put_int(&frame, x);
+        frame_put_int(&frame, y);
+        frame_put_int(&frame, z);
+        frame_put_int(&frame, w);
+        client_send_frame('B', &frame);
+        return;
+    }
     snprintf(buffer, 1024, "B,%d,%d,%d,%d\n", x, y, z, w);
     client_send(buffer);
 }
@@ -137,6 +375,16 @@ void client_light(int x, int y, int z, int w)
     char buffer[1024];
     if (!client_enabled)
         return;
+    if (protocol >= 2) {
+        Frame frame;
+        frame.size = 0;
+        frame_put_int(&frame, x);
+        frame_put_int(&frame, y);
+        frame_put_int(&frame, z);
+        frame_put_int(&frame, w);
+        client_send_frame('L', &frame);
+        return;
+    }
     snprintf(buffer, 1024, "L,%d,%d,%d,%d\n", x, y, z, w);
     client_send(buffer);
 }
@@ -146,6 +394,17 @@ void client_sign(int x, int y, int z, int face, const char *text)
     char buffer[1024];
     if (!client_enabled)
         return;
+    if (protocol >= 2) {
+        Frame frame;
+        frame.size = 0;
+        frame_put_int(&frame, x);
+        frame_put_int(&frame, y);
+        frame_put_int(&frame, z);
+        frame_put_int(&frame, face);
+        frame_put_text(&frame, text);
+        client_send_frame('S', &frame);
+        return;
+    }
     snprintf(buffer, 1024, "S,%d,%d,%d,%d,%s\n", x, y, z, face, text);
     client_send(buffer);
 }
@@ -157,73 +416,177 @@ void client_talk(const char *text)
         return;
     if (strlen(text) == 0)
         return;
+    if (protocol >= 2) {
+        Frame frame;
+        frame.size = 0;
+        frame_put_text(&frame, text);
+        client_send_frame('T', &frame);
+        return;
+    }
     snprintf(buffer, 1024, "T,%s\n", text);
     client_send(buffer);
 }
 
-char *client_recv()
+static Segment *segment_alloc(int capacity)
+{
+   Segment *segment;
+   while (spare) {
+      segment = spare;
+      spare = segment->next;
+      spare_count--;
+      if (segment->capacity >= capacity) {
+         segment->next = 0;
+         segment->size = segment->complete = segment->taken = 0;
+         segment->borrowed = 0;
+         return segment;
+      }
+      free(segment->data);
+      free(segment);
+   }
+   segment = (Segment *)calloc(1, sizeof(Segment));
+   segment->data = (char *)malloc(capacity);
+   segment->capacity = capacity;
+   return segment;
+}
+
+static void segment_free(Segment *segment)
+{
+   if (spare_count < SPARE_SEGMENTS) {
+      segment->next = spare;
+      spare = segment;
+      spare_count++;
+      return;
+   }
+   free(segment->data);
+   free(segment);
+}
+
+/* called by the receive thread with the mutex held once the tail has no
+ * room for another recv, moves a partial message along to a new tail */
+static Segment *segment_next(Segment *segment)
 {
+   int partial = segment->size - segment->complete;
+   int capacity = partial * 2 + RECV_SIZE;
+   Segment *next = segment_alloc(
+      capacity > SEGMENT_SIZE ? capacity : SEGMENT_SIZE);
+   memcpy(next->data, segment->data + segment->complete, partial);
+   next->size = partial;
+   segment->size = segment->complete;
+   segment->next = next;
+   return next;
+}
+
+/* the next run of whole messages, borrowed until client_release */
+char *client_recv(int *length)
+{
+   Segment *segment;
    char *result = 0;
-   char *p      = NULL;
+   *length = 0;
    if (!client_enabled)
       return 0;
    mtx_lock(&mutex);
-   p = queue + qsize - 1;
-
-   while (p >= queue && *p != '\n')
-      p--;
-
-   if (p >= queue)
+   for (segment = head; segment; segment = segment->next)
    {
-      int remaining;
-      int length = p - queue + 1;
-      result = malloc(sizeof(char) * (length + 1));
-      memcpy(result, queue, sizeof(char) * length);
-      result[length] = '\0';
-      remaining = qsize - length;
-      memmove(queue, p + 1, remaining);
-      qsize -= length;
-      bytes_received += length;
+      if (segment->taken < segment->complete)
+      {
+         result = segment->data + segment->taken;
+         *length = segment->complete - segment->taken;
+         segment->taken = segment->complete;
+         segment->borrowed++;
+         bytes_queued -= *length;
+         bytes_received += *length;
+         break;
+      }
    }
    mtx_unlock(&mutex);
    return result;
 }
 
+void client_release(char *data)
+{
+   Segment *segment;
+   if (!data)
+      return;
+   mtx_lock(&mutex);
+   for (segment = head; segment; segment = segment->next)
+   {
+      if (data >= segment->data && data < segment->data + segment->size)
+      {
+         segment->borrowed--;
+         break;
+      }
+   }
+   while (head != tail && !head->borrowed && head->taken == head->size)
+   {
+      segment = head;
+      head = head->next;
+      segment_free(segment);
+   }
+   cnd_signal(&space);
+   mtx_unlock(&mutex);
+}
+
+void client_stats(int *sent, int *received, int *queued)
+{
+   mtx_lock(&mutex);
+   *sent = bytes_sent;
+   *received = bytes_received;
+   *queued = bytes_queued;
+   mtx_unlock(&mutex);
+}
+
 int recv_worker(void *arg)
 {
-   char *data = malloc(sizeof(char) * RECV_SIZE);
    while (1)
    {
+      Segment *segment;
       int length;
-      if ((length = recv(sd, data, RECV_SIZE - 1, 0)) <= 0)
+      int complete;
+      int n;
+      mtx_lock(&mutex);
+      while (running && bytes_queued >= QUEUE_SIZE)
+         cnd_wait(&space, &mutex);
+      if (!running)
       {
-         if (running)
-         {
-            perror("recv");
-            exit(1);
-         }
-         else
-            break;
+         mtx_unlock(&mutex);
+         break;
       }
-      data[length] = '\0';
+      if (tail->capacity - tail->size < RECV_SIZE)
+         tail = segment_next(tail);
+      segment = tail;
+      mtx_unlock(&mutex);
 
-      while (1)
+      /* bytes past complete belong to this thread alone */
+      if ((length = recv(sd, segment->data + segment->size,
+                  segment->capacity - segment->size, 0)) <= 0)
       {
-         int done = 0;
+         int stopping;
          mtx_lock(&mutex);
-         if (qsize + length < QUEUE_SIZE)
+         stopping = !running;
+         mtx_unlock(&mutex);
+         if (!stopping)
          {
-            memcpy(queue + qsize, data, sizeof(char) * (length + 1));
-            qsize += length;
-            done = 1;
+            perror("recv");
+            exit(1);
          }
-         mtx_unlock(&mutex);
-         if (done)
-            break;
-         retro_sleep(0);
+         break;
+      }
+      complete = segment->complete;
+      while ((n = client_message_size(segment->data + complete,
+                  segment->size + length - complete)) > 0)
+         complete += n;
+      if (n < 0)
+      {
+         fprintf(stderr, "recv: malformed message from server\n");
+         exit(1);
       }
+
+      mtx_lock(&mutex);
+      segment->size += length;
+      bytes_queued += complete - segment->complete;
+      segment->complete = complete;
+      mtx_unlock(&mutex);
    }
-   free(data);
    return 0;
 }
 
@@ -273,9 +636,10 @@ void client_start(void)
     if (!client_enabled)
         return;
     running = 1;
-    queue = (char *)calloc(QUEUE_SIZE, sizeof(char));
-    qsize = 0;
+    head = tail = segment_alloc(SEGMENT_SIZE);
+    bytes_queued = 0;
     mtx_init(&mutex, mtx_plain);
+    cnd_init(&space);
 
     if (thrd_create(&recv_thread, recv_worker, NULL) != thrd_success)
     {
@@ -288,19 +652,39 @@ void client_stop(void)
 {
    if (!client_enabled)
       return;
+   mtx_lock(&mutex);
    running = 0;
-   close(sd);
-
-#if 0
+   cnd_signal(&space);
+   mtx_unlock(&mutex);
+   /* wakes a blocked recv, the thread still holds the tail segment */
+   shutdown(sd, SHUT_RDWR);
    if (thrd_join(recv_thread, NULL) != thrd_success)
    {
       perror("thrd_join");
       exit(1);
    }
+   close(sd);
+   cnd_destroy(&space);
    mtx_destroy(&mutex);
-#endif
-   qsize = 0;
-   free(queue);
+
+   while (head)
+   {
+      Segment *segment = head;
+      head = head->next;
+      free(segment->data);
+      free(segment);
+   }
+   while (spare)
+   {
+      Segment *segment = spare;
+      spare = spare->next;
+      free(segment->data);
+      free(segment);
+   }
+   tail = 0;
+   spare_count = 0;
+   bytes_queued = 0;
+   protocol = 1;
 
 #if 0
    printf("Bytes Sent: %d, Bytes Received: %d\n",
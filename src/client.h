@@ -3,6 +3,19 @@
 
 #define DEFAULT_PORT 4080
 
+/* from protocol 2 on, everything after the V handshake is framed: a tag
+ * byte (the command letter with FRAME_BIT set), a varint payload length
+ * and the payload; text lines never start with a byte >= FRAME_BIT.
+ * protocol 3 adds the H frame, a whole chunk sync in one message */
+#define PROTOCOL_VERSION 3
+#define FRAME_BIT 0x80
+
+typedef struct {
+    const unsigned char *data;
+    const unsigned char *end;
+    int error;
+} FrameReader;
+
 void client_enable();
 void client_disable();
 int get_client_enabled();
@@ -10,8 +23,12 @@ void client_connect(char *hostname, int port);
 void client_start();
 void client_stop();
 void client_send(char *data);
-char *client_recv();
+char *client_recv(int *length);
+void client_release(char *data);
+void client_stats(int *sent, int *received, int *queued);
+int client_message_size(const char *data, int length);
 void client_version(int version);
+void client_protocol(int version);
 void client_login(const char *username, const char *identity_token);
 void client_position(float x, float y, float z, float rx, float ry);
 void client_chunk(int p, int q, int key);
@@ -20,4 +37,11 @@ void client_light(int x, int y, int z, int w);
 void client_sign(int x, int y, int z, int face, const char *text);
 void client_talk(const char *text);
 
+unsigned int frame_varint(FrameReader *reader);
+unsigned int frame_count(FrameReader *reader, int size);
+int frame_int(FrameReader *reader);
+float frame_float(FrameReader *reader);
+double frame_double(FrameReader *reader);
+void frame_text(FrameReader *reader, char *text, int length);
+
 #endif
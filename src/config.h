@@ -11,6 +11,7 @@
 #define MAX_MESSAGES 4
 #define DB_PATH "craft.db"
 #define DB_AUTH_PATH "auth.db"
+#define TERRAIN_PATH "craft.terrain"
 #define USE_CACHE 1
 #define DAY_LENGTH 600
 #define INVERT_MOUSE 0
@@ -30,6 +31,11 @@ extern unsigned SHOW_INFO_TEXT;
 extern unsigned JUMPING_FLASH_MODE;
 extern unsigned FIELD_OF_VIEW;
 extern unsigned INVERTED_AIM;
+extern unsigned GREEDY_MESHING;
+extern unsigned WORKER_THREADS;
+extern unsigned PREGEN_RADIUS;
+extern unsigned BLOCK_REGIONS;
+extern unsigned NET_BUDGET;
 extern float ANALOG_SENSITIVITY;
 extern float DEADZONE_RADIUS;
 
@@ -63,4 +69,18 @@ extern unsigned RENDER_CHUNK_RADIUS;
 #define COMMIT_INTERVAL 5
 #define MAX_BLOCK_HEIGHT 65536
 
+/* chunk storage backend: 0 = hash map, 1 = paletted 32x32x16 sections */
+#ifndef MAP_SECTIONS
+#define MAP_SECTIONS 0
+#endif
+
+/* 12 byte block vertices instead of 10 floats, GLES2 keeps the floats */
+#ifndef PACKED_VERTICES
+#if defined(HAVE_OPENGLES)
+#define PACKED_VERTICES 0
+#else
+#define PACKED_VERTICES 1
+#endif
+#endif
+
 #endif
@@ -4,52 +4,55 @@
 #include "matrix.h"
 #include "util.h"
 
+static const float cube_positions[6][4][3] = {
+    {{-1, -1, -1}, {-1, -1, +1}, {-1, +1, -1}, {-1, +1, +1}},
+    {{+1, -1, -1}, {+1, -1, +1}, {+1, +1, -1}, {+1, +1, +1}},
+    {{-1, +1, -1}, {-1, +1, +1}, {+1, +1, -1}, {+1, +1, +1}},
+    {{-1, -1, -1}, {-1, -1, +1}, {+1, -1, -1}, {+1, -1, +1}},
+    {{-1, -1, -1}, {-1, +1, -1}, {+1, -1, -1}, {+1, +1, -1}},
+    {{-1, -1, +1}, {-1, +1, +1}, {+1, -1, +1}, {+1, +1, +1}}
+};
+static const float cube_normals[6][3] = {
+    {-1, 0, 0},
+    {+1, 0, 0},
+    {0, +1, 0},
+    {0, -1, 0},
+    {0, 0, -1},
+    {0, 0, +1}
+};
+static const float cube_uvs[6][4][2] = {
+    {{0, 0}, {1, 0}, {0, 1}, {1, 1}},
+    {{1, 0}, {0, 0}, {1, 1}, {0, 1}},
+    {{0, 1}, {0, 0}, {1, 1}, {1, 0}},
+    {{0, 0}, {0, 1}, {1, 0}, {1, 1}},
+    {{0, 0}, {0, 1}, {1, 0}, {1, 1}},
+    {{1, 0}, {1, 1}, {0, 0}, {0, 1}}
+};
+/* corner order of each quad, drawn with the shared 0 1 2, 0 2 3 indices;
+ * the flipped order splits the quad along the other diagonal */
+static const int cube_quads[6][4] = {
+    {0, 1, 3, 2},
+    {0, 2, 3, 1},
+    {0, 1, 3, 2},
+    {0, 2, 3, 1},
+    {0, 1, 3, 2},
+    {0, 2, 3, 1}
+};
+static const int cube_flipped[6][4] = {
+    {1, 3, 2, 0},
+    {2, 3, 1, 0},
+    {1, 3, 2, 0},
+    {2, 3, 1, 0},
+    {1, 3, 2, 0},
+    {2, 3, 1, 0}
+};
+
 void make_cube_faces(
     float *data, float ao[6][4], float light[6][4],
     int left, int right, int top, int bottom, int front, int back,
     int wleft, int wright, int wtop, int wbottom, int wfront, int wback,
     float x, float y, float z, float n)
 {
-    static const float positions[6][4][3] = {
-        {{-1, -1, -1}, {-1, -1, +1}, {-1, +1, -1}, {-1, +1, +1}},
-        {{+1, -1, -1}, {+1, -1, +1}, {+1, +1, -1}, {+1, +1, +1}},
-        {{-1, +1, -1}, {-1, +1, +1}, {+1, +1, -1}, {+1, +1, +1}},
-        {{-1, -1, -1}, {-1, -1, +1}, {+1, -1, -1}, {+1, -1, +1}},
-        {{-1, -1, -1}, {-1, +1, -1}, {+1, -1, -1}, {+1, +1, -1}},
-        {{-1, -1, +1}, {-1, +1, +1}, {+1, -1, +1}, {+1, +1, +1}}
-    };
-    static const float normals[6][3] = {
-        {-1, 0, 0},
-        {+1, 0, 0},
-        {0, +1, 0},
-        {0, -1, 0},
-        {0, 0, -1},
-        {0, 0, +1}
-    };
-    static const float uvs[6][4][2] = {
-        {{0, 0}, {1, 0}, {0, 1}, {1, 1}},
-        {{1, 0}, {0, 0}, {1, 1}, {0, 1}},
-        {{0, 1}, {0, 0}, {1, 1}, {1, 0}},
-        {{0, 0}, {0, 1}, {1, 0}, {1, 1}},
-        {{0, 0}, {0, 1}, {1, 0}, {1, 1}},
-        {{1, 0}, {1, 1}, {0, 0}, {0, 1}}
-    };
-    static const float indices[6][6] = {
-        {0, 3, 2, 0, 1, 3},
-        {0, 3, 1, 0, 2, 3},
-        {0, 3, 2, 0, 1, 3},
-        {0, 3, 1, 0, 2, 3},
-        {0, 3, 2, 0, 1, 3},
-        {0, 3, 1, 0, 2, 3}
-    };
-    static const float flipped[6][6] = {
-        {0, 1, 2, 1, 3, 2},
-        {0, 2, 1, 2, 3, 1},
-        {0, 1, 2, 1, 3, 2},
-        {0, 2, 1, 2, 3, 1},
-        {0, 1, 2, 1, 3, 2},
-        {0, 2, 1, 2, 3, 1}
-    };
     float *d = data;
     float s = 0.0625;
     float a = 0 + 1 / 2048.0;
@@ -66,17 +69,17 @@ void make_cube_faces(
         du = (tiles[i] % 16) * s;
         dv = (tiles[i] / 16) * s;
         flip = ao[i][0] + ao[i][3] > ao[i][1] + ao[i][2];
-        for (v = 0; v < 6; v++)
+        for (v = 0; v < 4; v++)
         {
-           int j = flip ? flipped[i][v] : indices[i][v];
-           *(d++) = x + n * positions[i][j][0];
-           *(d++) = y + n * positions[i][j][1];
-           *(d++) = z + n * positions[i][j][2];
-           *(d++) = normals[i][0];
-           *(d++) = normals[i][1];
-           *(d++) = normals[i][2];
-           *(d++) = du + (uvs[i][j][0] ? b : a);
-           *(d++) = dv + (uvs[i][j][1] ? b : a);
+           int j = flip ? cube_flipped[i][v] : cube_quads[i][v];
+           *(d++) = x + n * cube_positions[i][j][0];
+           *(d++) = y + n * cube_positions[i][j][1];
+           *(d++) = z + n * cube_positions[i][j][2];
+           *(d++) = cube_normals[i][0];
+           *(d++) = cube_normals[i][1];
+           *(d++) = cube_normals[i][2];
+           *(d++) = du + (cube_uvs[i][j][0] ? b : a);
+           *(d++) = dv + (cube_uvs[i][j][1] ? b : a);
            *(d++) = ao[i][j];
            *(d++) = light[i][j];
         }
@@ -101,6 +104,41 @@ void make_cube(
         x, y, z, n);
 }
 
+/* one quad stretched over ex * ey * ez blocks starting at block (x, y, z),
+ * the uv holds -(1 + tile * 64 + repeat) so the shader can wrap the tile */
+void make_cube_face_repeat(
+    float *data, float ao, float light, int face, int w,
+    float x, float y, float z, float n, int ex, int ey, int ez)
+{
+    static const int u_axis[6] = {2, 2, 0, 0, 0, 0};
+    static const int v_axis[6] = {1, 1, 2, 2, 1, 1};
+    float *d = data;
+    float base[3] = {x, y, z};
+    float extent[3] = {ex, ey, ez};
+    float du = (w % 16) * 64;
+    float dv = (w / 16) * 64;
+    int v;
+    for (v = 0; v < 4; v++)
+    {
+        int j = cube_quads[face][v];
+        int k;
+        for (k = 0; k < 3; k++)
+        {
+            if (cube_positions[face][j][k] < 0)
+                *(d++) = base[k] - n;
+            else
+                *(d++) = base[k] + extent[k] - 1 + n;
+        }
+        *(d++) = cube_normals[face][0];
+        *(d++) = cube_normals[face][1];
+        *(d++) = cube_normals[face][2];
+        *(d++) = -(1 + du + cube_uvs[face][j][0] * extent[u_axis[face]]);
+        *(d++) = -(1 + dv + cube_uvs[face][j][1] * extent[v_axis[face]]);
+        *(d++) = ao;
+        *(d++) = light;
+    }
+}
+
 void make_plant(
     float *data, float ao, float light,
     float px, float py, float pz, float n, int w, float rotation)
@@ -123,11 +161,11 @@ void make_plant(
         {{0, 0}, {0, 1}, {1, 0}, {1, 1}},
         {{1, 0}, {1, 1}, {0, 0}, {0, 1}}
     };
-    static const float indices[4][6] = {
-        {0, 3, 2, 0, 1, 3},
-        {0, 3, 1, 0, 2, 3},
-        {0, 3, 2, 0, 1, 3},
-        {0, 3, 1, 0, 2, 3}
+    static const int quads[4][4] = {
+        {0, 1, 3, 2},
+        {0, 2, 3, 1},
+        {0, 1, 3, 2},
+        {0, 2, 3, 1}
     };
     float *d = data;
     float s = 0.0625;
@@ -141,9 +179,9 @@ void make_plant(
     for (i = 0; i < 4; i++)
     {
        int v;
-       for (v = 0; v < 6; v++)
+       for (v = 0; v < 4; v++)
        {
-          int j = indices[i][v];
+          int j = quads[i][v];
           *(d++) = n * positions[i][j][0];
           *(d++) = n * positions[i][j][1];
           *(d++) = n * positions[i][j][2];
@@ -159,10 +197,37 @@ void make_plant(
     mat_identity(ma);
     mat_rotate(mb, 0, 1, 0, RADIANS(rotation));
     mat_multiply(ma, mb, ma);
-    mat_apply(data, ma, 24, 3, 10);
+    mat_apply(data, ma, 16, 3, 10);
     mat_translate(mb, px, py, pz);
     mat_multiply(ma, mb, ma);
-    mat_apply(data, ma, 24, 0, 10);
+    mat_apply(data, ma, 16, 0, 10);
+}
+
+/* pack float block vertices into 6 shorts each: the position in 1/64
+ * block units from (ox, oy, oz) with ao, light and diffuse folded into w,
+ * then the uv in 1/2048 atlas units, repeat-encoded uvs are kept as is */
+void pack_block_vertices(
+    short *dst, const float *src, int count, float ox, float oy, float oz)
+{
+    /* normalize(-1, 1, -1), matching light_direction in the shader */
+    static const float light_direction[3] = {
+        -0.57735027, 0.57735027, -0.57735027
+    };
+    int i;
+    for (i = 0; i < count; i++, src += 10)
+    {
+        float diffuse = src[3] * light_direction[0] +
+            src[4] * light_direction[1] + src[5] * light_direction[2];
+        int ao = roundf(MIN(src[8], 1) * 32);
+        int light = roundf(MIN(src[9], 1) * 60);
+        int df = roundf(MAX(diffuse, 0) * 15);
+        *(dst++) = roundf((src[0] - ox) * 64);
+        *(dst++) = roundf((src[1] - oy) * 64);
+        *(dst++) = roundf((src[2] - oz) * 64);
+        *(dst++) = (df * 61 + light) * 33 + ao;
+        *(dst++) = src[6] < 0 ? src[6] : roundf(src[6] * 2048);
+        *(dst++) = src[7] < 0 ? src[7] : roundf(src[7] * 2048);
+    }
 }
 
 void make_player(
@@ -190,10 +255,10 @@ void make_player(
     mat_multiply(ma, mb, ma);
     mat_rotate(mb, cosf(rx), 0, sinf(rx), -ry);
     mat_multiply(ma, mb, ma);
-    mat_apply(data, ma, 36, 3, 10);
+    mat_apply(data, ma, 24, 3, 10);
     mat_translate(mb, x, y, z);
     mat_multiply(ma, mb, ma);
-    mat_apply(data, ma, 36, 0, 10);
+    mat_apply(data, ma, 24, 0, 10);
 }
 
 void make_cube_wireframe(float *data, float x, float y, float z, float n) {
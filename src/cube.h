@@ -12,10 +12,17 @@ void make_cube(
     int left, int right, int top, int bottom, int front, int back,
     float x, float y, float z, float n, int w);
 
+void make_cube_face_repeat(
+    float *data, float ao, float light, int face, int w,
+    float x, float y, float z, float n, int ex, int ey, int ez);
+
 void make_plant(
     float *data, float ao, float light,
     float px, float py, float pz, float n, int w, float rotation);
 
+void pack_block_vertices(
+    short *dst, const float *src, int count, float ox, float oy, float oz);
+
 void make_player(
     float *data,
     float x, float y, float z, float rx, float ry);
@@ -1,5 +1,9 @@
+#include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include "chunk_index.h"
 #include "db.h"
+#include "region.h"
 #include "ring.h"
 #include "sqlite3.h"
 #include "tinycthread.h"
@@ -8,22 +12,270 @@
 static int db_enabled = 0;
 
 static sqlite3 *db;
-static sqlite3_stmt *insert_block_stmt;
-static sqlite3_stmt *insert_light_stmt;
 static sqlite3_stmt *insert_sign_stmt;
 static sqlite3_stmt *delete_sign_stmt;
 static sqlite3_stmt *delete_signs_stmt;
-static sqlite3_stmt *load_blocks_stmt;
-static sqlite3_stmt *load_lights_stmt;
-static sqlite3_stmt *load_signs_stmt;
-static sqlite3_stmt *get_key_stmt;
 static sqlite3_stmt *set_key_stmt;
+static sqlite3_stmt *read_blob_stmt;
+static sqlite3_stmt *save_blob_stmt;
+static sqlite3_stmt *insert_region_stmt;
 
-static Ring ring;
+/* with BLOCK_REGIONS block edits live in region files beside the
+ * database instead of chunk_blob, block_region lists the files */
+static int block_regions;
+static RegionStore store;
+
+/* a chunk_blob row holds the block edits and then the light edits of
+ * one chunk, each in the edit format of region.c, after the size of
+ * the block edits */
+#define BLOB_VERSION 1
+#define BLOB_BLOCKS 0
+#define BLOB_LIGHTS 1
+
+typedef struct {
+    unsigned char *data[2];
+    unsigned int size[2];
+} ChunkBlob;
+
+typedef struct {
+    RegionEdit *data;
+    unsigned int count;
+    unsigned int capacity;
+} EditList;
+
+/* chunk blobs the db worker changed since they were last written;
+ * loads look here first, so the rows are only written on db_commit or
+ * once BLOB_CACHE chunks are dirty. only the worker changes the cache,
+ * cache_mtx keeps loads out meanwhile */
+#define BLOB_CACHE 1024
+
+typedef struct {
+    int p;
+    int q;
+    ChunkBlob blob;
+} CachedBlob;
+
+static CachedBlob *cache;
+static int cache_count;
+static ChunkIndex cache_index;
+static mtx_t cache_mtx;
+
+/* the databases older builds wrote have user_version 0, their block
+ * and light rows have not been moved into chunk blobs yet */
+#define USER_VERSION 1
+
+/* block or light writes drained from the ring, one row per position */
+typedef struct {
+    RingEntry *rows;
+    unsigned int count;
+    unsigned int capacity;
+    unsigned int *slots;
+    unsigned int mask;
+} WriteBatch;
+
+/* writes queued by the main thread for the db worker; once it is full
+ * they queue in its overflow, which the worker drains after it, so the
+ * main thread never waits */
+#define QUEUE_SIZE 16384
+
+static SpscRing ring;
 static thrd_t thrd;
-static mtx_t mtx;
-static cnd_t cnd;
-static mtx_t load_mtx;
+
+/* chunk loads take a reader: with WAL each worker gets a read-only
+ * connection of its own, otherwise and when all of them are busy they
+ * share the main connection */
+#define MAX_READERS 16
+
+typedef struct {
+    sqlite3 *db;
+    sqlite3_stmt *load_blob_stmt;
+    sqlite3_stmt *load_signs_stmt;
+    sqlite3_stmt *get_key_stmt;
+    mtx_t mtx;
+} Reader;
+
+static const char *load_blob_query =
+    "select version, data from chunk_blob where p = ? and q = ?;";
+static const char *load_signs_query =
+    "select x, y, z, face, text from sign where p = ? and q = ?;";
+static const char *get_key_query =
+    "select key from key where p = ? and q = ?;";
+
+static Reader main_reader;
+static Reader readers[MAX_READERS];
+static int reader_count;
+static int batch_depth;
+static int batch_signs;
+
+static int blob_part(
+    const unsigned char *data, unsigned int size, int part,
+    const unsigned char **start, unsigned int *length)
+{
+    unsigned int first;
+    if (size < 4)
+        return 0;
+    first = data[0] | (data[1] << 8) | (data[2] << 16) |
+        ((unsigned int)data[3] << 24);
+    if (first > size - 4)
+        return 0;
+    *start = data + 4 + (part == BLOB_LIGHTS ? first : 0);
+    *length = part == BLOB_LIGHTS ? size - 4 - first : first;
+    return *length > 0;
+}
+
+static void blob_read(int p, int q, ChunkBlob *blob) {
+    const unsigned char *data;
+    unsigned int size;
+    int part;
+    memset(blob, 0, sizeof(ChunkBlob));
+    sqlite3_reset(read_blob_stmt);
+    sqlite3_bind_int(read_blob_stmt, 1, p);
+    sqlite3_bind_int(read_blob_stmt, 2, q);
+    if (sqlite3_step(read_blob_stmt) != SQLITE_ROW ||
+        sqlite3_column_int(read_blob_stmt, 0) != BLOB_VERSION)
+    {
+        return;
+    }
+    data = (const unsigned char *)sqlite3_column_blob(read_blob_stmt, 1);
+    size = sqlite3_column_bytes(read_blob_stmt, 1);
+    for (part = BLOB_BLOCKS; part <= BLOB_LIGHTS; part++) {
+        const unsigned char *start;
+        unsigned int length;
+        if (!blob_part(data, size, part, &start, &length))
+            continue;
+        blob->data[part] = (unsigned char *)malloc(length);
+        memcpy(blob->data[part], start, length);
+        blob->size[part] = length;
+    }
+}
+
+/* writes blob as the row of chunk p, q; returns 0 or -1 */
+static int blob_write(int p, int q, ChunkBlob *blob) {
+    unsigned int first = blob->size[BLOB_BLOCKS];
+    unsigned int size = 4 + first + blob->size[BLOB_LIGHTS];
+    unsigned char *data = (unsigned char *)malloc(size);
+    int rc;
+    data[0] = first & 0xff;
+    data[1] = (first >> 8) & 0xff;
+    data[2] = (first >> 16) & 0xff;
+    data[3] = (first >> 24) & 0xff;
+    if (first)
+        memcpy(data + 4, blob->data[BLOB_BLOCKS], first);
+    if (blob->size[BLOB_LIGHTS]) {
+        memcpy(data + 4 + first,
+            blob->data[BLOB_LIGHTS], blob->size[BLOB_LIGHTS]);
+    }
+    sqlite3_reset(save_blob_stmt);
+    sqlite3_bind_int(save_blob_stmt, 1, p);
+    sqlite3_bind_int(save_blob_stmt, 2, q);
+    sqlite3_bind_int(save_blob_stmt, 3, BLOB_VERSION);
+    sqlite3_bind_blob(save_blob_stmt, 4, data, size, SQLITE_STATIC);
+    rc = sqlite3_step(save_blob_stmt);
+    sqlite3_clear_bindings(save_blob_stmt);
+    free(data);
+    return rc == SQLITE_DONE ? 0 : -1;
+}
+
+static void blob_free(ChunkBlob *blob) {
+    free(blob->data[BLOB_BLOCKS]);
+    free(blob->data[BLOB_LIGHTS]);
+}
+
+void _db_commit(void);
+
+/* the cached blob of chunk p, q, read from its row the first time */
+static ChunkBlob *cache_blob(int p, int q) {
+    CachedBlob *entry;
+    int slot = chunk_index_get(&cache_index, p, q);
+    if (slot >= 0)
+        return &cache[slot].blob;
+    entry = cache + cache_count;
+    entry->p = p;
+    entry->q = q;
+    blob_read(p, q, &entry->blob);
+    mtx_lock(&cache_mtx);
+    chunk_index_set(&cache_index, p, q, cache_count++);
+    mtx_unlock(&cache_mtx);
+    return &entry->blob;
+}
+
+/* writes every cached blob and empties the cache; with WAL readers the
+ * rows are committed first so loads see the edits throughout. returns
+ * 0 or -1 if a row could not be written */
+static int cache_flush(void) {
+    int i, result = 0;
+    for (i = 0; i < cache_count; i++) {
+        if (blob_write(cache[i].p, cache[i].q, &cache[i].blob))
+            result = -1;
+    }
+    if (cache_count && reader_count)
+        _db_commit();
+    mtx_lock(&cache_mtx);
+    for (i = 0; i < cache_count; i++) {
+        blob_free(&cache[i].blob);
+    }
+    cache_count = 0;
+    chunk_index_clear(&cache_index);
+    mtx_unlock(&cache_mtx);
+    return result;
+}
+
+/* merges edits into the given part of their cached chunk blobs */
+static void blob_merge(RegionEdit *edits, unsigned int count, int part) {
+    unsigned int i = 0;
+    region_edits_sort(edits, count);
+    while (i < count) {
+        RegionEdit *e = edits + i;
+        int p = e->rx * REGION_CHUNKS + e->index / REGION_CHUNKS;
+        int q = e->rq * REGION_CHUNKS + e->index % REGION_CHUNKS;
+        unsigned int j = i;
+        ChunkBlob *blob;
+        while (j < count && edits[j].rx == e->rx && edits[j].rq == e->rq &&
+            edits[j].index == e->index)
+        {
+            j++;
+        }
+        if (cache_count == BLOB_CACHE && cache_flush())
+            LOG_ERROR("Error writing chunk blobs\n");
+        blob = cache_blob(p, q);
+        mtx_lock(&cache_mtx);
+        region_edits_merge(&blob->data[part], &blob->size[part], p, q,
+            e, j - i);
+        mtx_unlock(&cache_mtx);
+        i = j;
+    }
+}
+
+static void edits_add(EditList *list, int p, int q, int x, int y, int z,
+    int w)
+{
+    RegionEdit *edit;
+    if (list->count == list->capacity) {
+        list->capacity = list->capacity ? list->capacity * 2 : 1024;
+        list->data = (RegionEdit *)realloc(
+            list->data, list->capacity * sizeof(RegionEdit));
+    }
+    edit = list->data + list->count;
+    if (region_edit(edit, p, q, x, y, z, w))
+        edit->order = list->count++;
+}
+
+static void gather_edit(int p, int q, int x, int y, int z, int w, void *arg) {
+    edits_add((EditList *)arg, p, q, x, y, z, w);
+}
+
+static void load_edit(int p, int q, int x, int y, int z, int w, void *arg) {
+    map_set((Map *)arg, x, y, z, w);
+}
+
+static void add_pair(int **pairs, int *size, int *capacity, int a, int b) {
+    if (*size + 2 > *capacity) {
+        *capacity = *capacity ? *capacity * 2 : 64;
+        *pairs = (int *)realloc(*pairs, *capacity * sizeof(int));
+    }
+    (*pairs)[(*size)++] = a;
+    (*pairs)[(*size)++] = b;
+}
 
 void db_enable() {
     db_enabled = 1;
@@ -41,7 +293,235 @@ static void sqlite_log_callback(void *closure, int err_code, const char *msg){
   LOG_ERROR("sqlite log: (%d) %s\n", err_code, msg);
 }
 
-int db_init(char *path, char *auth_path)
+static void note_region(int p, int q, int *rx, int *rq, int *first) {
+    int x, z;
+    region_index(p, q, &x, &z);
+    if (!*first && x == *rx && z == *rq)
+        return;
+    *first = 0;
+    *rx = x;
+    *rq = z;
+    sqlite3_reset(insert_region_stmt);
+    sqlite3_bind_int(insert_region_stmt, 1, x);
+    sqlite3_bind_int(insert_region_stmt, 2, z);
+    sqlite3_step(insert_region_stmt);
+}
+
+static int migrate_table(const char *table, int part) {
+    char query[64];
+    sqlite3_stmt *stmt;
+    EditList list;
+    int rc, count;
+    memset(&list, 0, sizeof(list));
+    snprintf(query, sizeof(query), "select p, q, x, y, z, w from %s;", table);
+    if (sqlite3_prepare_v2(db, query, -1, &stmt, NULL))
+        return -1;
+    while ((rc = sqlite3_step(stmt)) == SQLITE_ROW) {
+        edits_add(&list,
+            sqlite3_column_int(stmt, 0), sqlite3_column_int(stmt, 1),
+            sqlite3_column_int(stmt, 2), sqlite3_column_int(stmt, 3),
+            sqlite3_column_int(stmt, 4), sqlite3_column_int(stmt, 5));
+    }
+    sqlite3_finalize(stmt);
+    count = list.count;
+    if (rc == SQLITE_DONE)
+        blob_merge(list.data, list.count, part);
+    free(list.data);
+    return rc == SQLITE_DONE ? count : -1;
+}
+
+/* moves the rows of the block and light tables of older databases into
+ * chunk blobs in one transaction that also bumps user_version; the
+ * rows stay, so a failed or interrupted move leaves them as they were
+ * and an older build still reads them */
+static int migrate_rows(void) {
+    sqlite3_stmt *stmt;
+    int version = 0, blocks, lights;
+    sqlite3_prepare_v2(db, "pragma user_version;", -1, &stmt, NULL);
+    if (sqlite3_step(stmt) == SQLITE_ROW)
+        version = sqlite3_column_int(stmt, 0);
+    sqlite3_finalize(stmt);
+    if (version >= USER_VERSION)
+        return 0;
+    sqlite3_exec(db, "begin;", NULL, NULL, NULL);
+    blocks = migrate_table("block", BLOB_BLOCKS);
+    lights = blocks < 0 ? -1 : migrate_table("light", BLOB_LIGHTS);
+    if (cache_flush() || lights < 0 ||
+        sqlite3_exec(db, "pragma user_version = 1; commit;", NULL, NULL, NULL))
+    {
+        LOG_ERROR("Error moving block rows to chunk blobs\n");
+        sqlite3_exec(db, "rollback;", NULL, NULL, NULL);
+        return -1;
+    }
+    return blocks + lights;
+}
+
+static void store_edit(int p, int q, int x, int y, int z, int w, void *arg) {
+    int *region = (int *)arg;
+    region_store_put(&store, p, q, x, y, z, w);
+    note_region(p, q, region, region + 1, region + 2);
+}
+
+/* moves the block edits of every chunk blob into region files, the
+ * blobs keep their lights and are only changed once every file is
+ * written */
+static int migrate_to_regions(void) {
+    static const char *query = "select p, q, version, data from chunk_blob;";
+    sqlite3_stmt *stmt;
+    int region[3] = {0, 0, 1};
+    int *chunks = 0;
+    int i, size = 0, capacity = 0, count = 0;
+    sqlite3_exec(db, "begin;", NULL, NULL, NULL);
+    sqlite3_prepare_v2(db, query, -1, &stmt, NULL);
+    while (sqlite3_step(stmt) == SQLITE_ROW) {
+        int p = sqlite3_column_int(stmt, 0);
+        int q = sqlite3_column_int(stmt, 1);
+        const unsigned char *start;
+        unsigned int length;
+        int n;
+        if (sqlite3_column_int(stmt, 2) != BLOB_VERSION ||
+            !blob_part((const unsigned char *)sqlite3_column_blob(stmt, 3),
+                sqlite3_column_bytes(stmt, 3), BLOB_BLOCKS, &start, &length))
+        {
+            continue;
+        }
+        n = region_edits_each(start, length, p, q, store_edit, region);
+        if (n > 0)
+            count += n;
+        add_pair(&chunks, &size, &capacity, p, q);
+    }
+    sqlite3_finalize(stmt);
+    if (count && region_store_flush(&store)) {
+        LOG_ERROR("Error moving %d blocks to %s\n", count, store.prefix);
+        // the blobs still hold them
+        store.count = 0;
+        sqlite3_exec(db, "rollback;", NULL, NULL, NULL);
+        free(chunks);
+        return -1;
+    }
+    for (i = 0; i < size; i += 2) {
+        ChunkBlob blob;
+        blob_read(chunks[i], chunks[i + 1], &blob);
+        free(blob.data[BLOB_BLOCKS]);
+        blob.data[BLOB_BLOCKS] = 0;
+        blob.size[BLOB_BLOCKS] = 0;
+        blob_write(chunks[i], chunks[i + 1], &blob);
+        blob_free(&blob);
+    }
+    sqlite3_exec(db, "commit;", NULL, NULL, NULL);
+    free(chunks);
+    return count;
+}
+
+/* moves region files back into chunk blobs when the sqlite backend is
+ * selected again, the files are removed after the commit */
+static int migrate_from_regions(void) {
+    static const char *query = "select rx, rq from block_region;";
+    sqlite3_stmt *stmt;
+    char prefix[REGION_PREFIX];
+    EditList list;
+    int *regions = 0;
+    int i, size = 0, capacity = 0, count;
+    sqlite3_prepare_v2(db, query, -1, &stmt, NULL);
+    while (sqlite3_step(stmt) == SQLITE_ROW) {
+        add_pair(&regions, &size, &capacity,
+            sqlite3_column_int(stmt, 0), sqlite3_column_int(stmt, 1));
+    }
+    sqlite3_finalize(stmt);
+    if (!size)
+        return 0;
+    memset(&list, 0, sizeof(list));
+    for (i = 0; i < size; i += 2) {
+        region_store_each(
+            &store, regions[i], regions[i + 1], gather_edit, &list);
+    }
+    count = list.count;
+    sqlite3_exec(db, "begin;", NULL, NULL, NULL);
+    blob_merge(list.data, list.count, BLOB_BLOCKS);
+    cache_flush();
+    sqlite3_exec(db, "delete from block_region; commit;", NULL, NULL, NULL);
+    free(list.data);
+    // drop the open files before removing them
+    strcpy(prefix, store.prefix);
+    region_store_close(&store);
+    for (i = 0; i < size; i += 2) {
+        char path[REGION_PATH];
+        region_path(path, sizeof(path), prefix, regions[i], regions[i + 1]);
+        remove(path);
+    }
+    region_store_open(&store, prefix);
+    free(regions);
+    return count;
+}
+
+static int reader_prepare(Reader *reader, sqlite3 *conn) {
+    int rc;
+    reader->db = conn;
+    rc = sqlite3_prepare_v2(
+        conn, load_blob_query, -1, &reader->load_blob_stmt, NULL);
+    if (rc) return rc;
+    rc = sqlite3_prepare_v2(
+        conn, load_signs_query, -1, &reader->load_signs_stmt, NULL);
+    if (rc) return rc;
+    rc = sqlite3_prepare_v2(
+        conn, get_key_query, -1, &reader->get_key_stmt, NULL);
+    if (rc) return rc;
+    mtx_init(&reader->mtx, mtx_plain);
+    return 0;
+}
+
+static void reader_close(Reader *reader) {
+    sqlite3_finalize(reader->load_blob_stmt);
+    sqlite3_finalize(reader->load_signs_stmt);
+    sqlite3_finalize(reader->get_key_stmt);
+    mtx_destroy(&reader->mtx);
+    if (reader->db != db)
+        sqlite3_close(reader->db);
+}
+
+/* switches to WAL and opens a reader per worker; readers only see
+ * committed rows, so the db worker then commits after every drain */
+static void readers_open(const char *path, int count) {
+    sqlite3_stmt *stmt;
+    int wal = 0;
+    sqlite3_prepare_v2(db, "pragma journal_mode = wal;", -1, &stmt, NULL);
+    if (sqlite3_step(stmt) == SQLITE_ROW) {
+        const char *mode = (const char *)sqlite3_column_text(stmt, 0);
+        wal = mode && !strcmp(mode, "wal");
+    }
+    sqlite3_finalize(stmt);
+    if (!wal)
+        return;
+    sqlite3_exec(db, "pragma synchronous = normal;", NULL, NULL, NULL);
+    count = MIN(count, MAX_READERS);
+    for (reader_count = 0; reader_count < count; reader_count++) {
+        Reader *reader = readers + reader_count;
+        sqlite3 *conn;
+        if (sqlite3_open_v2(path, &conn, SQLITE_OPEN_READONLY, NULL)) {
+            sqlite3_close(conn);
+            break;
+        }
+        sqlite3_busy_timeout(conn, 1000);
+        if (reader_prepare(reader, conn)) {
+            sqlite3_finalize(reader->load_blob_stmt);
+            sqlite3_finalize(reader->load_signs_stmt);
+            sqlite3_close(conn);
+            break;
+        }
+    }
+}
+
+static Reader *reader_acquire(void) {
+    int i;
+    for (i = 0; i < reader_count; i++) {
+        if (mtx_trylock(&readers[i].mtx) == thrd_success)
+            return readers + i;
+    }
+    mtx_lock(&main_reader.mtx);
+    return &main_reader;
+}
+
+int db_init(char *path, char *auth_path, int workers)
 {
    static const char *attach_query = "attach database ? as auth;"; 
    static const char *create_query =
@@ -89,17 +569,23 @@ int db_init(char *path, char *auth_path)
       "    face int not null,"
       "    text text not null"
       ");"
+      "create table if not exists chunk_blob ("
+      "    p int not null,"
+      "    q int not null,"
+      "    version int not null,"
+      "    data blob not null"
+      ");"
+      "create table if not exists block_region ("
+      "    rx int not null,"
+      "    rq int not null"
+      ");"
       "create unique index if not exists block_pqxyz_idx on block (p, q, x, y, z);"
+      "create unique index if not exists chunk_blob_pq_idx on chunk_blob (p, q);"
+      "create unique index if not exists block_region_idx on block_region (rx, rq);"
       "create unique index if not exists light_pqxyz_idx on light (p, q, x, y, z);"
       "create unique index if not exists key_pq_idx on key (p, q);"
       "create unique index if not exists sign_xyzface_idx on sign (x, y, z, face);"
       "create index if not exists sign_pq_idx on sign (p, q);";
-   static const char *insert_block_query =
-      "insert or replace into block (p, q, x, y, z, w) "
-      "values (?, ?, ?, ?, ?, ?);";
-   static const char *insert_light_query =
-      "insert or replace into light (p, q, x, y, z, w) "
-      "values (?, ?, ?, ?, ?, ?);";
    static const char *insert_sign_query =
       "insert or replace into sign (p, q, x, y, z, face, text) "
       "values (?, ?, ?, ?, ?, ?, ?);";
@@ -107,25 +593,28 @@ int db_init(char *path, char *auth_path)
       "delete from sign where x = ? and y = ? and z = ? and face = ?;";
    static const char *delete_signs_query =
       "delete from sign where x = ? and y = ? and z = ?;";
-   static const char *load_blocks_query =
-      "select x, y, z, w from block where p = ? and q = ?;";
-   static const char *load_lights_query =
-      "select x, y, z, w from light where p = ? and q = ?;";
-   static const char *load_signs_query =
-      "select x, y, z, face, text from sign where p = ? and q = ?;";
-   static const char *get_key_query =
-      "select key from key where p = ? and q = ?;";
+   static const char *save_blob_query =
+      "insert or replace into chunk_blob (p, q, version, data) "
+      "values (?, ?, ?, ?);";
    static const char *set_key_query =
       "insert or replace into key (p, q, key) "
       "values (?, ?, ?);";
+   static const char *insert_region_query =
+      "insert or ignore into block_region (rx, rq) values (?, ?);";
+   static int logging;
+   char prefix[REGION_PREFIX];
    sqlite3_stmt *attach_stmt;
    int rc;
-   char *errmsg;
+   char *errmsg = NULL;
    if (!db_enabled) {
       return 0;
    }
 
-   sqlite3_config(SQLITE_CONFIG_LOG, sqlite_log_callback, NULL);
+   // sqlite only takes its configuration before the first open
+   if (!logging) {
+      sqlite3_config(SQLITE_CONFIG_LOG, sqlite_log_callback, NULL);
+      logging = 1;
+   }
 
    rc = sqlite3_open(path, &db);
    if (rc) return rc;
@@ -142,19 +631,13 @@ int db_init(char *path, char *auth_path)
    rc = sqlite3_finalize(attach_stmt);
    if (rc) return rc;
    
-   rc = sqlite3_exec(db, create_query, NULL, NULL, NULL);
+   rc = sqlite3_exec(db, create_query, NULL, NULL, &errmsg);
    if (rc) {
      LOG_ERROR("Error running SQLite create_query: %d: %s\n", rc,
 	       errmsg);
      sqlite3_free(errmsg);
      return rc;
    }
-   rc = sqlite3_prepare_v2(
-         db, insert_block_query, -1, &insert_block_stmt, NULL);
-   if (rc) return rc;
-   rc = sqlite3_prepare_v2(
-         db, insert_light_query, -1, &insert_light_stmt, NULL);
-   if (rc) return rc;
    rc = sqlite3_prepare_v2(
          db, insert_sign_query, -1, &insert_sign_stmt, NULL);
    if (rc) return rc;
@@ -164,16 +647,29 @@ int db_init(char *path, char *auth_path)
    rc = sqlite3_prepare_v2(
          db, delete_signs_query, -1, &delete_signs_stmt, NULL);
    if (rc) return rc;
-   rc = sqlite3_prepare_v2(db, load_blocks_query, -1, &load_blocks_stmt, NULL);
-   if (rc) return rc;
-   rc = sqlite3_prepare_v2(db, load_lights_query, -1, &load_lights_stmt, NULL);
+   rc = reader_prepare(&main_reader, db);
    if (rc) return rc;
-   rc = sqlite3_prepare_v2(db, load_signs_query, -1, &load_signs_stmt, NULL);
+   rc = sqlite3_prepare_v2(db, load_blob_query, -1, &read_blob_stmt, NULL);
    if (rc) return rc;
-   rc = sqlite3_prepare_v2(db, get_key_query, -1, &get_key_stmt, NULL);
+   rc = sqlite3_prepare_v2(db, save_blob_query, -1, &save_blob_stmt, NULL);
    if (rc) return rc;
    rc = sqlite3_prepare_v2(db, set_key_query, -1, &set_key_stmt, NULL);
    if (rc) return rc;
+   rc = sqlite3_prepare_v2(
+         db, insert_region_query, -1, &insert_region_stmt, NULL);
+   if (rc) return rc;
+   snprintf(prefix, sizeof(prefix), "%s.blocks", path);
+   region_store_open(&store, prefix);
+   cache = (CachedBlob *)malloc(BLOB_CACHE * sizeof(CachedBlob));
+   chunk_index_alloc(&cache_index, BLOB_CACHE * 2);
+   mtx_init(&cache_mtx, mtx_plain);
+   block_regions = BLOCK_REGIONS;
+   migrate_rows();
+   if (block_regions)
+      migrate_to_regions();
+   else
+      migrate_from_regions();
+   readers_open(path, workers);
    sqlite3_exec(db, "begin;", NULL, NULL, NULL);
    db_worker_start("");
    return 0;
@@ -185,27 +681,45 @@ void db_close(void)
         return;
     db_worker_stop();
     sqlite3_exec(db, "commit;", NULL, NULL, NULL);
-    sqlite3_finalize(insert_block_stmt);
-    sqlite3_finalize(insert_light_stmt);
     sqlite3_finalize(insert_sign_stmt);
     sqlite3_finalize(delete_sign_stmt);
     sqlite3_finalize(delete_signs_stmt);
-    sqlite3_finalize(load_blocks_stmt);
-    sqlite3_finalize(load_lights_stmt);
-    sqlite3_finalize(load_signs_stmt);
-    sqlite3_finalize(get_key_stmt);
     sqlite3_finalize(set_key_stmt);
+    sqlite3_finalize(read_blob_stmt);
+    sqlite3_finalize(save_blob_stmt);
+    sqlite3_finalize(insert_region_stmt);
+    while (reader_count)
+        reader_close(readers + --reader_count);
+    reader_close(&main_reader);
     sqlite3_close(db);
+    region_store_close(&store);
+    chunk_index_free(&cache_index);
+    mtx_destroy(&cache_mtx);
+    free(cache);
+}
+
+/* every write is queued from the main thread, the only producer; KEY
+ * entries carry the key in w */
+static void queue_put(
+    RingEntryType type, int p, int q, int x, int y, int z, int w)
+{
+    RingEntry entry;
+    entry.type = type;
+    entry.p = p;
+    entry.q = q;
+    entry.x = x;
+    entry.y = y;
+    entry.z = z;
+    entry.w = w;
+    entry.key = w;
+    spsc_ring_put(&ring, &entry);
 }
 
 void db_commit(void)
 {
     if (!db_enabled)
         return;
-    mtx_lock(&mtx);
-    ring_put_commit(&ring);
-    cnd_signal(&cnd);
-    mtx_unlock(&mtx);
+    queue_put(COMMIT, 0, 0, 0, 0, 0, 0);
 }
 
 void _db_commit(void)
@@ -344,41 +858,37 @@ void db_insert_block(int p, int q, int x, int y, int z, int w)
 {
    if (!db_enabled)
       return;
-   mtx_lock(&mtx);
-   ring_put_block(&ring, p, q, x, y, z, w);
-   cnd_signal(&cnd);
-   mtx_unlock(&mtx);
-}
-
-void _db_insert_block(int p, int q, int x, int y, int z, int w) {
-    sqlite3_reset(insert_block_stmt);
-    sqlite3_bind_int(insert_block_stmt, 1, p);
-    sqlite3_bind_int(insert_block_stmt, 2, q);
-    sqlite3_bind_int(insert_block_stmt, 3, x);
-    sqlite3_bind_int(insert_block_stmt, 4, y);
-    sqlite3_bind_int(insert_block_stmt, 5, z);
-    sqlite3_bind_int(insert_block_stmt, 6, w);
-    sqlite3_step(insert_block_stmt);
+   queue_put(BLOCK, p, q, x, y, z, w);
 }
 
 void db_insert_light(int p, int q, int x, int y, int z, int w) {
     if (!db_enabled)
         return;
-    mtx_lock(&mtx);
-    ring_put_light(&ring, p, q, x, y, z, w);
-    cnd_signal(&cnd);
-    mtx_unlock(&mtx);
+    queue_put(LIGHT, p, q, x, y, z, w);
+}
+
+/* sign writes run on the calling thread, readers see them once the db
+ * worker commits */
+static void signs_changed(void) {
+    if (batch_depth)
+        batch_signs = 1;
+    else if (reader_count)
+        db_commit();
 }
 
-void _db_insert_light(int p, int q, int x, int y, int z, int w) {
-    sqlite3_reset(insert_light_stmt);
-    sqlite3_bind_int(insert_light_stmt, 1, p);
-    sqlite3_bind_int(insert_light_stmt, 2, q);
-    sqlite3_bind_int(insert_light_stmt, 3, x);
-    sqlite3_bind_int(insert_light_stmt, 4, y);
-    sqlite3_bind_int(insert_light_stmt, 5, z);
-    sqlite3_bind_int(insert_light_stmt, 6, w);
-    sqlite3_step(insert_light_stmt);
+/* writes between begin and end share one commit, the block and light
+ * entries already reach the worker in one drain */
+void db_begin_batch(void) {
+    batch_depth++;
+}
+
+void db_end_batch(void) {
+    if (!batch_depth || --batch_depth)
+        return;
+    if (batch_signs) {
+        batch_signs = 0;
+        signs_changed();
+    }
 }
 
 void db_insert_sign(
@@ -395,6 +905,7 @@ void db_insert_sign(
     sqlite3_bind_int(insert_sign_stmt, 6, face);
     sqlite3_bind_text(insert_sign_stmt, 7, text, -1, NULL);
     sqlite3_step(insert_sign_stmt);
+    signs_changed();
 }
 
 void db_delete_sign(int x, int y, int z, int face) {
@@ -406,6 +917,7 @@ void db_delete_sign(int x, int y, int z, int face) {
     sqlite3_bind_int(delete_sign_stmt, 3, z);
     sqlite3_bind_int(delete_sign_stmt, 4, face);
     sqlite3_step(delete_sign_stmt);
+    signs_changed();
 }
 
 void db_delete_signs(int x, int y, int z) {
@@ -416,84 +928,114 @@ void db_delete_signs(int x, int y, int z) {
     sqlite3_bind_int(delete_signs_stmt, 2, y);
     sqlite3_bind_int(delete_signs_stmt, 3, z);
     sqlite3_step(delete_signs_stmt);
+    signs_changed();
 }
 
 void db_delete_all_signs() {
     if (!db_enabled)
         return;
     sqlite3_exec(db, "delete from sign;", NULL, NULL, NULL);
+    signs_changed();
+}
+
+/* applies the edits of a cached chunk blob to map; returns 0 if the
+ * chunk is not cached */
+static int cache_load(Map *map, int p, int q, int part) {
+    int slot;
+    mtx_lock(&cache_mtx);
+    slot = chunk_index_get(&cache_index, p, q);
+    if (slot >= 0 && cache[slot].blob.size[part]) {
+        region_edits_each(cache[slot].blob.data[part],
+            cache[slot].blob.size[part], p, q, load_edit, map);
+    }
+    mtx_unlock(&cache_mtx);
+    return slot >= 0;
+}
+
+/* one indexed lookup per chunk, the edits are decoded straight into
+ * the map */
+static void blob_load(Map *map, int p, int q, int part) {
+    Reader *reader;
+    sqlite3_stmt *stmt;
+    const unsigned char *start;
+    unsigned int length;
+    if (cache_load(map, p, q, part))
+        return;
+    reader = reader_acquire();
+    stmt = reader->load_blob_stmt;
+    sqlite3_bind_int(stmt, 1, p);
+    sqlite3_bind_int(stmt, 2, q);
+    if (sqlite3_step(stmt) == SQLITE_ROW &&
+        sqlite3_column_int(stmt, 0) == BLOB_VERSION &&
+        blob_part((const unsigned char *)sqlite3_column_blob(stmt, 1),
+            sqlite3_column_bytes(stmt, 1), part, &start, &length))
+    {
+        region_edits_each(start, length, p, q, load_edit, map);
+    }
+    // ends the read transaction so WAL checkpoints are not held back
+    sqlite3_reset(stmt);
+    mtx_unlock(&reader->mtx);
 }
 
 void db_load_blocks(Map *map, int p, int q) {
     if (!db_enabled)
         return;
-    mtx_lock(&load_mtx);
-    sqlite3_reset(load_blocks_stmt);
-    sqlite3_bind_int(load_blocks_stmt, 1, p);
-    sqlite3_bind_int(load_blocks_stmt, 2, q);
-    while (sqlite3_step(load_blocks_stmt) == SQLITE_ROW) {
-        int x = sqlite3_column_int(load_blocks_stmt, 0);
-        int y = sqlite3_column_int(load_blocks_stmt, 1);
-        int z = sqlite3_column_int(load_blocks_stmt, 2);
-        int w = sqlite3_column_int(load_blocks_stmt, 3);
-        map_set(map, x, y, z, w);
+    if (block_regions) {
+        region_store_load(&store, p, q, map);
+        return;
     }
-    mtx_unlock(&load_mtx);
+    blob_load(map, p, q, BLOB_BLOCKS);
 }
 
 void db_load_lights(Map *map, int p, int q) {
     if (!db_enabled)
         return;
-    mtx_lock(&load_mtx);
-    sqlite3_reset(load_lights_stmt);
-    sqlite3_bind_int(load_lights_stmt, 1, p);
-    sqlite3_bind_int(load_lights_stmt, 2, q);
-    while (sqlite3_step(load_lights_stmt) == SQLITE_ROW) {
-        int x = sqlite3_column_int(load_lights_stmt, 0);
-        int y = sqlite3_column_int(load_lights_stmt, 1);
-        int z = sqlite3_column_int(load_lights_stmt, 2);
-        int w = sqlite3_column_int(load_lights_stmt, 3);
-        map_set(map, x, y, z, w);
-    }
-    mtx_unlock(&load_mtx);
+    blob_load(map, p, q, BLOB_LIGHTS);
 }
 
 void db_load_signs(SignList *list, int p, int q) {
+    Reader *reader;
+    sqlite3_stmt *stmt;
     if (!db_enabled)
         return;
-    sqlite3_reset(load_signs_stmt);
-    sqlite3_bind_int(load_signs_stmt, 1, p);
-    sqlite3_bind_int(load_signs_stmt, 2, q);
-    while (sqlite3_step(load_signs_stmt) == SQLITE_ROW) {
-        int x = sqlite3_column_int(load_signs_stmt, 0);
-        int y = sqlite3_column_int(load_signs_stmt, 1);
-        int z = sqlite3_column_int(load_signs_stmt, 2);
-        int face = sqlite3_column_int(load_signs_stmt, 3);
-        const char *text = (const char *)sqlite3_column_text(
-            load_signs_stmt, 4);
+    reader = reader_acquire();
+    stmt = reader->load_signs_stmt;
+    sqlite3_bind_int(stmt, 1, p);
+    sqlite3_bind_int(stmt, 2, q);
+    while (sqlite3_step(stmt) == SQLITE_ROW) {
+        int x = sqlite3_column_int(stmt, 0);
+        int y = sqlite3_column_int(stmt, 1);
+        int z = sqlite3_column_int(stmt, 2);
+        int face = sqlite3_column_int(stmt, 3);
+        const char *text = (const char *)sqlite3_column_text(stmt, 4);
         sign_list_add(list, x, y, z, face, text);
     }
+    sqlite3_reset(stmt);
+    mtx_unlock(&reader->mtx);
 }
 
 int db_get_key(int p, int q) {
+    Reader *reader;
+    sqlite3_stmt *stmt;
+    int key = 0;
     if (!db_enabled)
         return 0;
-    sqlite3_reset(get_key_stmt);
-    sqlite3_bind_int(get_key_stmt, 1, p);
-    sqlite3_bind_int(get_key_stmt, 2, q);
-    if (sqlite3_step(get_key_stmt) == SQLITE_ROW) {
-        return sqlite3_column_int(get_key_stmt, 0);
+    reader = reader_acquire();
+    stmt = reader->get_key_stmt;
+    sqlite3_bind_int(stmt, 1, p);
+    sqlite3_bind_int(stmt, 2, q);
+    if (sqlite3_step(stmt) == SQLITE_ROW) {
+        key = sqlite3_column_int(stmt, 0);
     }
-    return 0;
+    sqlite3_reset(stmt);
+    mtx_unlock(&reader->mtx);
+    return key;
 }
 
 void db_set_key(int p, int q, int key) {
     if (!db_enabled)
         return;
-    mtx_lock(&mtx);
-    ring_put_key(&ring, p, q, key);
-    cnd_signal(&cnd);
-    mtx_unlock(&mtx);
+    queue_put(KEY, p, q, 0, 0, 0, key);
 }
 
 void _db_set_key(int p, int q, int key) {
@@ -507,55 +1049,153 @@ void _db_set_key(int p, int q, int key) {
 void db_worker_start(char *path) {
     if (!db_enabled)
         return;
-    ring_alloc(&ring, 1024);
-    mtx_init(&mtx, mtx_plain);
-    mtx_init(&load_mtx, mtx_plain);
-    cnd_init(&cnd);
+    spsc_ring_alloc(&ring, QUEUE_SIZE);
     thrd_create(&thrd, db_worker_run, path);
 }
 
 void db_worker_stop(void) {
     if (!db_enabled)
         return;
-    mtx_lock(&mtx);
-    ring_put_exit(&ring);
-    cnd_signal(&cnd);
-    mtx_unlock(&mtx);
+    queue_put(EXIT, 0, 0, 0, 0, 0, 0);
     thrd_join(thrd, NULL);
-    cnd_destroy(&cnd);
-    mtx_destroy(&load_mtx);
-    mtx_destroy(&mtx);
-    ring_free(&ring);
+    spsc_ring_free(&ring);
+}
+
+static void batch_alloc(WriteBatch *batch) {
+    batch->count = 0;
+    batch->capacity = 1024;
+    batch->rows = (RingEntry *)malloc(batch->capacity * sizeof(RingEntry));
+    batch->mask = 2047;
+    batch->slots = (unsigned int *)calloc(
+        batch->mask + 1, sizeof(unsigned int));
+}
+
+static void batch_free(WriteBatch *batch) {
+    free(batch->rows);
+    free(batch->slots);
+}
+
+static unsigned int batch_hash(RingEntry *e) {
+    unsigned int h = e->p * 73856093u ^ e->q * 19349663u;
+    h ^= e->x * 83492791u ^ e->y * 2654435761u ^ e->z * 40503u;
+    return h ^ (h >> 16);
+}
+
+static unsigned int *batch_slot(WriteBatch *batch, RingEntry *e) {
+    unsigned int index = batch_hash(e) & batch->mask;
+    while (batch->slots[index]) {
+        RingEntry *row = batch->rows + batch->slots[index] - 1;
+        if (row->x == e->x && row->y == e->y && row->z == e->z &&
+            row->p == e->p && row->q == e->q)
+            break;
+        index = (index + 1) & batch->mask;
+    }
+    return batch->slots + index;
+}
+
+/* later writes to the same position replace earlier ones */
+static void batch_put(WriteBatch *batch, RingEntry *e) {
+    unsigned int *slot = batch_slot(batch, e);
+    unsigned int i;
+    if (*slot) {
+        batch->rows[*slot - 1].w = e->w;
+        return;
+    }
+    if (batch->count == batch->capacity) {
+        batch->capacity *= 2;
+        batch->rows = (RingEntry *)realloc(
+            batch->rows, batch->capacity * sizeof(RingEntry));
+    }
+    batch->rows[batch->count++] = *e;
+    *slot = batch->count;
+    if (batch->count * 2 <= batch->mask)
+        return;
+    batch->mask = (batch->mask << 1) | 1;
+    free(batch->slots);
+    batch->slots = (unsigned int *)calloc(
+        batch->mask + 1, sizeof(unsigned int));
+    for (i = 0; i < batch->count; i++)
+        *batch_slot(batch, batch->rows + i) = i + 1;
 }
 
+/* block edits go to the region store when it is selected, everything
+ * else is merged into the chunk blobs; edits a failed flush left in
+ * the store are retried with the next batch */
+static void batch_flush(WriteBatch *batch, int part) {
+    unsigned int i;
+    int regions = part == BLOB_BLOCKS && block_regions;
+    if (!batch->count && !(regions && store.count))
+        return;
+    if (regions) {
+        int region[3] = {0, 0, 1};
+        for (i = 0; i < batch->count; i++) {
+            RingEntry *e = batch->rows + i;
+            store_edit(e->p, e->q, e->x, e->y, e->z, e->w, region);
+        }
+        if (region_store_flush(&store))
+            LOG_ERROR("Error writing blocks to %s, retrying later\n",
+                store.prefix);
+    }
+    else {
+        EditList list;
+        memset(&list, 0, sizeof(list));
+        for (i = 0; i < batch->count; i++) {
+            RingEntry *e = batch->rows + i;
+            edits_add(&list, e->p, e->q, e->x, e->y, e->z, e->w);
+        }
+        blob_merge(list.data, list.count, part);
+        free(list.data);
+    }
+    batch->count = 0;
+    memset(batch->slots, 0, (batch->mask + 1) * sizeof(unsigned int));
+}
+
+/* drains up to a ring's worth of writes at a time and writes them in
+ * batches */
 int db_worker_run(void *arg) {
     int running = 1;
+    WriteBatch blocks;
+    WriteBatch lights;
+    batch_alloc(&blocks);
+    batch_alloc(&lights);
     while (running)
     {
        RingEntry e;
-       mtx_lock(&mtx);
-       while (!ring_get(&ring, &e))
-          cnd_wait(&cnd, &mtx);
-       mtx_unlock(&mtx);
-
-       switch (e.type)
+       int count = 0;
+       spsc_ring_wait(&ring);
+       while (running && count++ < QUEUE_SIZE && spsc_ring_get(&ring, &e))
        {
-          case BLOCK:
-             _db_insert_block(e.p, e.q, e.x, e.y, e.z, e.w);
-             break;
-          case LIGHT:
-             _db_insert_light(e.p, e.q, e.x, e.y, e.z, e.w);
-             break;
-          case KEY:
-             _db_set_key(e.p, e.q, e.key);
-             break;
-          case COMMIT:
-             _db_commit();
-             break;
-          case EXIT:
-             running = 0;
-             break;
+          switch (e.type)
+          {
+             case BLOCK:
+                batch_put(&blocks, &e);
+                break;
+             case LIGHT:
+                batch_put(&lights, &e);
+                break;
+             case KEY:
+                _db_set_key(e.p, e.q, e.key);
+                break;
+             case COMMIT:
+                batch_flush(&blocks, BLOB_BLOCKS);
+                batch_flush(&lights, BLOB_LIGHTS);
+                if (cache_flush())
+                   LOG_ERROR("Error writing chunk blobs\n");
+                _db_commit();
+                break;
+             case EXIT:
+                running = 0;
+                break;
+          }
        }
+       batch_flush(&blocks, BLOB_BLOCKS);
+       batch_flush(&lights, BLOB_LIGHTS);
+       if (!running && cache_flush())
+          LOG_ERROR("Error writing chunk blobs\n");
+       if (reader_count && running)
+          _db_commit();
     }
+    batch_free(&blocks);
+    batch_free(&lights);
     return 0;
 }
@@ -7,9 +7,11 @@
 void db_enable();
 void db_disable();
 int get_db_enabled();
-int db_init(char *path, char *auth_path);
+int db_init(char *path, char *auth_path, int workers);
 void db_close();
 void db_commit();
+void db_begin_batch(void);
+void db_end_batch(void);
 void db_auth_set(char *username, char *identity_token);
 int db_auth_select(char *username);
 void db_auth_select_none();
@@ -0,0 +1,140 @@
+#include <stdlib.h>
+#include <string.h>
+#include "inbox.h"
+
+#define INBOX_DISTANCE(a, b) ((a) > (b) ? (a) : (b))
+
+void inbox_alloc(Inbox *inbox) {
+    memset(inbox, 0, sizeof(Inbox));
+    inbox->free_message = -1;
+    inbox->free_run = -1;
+    inbox->current = -1;
+}
+
+void inbox_free(Inbox *inbox) {
+    free(inbox->messages);
+    free(inbox->chunks);
+    free(inbox->runs);
+    inbox_alloc(inbox);
+}
+
+/* the scan of a run holds it open until inbox_close_run */
+int inbox_run(Inbox *inbox, char *buffer) {
+    int index = inbox->free_run;
+    if (index >= 0) {
+        inbox->free_run = inbox->runs[index].pending;
+    }
+    else {
+        if (inbox->run_count == inbox->run_capacity) {
+            inbox->run_capacity = inbox->run_capacity ?
+                inbox->run_capacity * 2 : 16;
+            inbox->runs = (InboxRun *)realloc(inbox->runs,
+                sizeof(InboxRun) * inbox->run_capacity);
+        }
+        index = inbox->run_count++;
+    }
+    inbox->runs[index].buffer = buffer;
+    inbox->runs[index].pending = 1;
+    return index;
+}
+
+/* returns the run's buffer once nothing refers to it any more */
+char *inbox_close_run(Inbox *inbox, int run) {
+    InboxRun *e = inbox->runs + run;
+    char *buffer = e->buffer;
+    if (--e->pending)
+        return 0;
+    e->buffer = 0;
+    e->pending = inbox->free_run;
+    inbox->free_run = run;
+    return buffer;
+}
+
+void inbox_add(Inbox *inbox, int run, int p, int q, char *data, int size) {
+    InboxMessage *message;
+    InboxChunk *chunk = 0;
+    int i, index;
+    for (i = inbox->chunk_count - 1; i >= 0; i--) {
+        if (inbox->chunks[i].p == p && inbox->chunks[i].q == q) {
+            chunk = inbox->chunks + i;
+            break;
+        }
+    }
+    if (!chunk) {
+        if (inbox->chunk_count == inbox->chunk_capacity) {
+            inbox->chunk_capacity = inbox->chunk_capacity ?
+                inbox->chunk_capacity * 2 : 64;
+            inbox->chunks = (InboxChunk *)realloc(inbox->chunks,
+                sizeof(InboxChunk) * inbox->chunk_capacity);
+        }
+        chunk = inbox->chunks + inbox->chunk_count++;
+        chunk->p = p;
+        chunk->q = q;
+        chunk->first = chunk->last = -1;
+    }
+    index = inbox->free_message;
+    if (index >= 0) {
+        inbox->free_message = inbox->messages[index].next;
+    }
+    else {
+        if (inbox->message_count == inbox->message_capacity) {
+            inbox->message_capacity = inbox->message_capacity ?
+                inbox->message_capacity * 2 : 1024;
+            inbox->messages = (InboxMessage *)realloc(inbox->messages,
+                sizeof(InboxMessage) * inbox->message_capacity);
+        }
+        index = inbox->message_count++;
+    }
+    message = inbox->messages + index;
+    message->data = data;
+    message->size = size;
+    message->next = -1;
+    message->run = run;
+    if (chunk->last >= 0)
+        inbox->messages[chunk->last].next = index;
+    else
+        chunk->first = index;
+    chunk->last = index;
+    inbox->runs[run].pending++;
+    inbox->size++;
+}
+
+/* takes the oldest message of the chunk being drained, or of the chunk
+ * nearest to p, q once that one is empty; -1 when nothing is queued */
+int inbox_next(Inbox *inbox, int p, int q) {
+    InboxChunk *chunk;
+    int index;
+    if (inbox->current < 0) {
+        int i, best = -1;
+        for (i = 0; i < inbox->chunk_count; i++) {
+            InboxChunk *e = inbox->chunks + i;
+            int distance = INBOX_DISTANCE(abs(e->p - p), abs(e->q - q));
+            if (inbox->current < 0 || distance < best) {
+                inbox->current = i;
+                best = distance;
+            }
+        }
+        if (inbox->current < 0)
+            return -1;
+    }
+    chunk = inbox->chunks + inbox->current;
+    index = chunk->first;
+    chunk->first = inbox->messages[index].next;
+    if (chunk->first < 0) {
+        *chunk = inbox->chunks[--inbox->chunk_count];
+        inbox->current = -1;
+    }
+    return index;
+}
+
+/* frees a message taken with inbox_next, returning its run's buffer
+ * when that was the last message left in it */
+char *inbox_done(Inbox *inbox, int index) {
+    InboxMessage *message = inbox->messages + index;
+    int run = message->run;
+    message->data = 0;
+    message->next = inbox->free_message;
+    inbox->free_message = index;
+    inbox->size--;
+    return inbox_close_run(inbox, run);
+}
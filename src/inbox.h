@@ -0,0 +1,50 @@
+#ifndef _inbox_h_
+#define _inbox_h_
+
+/* world messages waiting to be applied, queued per chunk in arrival
+ * order. each message points into a run borrowed from client_recv,
+ * the run is handed back once none of its messages are left */
+typedef struct {
+    char *data;
+    int size;
+    int next;
+    int run;
+} InboxMessage;
+
+typedef struct {
+    int p;
+    int q;
+    int first;
+    int last;
+} InboxChunk;
+
+typedef struct {
+    char *buffer;
+    int pending;
+} InboxRun;
+
+typedef struct {
+    InboxMessage *messages;
+    int message_count;
+    int message_capacity;
+    int free_message;
+    InboxChunk *chunks;
+    int chunk_count;
+    int chunk_capacity;
+    int current;
+    InboxRun *runs;
+    int run_count;
+    int run_capacity;
+    int free_run;
+    int size;
+} Inbox;
+
+void inbox_alloc(Inbox *inbox);
+void inbox_free(Inbox *inbox);
+int inbox_run(Inbox *inbox, char *buffer);
+char *inbox_close_run(Inbox *inbox, int run);
+void inbox_add(Inbox *inbox, int run, int p, int q, char *data, int size);
+int inbox_next(Inbox *inbox, int p, int q);
+char *inbox_done(Inbox *inbox, int index);
+
+#endif
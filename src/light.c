@@ -0,0 +1,153 @@
+#include <stdlib.h>
+#include "light.h"
+
+static const int offsets[6][3] = {
+    {-1, 0, 0}, {1, 0, 0}, {0, -1, 0}, {0, 1, 0}, {0, 0, -1}, {0, 0, 1}
+};
+
+static void queue_alloc(LightQueue *queue, int capacity) {
+    queue->capacity = capacity;
+    queue->start = 0;
+    queue->end = 0;
+    queue->data = (LightNode *)malloc(capacity * sizeof(LightNode));
+}
+
+static void queue_put(LightQueue *queue, int x, int y, int z, int w) {
+    LightNode *node;
+    if (queue->end == queue->capacity) {
+        queue->capacity *= 2;
+        queue->data = (LightNode *)realloc(
+            queue->data, queue->capacity * sizeof(LightNode));
+    }
+    node = queue->data + queue->end++;
+    node->x = x;
+    node->y = y;
+    node->z = z;
+    node->w = w;
+}
+
+static int queue_get(LightQueue *queue, LightNode *node) {
+    if (queue->start == queue->end) {
+        queue->start = queue->end = 0;
+        return 0;
+    }
+    *node = queue->data[queue->start++];
+    return 1;
+}
+
+void light_world_init(
+    LightWorld *world, light_get_func get, light_set_func set,
+    light_opaque_func opaque, light_source_func source, void *arg)
+{
+    world->get = get;
+    world->set = set;
+    world->opaque = opaque;
+    world->source = source;
+    world->arg = arg;
+    queue_alloc(&world->fill, 1024);
+    queue_alloc(&world->drain, 1024);
+    queue_alloc(&world->seed, 64);
+}
+
+void light_world_free(LightWorld *world) {
+    free(world->fill.data);
+    free(world->drain.data);
+    free(world->seed.data);
+}
+
+/* breadth first fill from the queued cells, each node carries the
+ * level it was given when queued */
+static void light_fill(LightWorld *world) {
+    LightNode node;
+    while (queue_get(&world->fill, &node)) {
+        int i;
+        int w = node.w - 1;
+        if (w <= 0)
+            continue;
+        if (world->get(node.x, node.y, node.z, world->arg) != node.w)
+            continue;
+        for (i = 0; i < 6; i++) {
+            int x = node.x + offsets[i][0];
+            int y = node.y + offsets[i][1];
+            int z = node.z + offsets[i][2];
+            if (world->get(x, y, z, world->arg) >= w)
+                continue;
+            if (world->opaque(x, y, z, world->arg))
+                continue;
+            world->set(x, y, z, w, world->arg);
+            queue_put(&world->fill, x, y, z, w);
+        }
+    }
+}
+
+/* set a light of level w at a cell, opaque or not, and spread it */
+void light_add(LightWorld *world, int x, int y, int z, int w) {
+    if (world->get(x, y, z, world->arg) >= w)
+        return;
+    world->set(x, y, z, w, world->arg);
+    queue_put(&world->fill, x, y, z, w);
+    light_fill(world);
+}
+
+/* queue a lit cell to spread from on the next light_update, e.g.
+ * along the border of a chunk that just loaded */
+void light_push(LightWorld *world, int x, int y, int z) {
+    int w = world->get(x, y, z, world->arg);
+    if (w > 1)
+        queue_put(&world->fill, x, y, z, w);
+}
+
+void light_update(LightWorld *world) {
+    light_fill(world);
+}
+
+/* a cell stopped blocking light, let its neighbors spread into it */
+void light_unblock(LightWorld *world, int x, int y, int z) {
+    int i;
+    for (i = 0; i < 6; i++) {
+        light_push(world,
+            x + offsets[i][0], y + offsets[i][1], z + offsets[i][2]);
+    }
+    light_fill(world);
+}
+
+/* two queue removal: darken every cell that was lit through this one,
+ * collecting brighter cells on the border to refill from. sources the
+ * drain passes through are darkened like any cell, so whatever they lit
+ * is drained too, and then relit before the refill */
+void light_remove(LightWorld *world, int x, int y, int z) {
+    LightNode node;
+    int w = world->get(x, y, z, world->arg);
+    if (!w)
+        return;
+    world->set(x, y, z, 0, world->arg);
+    queue_put(&world->drain, x, y, z, w);
+    while (queue_get(&world->drain, &node)) {
+        int i;
+        int source = world->source(node.x, node.y, node.z, world->arg);
+        if (source > 0)
+            queue_put(&world->seed, node.x, node.y, node.z, source);
+        for (i = 0; i < 6; i++) {
+            int nx = node.x + offsets[i][0];
+            int ny = node.y + offsets[i][1];
+            int nz = node.z + offsets[i][2];
+            int nw = world->get(nx, ny, nz, world->arg);
+            if (!nw)
+                continue;
+            if (nw < node.w) {
+                world->set(nx, ny, nz, 0, world->arg);
+                queue_put(&world->drain, nx, ny, nz, nw);
+            }
+            else {
+                queue_put(&world->fill, nx, ny, nz, nw);
+            }
+        }
+    }
+    while (queue_get(&world->seed, &node)) {
+        if (world->get(node.x, node.y, node.z, world->arg) >= node.w)
+            continue;
+        world->set(node.x, node.y, node.z, node.w, world->arg);
+        queue_put(&world->fill, node.x, node.y, node.z, node.w);
+    }
+    light_fill(world);
+}
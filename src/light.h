@@ -0,0 +1,44 @@
+#ifndef _light_h_
+#define _light_h_
+
+typedef struct {
+    int x;
+    int y;
+    int z;
+    int w;
+} LightNode;
+
+typedef struct {
+    unsigned int capacity;
+    unsigned int start;
+    unsigned int end;
+    LightNode *data;
+} LightQueue;
+
+typedef int (*light_get_func)(int x, int y, int z, void *arg);
+typedef void (*light_set_func)(int x, int y, int z, int w, void *arg);
+typedef int (*light_opaque_func)(int x, int y, int z, void *arg);
+typedef int (*light_source_func)(int x, int y, int z, void *arg);
+
+typedef struct {
+    light_get_func get;
+    light_set_func set;
+    light_opaque_func opaque;
+    light_source_func source;
+    void *arg;
+    LightQueue fill;
+    LightQueue drain;
+    LightQueue seed;
+} LightWorld;
+
+void light_world_init(
+    LightWorld *world, light_get_func get, light_set_func set,
+    light_opaque_func opaque, light_source_func source, void *arg);
+void light_world_free(LightWorld *world);
+void light_add(LightWorld *world, int x, int y, int z, int w);
+void light_push(LightWorld *world, int x, int y, int z);
+void light_update(LightWorld *world);
+void light_unblock(LightWorld *world, int x, int y, int z);
+void light_remove(LightWorld *world, int x, int y, int z);
+
+#endif
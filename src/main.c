@@ -10,14 +10,20 @@
 #include <time.h>
 #include "lodepng.h"
 #include "auth.h"
+#include "chunk_index.h"
 #include "client.h"
 #include "config.h"
 #include "cube.h"
 #include "db.h"
+#include "inbox.h"
 #include "item.h"
+#include "light.h"
 #include "map.h"
 #include "matrix.h"
+#include "mesh.h"
+#include "message.h"
 #include <noise.h>
+#include "region.h"
 #include "sign.h"
 #include "util.h"
 #include <tinycthread.h>
@@ -28,6 +34,12 @@
 #include <retro_miscellaneous.h>
 #endif
 
+#if defined(_WIN32)
+#include <windows.h>
+#else
+#include <unistd.h>
+#endif
+
 #include "../textures/font_texture.h"
 #include "../textures/sign_texture.h"
 #include "../textures/sky_texture.h"
@@ -40,19 +52,32 @@ extern retro_environment_t environ_cb;
 extern unsigned game_width, game_height;
 double glfwGetTime(void);
 void glfwSetTime(double val);
+double wall_clock(void);
 
 unsigned RENDER_CHUNK_RADIUS = 10;
 unsigned SHOW_INFO_TEXT = 1;
 unsigned JUMPING_FLASH_MODE = 0;
 unsigned FIELD_OF_VIEW = 90;
 unsigned INVERTED_AIM = 1;
+/* off by default: merging only uniformly shaded faces saves about 18%
+ * of the faces of generated terrain (see tests/mesh_faces) */
+unsigned GREEDY_MESHING = 0;
+unsigned WORKER_THREADS = 0;
+unsigned PREGEN_RADIUS = 0;
+unsigned BLOCK_REGIONS = 0;
+unsigned NET_BUDGET = 4;
 float ANALOG_SENSITIVITY = 0.0200;
 float DEADZONE_RADIUS = 0.040;
 
 #define MAX_CHUNKS 8192
+#define CHUNK_INDEX_SIZE (MAX_CHUNKS * 2)
 #define MAX_PLAYERS 128
-#define WORKERS 4
+#define MAX_WORKERS 16
+#define JOBS_PER_WORKER 2
+#define MAX_JOBS (MAX_WORKERS * JOBS_PER_WORKER)
 #define MAX_TEXT_LENGTH 256
+#define MAX_INBOX 65536
+#define MAX_INBOX_APPLY 1024
 #define MAX_PATH_LENGTH 256
 #define MAX_ADDR_LENGTH 256
 
@@ -63,21 +88,26 @@ float DEADZONE_RADIUS = 0.040;
 #define MODE_OFFLINE 0
 #define MODE_ONLINE 1
 
-#define WORKER_IDLE 0
-#define WORKER_BUSY 1
-#define WORKER_DONE 2
+#define JOB_IDLE 0
+#define JOB_QUEUED 1
+#define JOB_BUSY 2
+#define JOB_DONE 3
 
 typedef struct {
     Map map;
     Map lights;
+    Map levels;
     SignList signs;
     int p;
     int q;
     int faces;
     int sign_faces;
     int dirty;
+    int loaded;
     int miny;
     int maxy;
+    int packed;
+    int pending;
     uintptr_t buffer;
     uintptr_t sign_buffer;
 } Chunk;
@@ -88,19 +118,26 @@ typedef struct {
     int load;
     Map *block_maps[3][3];
     Map *light_maps[3][3];
+    Map *level_maps[3][3];
     int miny;
     int maxy;
     int faces;
     float *data;
+    short *packed;
+    SignList signs;
+    int key;
+    int meshed;
 } WorkerItem;
 
 typedef struct {
-    int index;
     int state;
-    thrd_t thrd;
-    mtx_t mtx;
-    cnd_t cnd;
+    int score;
     WorkerItem item;
+} Job;
+
+typedef struct {
+    int index;
+    thrd_t thrd;
 } Worker;
 
 typedef struct {
@@ -111,9 +148,17 @@ typedef struct {
 } Block;
 
 typedef struct {
-    Worker workers[WORKERS];
+    Worker workers[MAX_WORKERS];
+    int worker_count;
+    Job jobs[MAX_JOBS];
+    mtx_t job_mtx;
+    cnd_t job_cnd;
+    int workers_exit;
     Chunk chunks[MAX_CHUNKS];
     int chunk_count;
+    ChunkIndex chunk_index;
+    LightWorld light_world;
+    WorldGen *world_gen;
     int create_radius;
     int delete_radius;
     int sign_radius;
@@ -137,10 +182,13 @@ typedef struct {
     int mode_changed;
     char db_path[MAX_PATH_LENGTH];
     char db_auth_path[MAX_PATH_LENGTH];
+    char terrain_path[MAX_PATH_LENGTH];
+    RegionBake *bake;
     char server_addr[MAX_ADDR_LENGTH];
     int server_port;
     int day_length;
     int time_changed;
+    int greedy_meshing;
     Block block0;
     Block block1;
     Block copy0;
@@ -208,6 +256,22 @@ void sglfwSetTime(double val)
 #endif
 
 static Model model;
+static Inbox inbox;
+static craft_info_t info;
+
+static int cpu_count(void)
+{
+#if defined(_WIN32)
+   SYSTEM_INFO info;
+   GetSystemInfo(&info);
+   return info.dwNumberOfProcessors;
+#elif defined(_SC_NPROCESSORS_ONLN)
+   long count = sysconf(_SC_NPROCESSORS_ONLN);
+   return count > 0 ? count : 1;
+#else
+   return 4;
+#endif
+}
 
 static int rand_int(int n)
 {
@@ -240,6 +304,11 @@ static float *malloc_faces(int components, int faces)
     return (float*)malloc(sizeof(float) *  6 * components * faces);
 }
 
+static float *malloc_quads(int components, int faces)
+{
+    return (float*)malloc(sizeof(float) *  4 * components * faces);
+}
+
 static void flip_image_vertical(
     unsigned char *data, unsigned int width, unsigned int height)
 {
@@ -468,7 +537,7 @@ static uintptr_t gen_wireframe_buffer(float x, float y, float z, float n)
 
 static uintptr_t gen_water_buffer(float x, float y, float z, float n)
 {
-    float data[120];
+    float data[80];
     float ao[6][4] = {0};
     float light[6][4] = {
         {0.5, 0.5, 0.5, 0.5},
@@ -484,7 +553,7 @@ static uintptr_t gen_water_buffer(float x, float y, float z, float n)
         0, 0, 255, 0, 0, 0,
         x, y - n, z, n);
     make_cube_faces(
-        data + 60, ao, light,
+        data + 40, ao, light,
         0, 0, 0, 1, 0, 0,
         0, 0, 0, 255, 0, 0,
         x, y + n, z, n);
@@ -500,7 +569,7 @@ static uintptr_t gen_sky_buffer(void)
 
 static uintptr_t gen_cube_buffer(float x, float y, float z, float n, int w)
 {
-    float *data = malloc_faces(10, 6);
+    float *data = malloc_quads(10, 6);
     float ao[6][4] = {0};
     float light[6][4] = {
         {0.5, 0.5, 0.5, 0.5},
@@ -511,24 +580,24 @@ static uintptr_t gen_cube_buffer(float x, float y, float z, float n, int w)
         {0.5, 0.5, 0.5, 0.5}
     };
     make_cube(data, ao, light, 1, 1, 1, 1, 1, 1, x, y, z, n, w);
-    return renderer_gen_faces(10, 6, data);
+    return renderer_gen_quads(10, 6, data);
 }
 
 static uintptr_t gen_plant_buffer(float x, float y, float z, float n, int w)
 {
-    float *data = malloc_faces(10, 4);
+    float *data = malloc_quads(10, 4);
     float ao    = 0;
     float light = 1;
 
     make_plant(data, ao, light, x, y, z, n, w, 45);
-    return renderer_gen_faces(10, 4, data);
+    return renderer_gen_quads(10, 4, data);
 }
 
 static uintptr_t gen_player_buffer(float x, float y, float z, float rx, float ry)
 {
-    float *data = malloc_faces(10, 6);
+    float *data = malloc_quads(10, 6);
     make_player(data, x, y, z, rx, ry);
-    return renderer_gen_faces(10, 6, data);
+    return renderer_gen_quads(10, 6, data);
 }
 
 static uintptr_t gen_text_buffer(float x, float y, float n, char *text)
@@ -544,17 +613,36 @@ static uintptr_t gen_text_buffer(float x, float y, float n, char *text)
    return renderer_gen_faces(4, length, data);
 }
 
-static void draw_triangles_3d_ao(Attrib *attrib, uintptr_t buffer, int count) {
+static void draw_quads_3d_ao(Attrib *attrib, uintptr_t buffer, int faces) {
    unsigned attrib_size   = 3;
    unsigned normal_enable = 1;
    unsigned uv_enable     = 1;
+   int first;
 
    renderer_bind_array_buffer(attrib, buffer, normal_enable, uv_enable);
-   renderer_modify_array_buffer(attrib, attrib_size, normal_enable, uv_enable, 10);
-   renderer_draw_triangle_arrays(DRAW_PRIM_TRIANGLES, count);
+   for (first = 0; first < faces; first += MAX_QUAD_BATCH)
+   {
+      renderer_modify_array_buffer_from(attrib, attrib_size,
+            normal_enable, uv_enable, 10, first * 4);
+      renderer_draw_elements(DRAW_PRIM_TRIANGLES, info.quad_buffer,
+            MIN(faces - first, MAX_QUAD_BATCH) * 6);
+   }
    renderer_unbind_array_buffer(attrib, normal_enable, uv_enable);
 }
 
+static void draw_quads_3d_packed(Attrib *attrib, uintptr_t buffer, int faces) {
+   int first;
+
+   renderer_bind_array_buffer(attrib, buffer, 0, 1);
+   for (first = 0; first < faces; first += MAX_QUAD_BATCH)
+   {
+      renderer_modify_packed_array_buffer(attrib, first * 4);
+      renderer_draw_elements(DRAW_PRIM_TRIANGLES, info.quad_buffer,
+            MIN(faces - first, MAX_QUAD_BATCH) * 6);
+   }
+   renderer_unbind_array_buffer(attrib, 0, 1);
+}
+
 static void draw_triangles_3d_text(Attrib *attrib, uintptr_t buffer, int count) {
    unsigned attrib_size   = 3;
    unsigned normal_enable = 0;
@@ -736,14 +824,10 @@ static Player *player_crosshair(Player *player)
 
 static Chunk *find_chunk(int p, int q)
 {
-   unsigned i;
    Model *g = (Model*)&model;
-   for (i = 0; i < g->chunk_count; i++)
-   {
-      Chunk *chunk = g->chunks + i;
-      if (chunk->p == p && chunk->q == q)
-         return chunk;
-   }
+   int slot = chunk_index_get(&g->chunk_index, p, q);
+   if (slot >= 0)
+      return g->chunks + slot;
    return 0;
 }
 
@@ -1084,337 +1168,183 @@ static void gen_sign_buffer(Chunk *chunk)
    chunk->sign_faces  = faces;
 }
 
-static int has_lights(Chunk *chunk)
+static void dirty_chunk(Chunk *chunk)
 {
-   int dp, dq;
-   if (!SHOW_LIGHTS)
-      return 0;
-
-   for (dp = -1; dp <= 1; dp++)
-   {
-      for (dq = -1; dq <= 1; dq++)
-      {
-         Map *map;
-         Chunk *other = chunk;
-         if (dp || dq)
-            other = find_chunk(chunk->p + dp, chunk->q + dq);
-         if (!other)
-            continue;
-         map = &other->lights;
-         if (map->size)
-            return 1;
-      }
-   }
-
-   return 0;
+   chunk->dirty = 1;
 }
 
-static void dirty_chunk(Chunk *chunk)
+/* propagated light levels live in each chunk's levels map, a change
+ * also dirties the neighbors whose meshes sample the cell */
+static int light_level_get(int x, int y, int z, void *arg)
 {
-   int dp, dq;
+   Chunk *chunk = find_chunk(chunked(x), chunked(z));
+   if (!chunk)
+      return 0;
+   return map_get(&chunk->levels, x, y, z);
+}
 
-   chunk->dirty = 1;
+static void light_level_set(int x, int y, int z, int w, void *arg)
+{
+   int dp;
+   int p        = chunked(x);
+   int q        = chunked(z);
+   Chunk *chunk = find_chunk(p, q);
 
-   if (!has_lights(chunk))
+   if (!chunk || !map_set(&chunk->levels, x, y, z, w))
       return;
 
    for (dp = -1; dp <= 1; dp++)
    {
+      int dq;
       for (dq = -1; dq <= 1; dq++)
       {
-         Chunk *other = find_chunk(chunk->p + dp, chunk->q + dq);
+         Chunk *other;
+         if (dp && chunked(x + dp) == p)
+            continue;
+         if (dq && chunked(z + dq) == q)
+            continue;
+         other = find_chunk(p + dp, q + dq);
          if (other)
             other->dirty = 1;
       }
    }
 }
 
-static void occlusion(
-    int8_t neighbors[27], int8_t lights[27], float shades[27],
-    float ao[6][4], float light[6][4])
+static int light_opaque(int x, int y, int z, void *arg)
 {
-   unsigned i, j;
-    static const int lookup3[6][4][3] = {
-        {{0, 1, 3}, {2, 1, 5}, {6, 3, 7}, {8, 5, 7}},
-        {{18, 19, 21}, {20, 19, 23}, {24, 21, 25}, {26, 23, 25}},
-        {{6, 7, 15}, {8, 7, 17}, {24, 15, 25}, {26, 17, 25}},
-        {{0, 1, 9}, {2, 1, 11}, {18, 9, 19}, {20, 11, 19}},
-        {{0, 3, 9}, {6, 3, 15}, {18, 9, 21}, {24, 15, 21}},
-        {{2, 5, 11}, {8, 5, 17}, {20, 11, 23}, {26, 17, 23}}
-    };
-   static const int lookup4[6][4][4] = {
-        {{0, 1, 3, 4}, {1, 2, 4, 5}, {3, 4, 6, 7}, {4, 5, 7, 8}},
-        {{18, 19, 21, 22}, {19, 20, 22, 23}, {21, 22, 24, 25}, {22, 23, 25, 26}},
-        {{6, 7, 15, 16}, {7, 8, 16, 17}, {15, 16, 24, 25}, {16, 17, 25, 26}},
-        {{0, 1, 9, 10}, {1, 2, 10, 11}, {9, 10, 18, 19}, {10, 11, 19, 20}},
-        {{0, 3, 9, 12}, {3, 6, 12, 15}, {9, 12, 18, 21}, {12, 15, 21, 24}},
-        {{2, 5, 11, 14}, {5, 8, 14, 17}, {11, 14, 20, 23}, {14, 17, 23, 26}}
-    };
-    static const float curve[4] = {0.0, 0.25, 0.5, 0.75};
-
-    for (i = 0; i < 6; i++)
-    {
-        for (j = 0; j < 4; j++)
-        {
-           float total;
-           unsigned k;
-           int corner = neighbors[lookup3[i][j][0]];
-           int side1 = neighbors[lookup3[i][j][1]];
-           int side2 = neighbors[lookup3[i][j][2]];
-           int value = side1 && side2 ? 3 : corner + side1 + side2;
-           float shade_sum = 0;
-           float light_sum = 0;
-           int is_light = lights[13] == 15;
-
-           for (k = 0; k < 4; k++) {
-              shade_sum += shades[lookup4[i][j][k]];
-              light_sum += lights[lookup4[i][j][k]];
-           }
-           if (is_light)
-              light_sum = 15 * 4 * 10;
-           total = curve[value] + shade_sum / 4.0;
-           ao[i][j] = MIN(total, 1.0);
-           light[i][j] = light_sum / 15.0 / 4.0;
-        }
-    }
+   Chunk *chunk;
+   if (y < 0 || y >= MAX_BLOCK_HEIGHT)
+      return 1;
+   chunk = find_chunk(chunked(x), chunked(z));
+   if (!chunk || !chunk->loaded)
+      return 1;
+   return !is_transparent(map_get(&chunk->map, x, y, z));
 }
 
-#define XZ_SIZE (CHUNK_SIZE * 3 + 2)
-#define XZ_LO (CHUNK_SIZE)
-#define XZ_HI (CHUNK_SIZE * 2 + 1)
-#define Y_SIZE (MAX_BLOCK_HEIGHT + 2)
-#define XYZ(x, y, z) ((y) * XZ_SIZE * XZ_SIZE + (x) * XZ_SIZE + (z))
-#define XZ(x, z) ((x) * XZ_SIZE + (z))
-
-static void light_fill(
-    int8_t *opaque, int8_t *light,
-    int x, int y, int z, int w, int force)
+/* the placed light at a cell, so light_remove can relight sources that
+ * its drain passes through */
+static int light_source(int x, int y, int z, void *arg)
 {
-    if (x + w < XZ_LO || z + w < XZ_LO)
-        return;
-    if (x - w > XZ_HI || z - w > XZ_HI)
-        return;
-    if (y < 0 || y >= Y_SIZE)
-        return;
-    if (light[XYZ(x, y, z)] >= w)
-        return;
-    if (!force && opaque[XYZ(x, y, z)])
-        return;
-
-    light[XYZ(x, y, z)] = w--;
-    light_fill(opaque, light, x - 1, y, z, w, 0);
-    light_fill(opaque, light, x + 1, y, z, w, 0);
-    light_fill(opaque, light, x, y - 1, z, w, 0);
-    light_fill(opaque, light, x, y + 1, z, w, 0);
-    light_fill(opaque, light, x, y, z - 1, w, 0);
-    light_fill(opaque, light, x, y, z + 1, w, 0);
+   Chunk *chunk = find_chunk(chunked(x), chunked(z));
+   if (!chunk || !chunk->loaded)
+      return 0;
+   return map_get(&chunk->lights, x, y, z);
 }
 
-static void compute_chunk(WorkerItem *item)
+/* light a freshly loaded chunk from its own sources and from whatever
+ * already reaches its border from the neighbors */
+static void light_chunk(Chunk *chunk)
 {
+   int dp;
    Map *map;
-   unsigned a, b;
-   int miny = MAX_BLOCK_HEIGHT;
-   int maxy = 0;
-   int faces = 0;
-   int8_t *opaque  = (int8_t *)calloc(XZ_SIZE * XZ_SIZE * Y_SIZE, sizeof(int8_t));
-   int8_t *light   = (int8_t*)calloc(XZ_SIZE * XZ_SIZE * Y_SIZE, sizeof(int8_t));
-   int8_t *highest = (int8_t*)calloc(XZ_SIZE * XZ_SIZE, sizeof(int8_t));
-   int ox        = item->p * CHUNK_SIZE - CHUNK_SIZE - 1;
-   int oy        = -1;
-   int oz        = item->q * CHUNK_SIZE - CHUNK_SIZE - 1;
-   /* check for lights */
-   int has_light = 0;
-
-   if (!opaque || !light || !highest)
-   {
-      free(opaque);
-      free(light);
-      free(highest);
+   Model *g = (Model*)&model;
+   LightWorld *world = &g->light_world;
+   int x0 = chunk->p * CHUNK_SIZE - 1;
+   int z0 = chunk->q * CHUNK_SIZE - 1;
+   int x1 = x0 + CHUNK_SIZE + 1;
+   int z1 = z0 + CHUNK_SIZE + 1;
+
+   if (!SHOW_LIGHTS)
       return;
-   }
 
-   if (SHOW_LIGHTS)
+   map = &chunk->lights;
+   MAP_FOR_EACH(map, ex, ey, ez, ew)
    {
-      for (a = 0; a < 3; a++)
-      {
-         for (b = 0; b < 3; b++)
-         {
-            Map *map = item->light_maps[a][b];
-            if (map && map->size)
-               has_light = 1;
-         }
-      }
-   }
+      if (ew > 0)
+         light_add(world, ex, ey, ez, ew);
+   } END_MAP_FOR_EACH;
 
-   // populate opaque array
-   for (a = 0; a < 3; a++)
+   for (dp = -1; dp <= 1; dp++)
    {
-      for (b = 0; b < 3; b++)
+      int dq;
+      for (dq = -1; dq <= 1; dq++)
       {
-         Map *map = item->block_maps[a][b];
-         if (!map)
+         Chunk *other;
+         if (!dp && !dq)
+            continue;
+         other = find_chunk(chunk->p + dp, chunk->q + dq);
+         if (!other || !other->loaded)
             continue;
+         map = &other->levels;
          MAP_FOR_EACH(map, ex, ey, ez, ew)
          {
-            int x = ex - ox;
-            int y = ey - oy;
-            int z = ez - oz;
-            int w = ew;
-            // TODO: this should be unnecessary
-            if (x < 0 || y < 0 || z < 0)
+            if (ew <= 1)
                continue;
-            if (x >= XZ_SIZE || y >= Y_SIZE || z >= XZ_SIZE)
+            if (ex < x0 || ex > x1 || ez < z0 || ez > z1)
                continue;
-            // END TODO
-            opaque[XYZ(x, y, z)] = !is_transparent(w);
-            if (opaque[XYZ(x, y, z)])
-               highest[XZ(x, z)] = MAX(highest[XZ(x, z)], y);
+            light_push(world, ex, ey, ez);
          } END_MAP_FOR_EACH;
       }
    }
+   light_update(world);
+}
 
-   // flood fill light intensities
-   if (has_light)
-   {
-      for (a = 0; a < 3; a++)
-      {
-         for (b = 0; b < 3; b++)
-         {
-            Map *map = item->light_maps[a][b];
-            if (!map)
-               continue;
-            MAP_FOR_EACH(map, ex, ey, ez, ew)
-            {
-               int x = ex - ox;
-               int y = ey - oy;
-               int z = ez - oz;
-               light_fill(opaque, light, x, y, z, ew, 1);
-            } END_MAP_FOR_EACH;
-         }
-      }
-   }
-
-   map = item->block_maps[1][1];
+/* take a chunk's own sources back out before it unloads, so the light
+ * they spilled into the neighbors does not outlive them */
+static void unlight_chunk(Chunk *chunk)
+{
+   Map *map;
+   Model *g = (Model*)&model;
 
-   /* count exposed faces */
-   MAP_FOR_EACH(map, ex, ey, ez, ew) {
-      if (ew <= 0)
-         continue;
-      {
-         int x = ex - ox;
-         int y = ey - oy;
-         int z = ez - oz;
-         int f1 = !opaque[XYZ(x - 1, y, z)];
-         int f2 = !opaque[XYZ(x + 1, y, z)];
-         int f3 = !opaque[XYZ(x, y + 1, z)];
-         int f4 = !opaque[XYZ(x, y - 1, z)] && (ey > 0);
-         int f5 = !opaque[XYZ(x, y, z - 1)];
-         int f6 = !opaque[XYZ(x, y, z + 1)];
-         int total = f1 + f2 + f3 + f4 + f5 + f6;
-         if (total == 0)
-            continue;
-         if (is_plant(ew))
-            total = 4;
-         miny = MIN(miny, ey);
-         maxy = MAX(maxy, ey);
-         faces += total;
-      }
-   } END_MAP_FOR_EACH;
+   if (!SHOW_LIGHTS || !chunk->loaded)
+      return;
 
+   /* an unloaded chunk neither relights its sources nor lets the
+    * refill back in */
+   chunk->loaded = 0;
+   map = &chunk->lights;
+   MAP_FOR_EACH(map, ex, ey, ez, ew)
    {
-      // generate geometry
-      float *data = malloc_faces(10, faces);
-      int offset = 0;
-      MAP_FOR_EACH(map, ex, ey, ez, ew) {
-         int8_t neighbors[27] = {0};
-         int8_t lights[27] = {0};
-         float shades[27] = {0};
-         int index = 0;
-         int dx;
-         int x = ex - ox;
-         int y = ey - oy;
-         int z = ez - oz;
-         int f1 = !opaque[XYZ(x - 1, y, z)];
-         int f2 = !opaque[XYZ(x + 1, y, z)];
-         int f3 = !opaque[XYZ(x, y + 1, z)];
-         int f4 = !opaque[XYZ(x, y - 1, z)] && (ey > 0);
-         int f5 = !opaque[XYZ(x, y, z - 1)];
-         int f6 = !opaque[XYZ(x, y, z + 1)];
-         int total = f1 + f2 + f3 + f4 + f5 + f6;
-         if (ew <= 0) {
-            continue;
-         }
-         if (total == 0) {
-            continue;
-         }
-         for (dx = -1; dx <= 1; dx++) {
-            int dy;
-            for (dy = -1; dy <= 1; dy++) {
-               int dz;
-               for (dz = -1; dz <= 1; dz++) {
-                  neighbors[index] = opaque[XYZ(x + dx, y + dy, z + dz)];
-                  lights[index] = light[XYZ(x + dx, y + dy, z + dz)];
-                  shades[index] = 0;
-                  if (y + dy <= highest[XZ(x + dx, z + dz)]) {
-                     int oy;
-                     for (oy = 0; oy < 8; oy++) {
-                        if (opaque[XYZ(x + dx, y + dy + oy, z + dz)]) {
-                           shades[index] = 1.0 - oy * 0.125;
-                           break;
-                        }
-                     }
-                  }
-                  index++;
-               }
-            }
-         }
-
-         {
-            float ao[6][4];
-            float light[6][4];
-            occlusion(neighbors, lights, shades, ao, light);
+      if (ew > 0)
+         light_remove(&g->light_world, ex, ey, ez);
+   } END_MAP_FOR_EACH;
+}
 
-            if (is_plant(ew))
-            {
-               int a;
-               float rotation;
-               float min_ao = 1;
-               float max_light = 0;
-               total = 4;
-               for (a = 0; a < 6; a++)
-               {
-                  int b;
-                  for (b = 0; b < 4; b++)
-                  {
-                     min_ao = MIN(min_ao, ao[a][b]);
-                     max_light = MAX(max_light, light[a][b]);
-                  }
-               }
-               rotation = simplex2(ex, ez, 4, 0.5, 2) * 360;
-               make_plant(
-                     data + offset, min_ao, max_light,
-                     ex, ey, ez, 0.5, ew, rotation);
-            }
-            else
-               make_cube(
-                     data + offset, ao, light,
-                     f1, f2, f3, f4, f5, f6,
-                     ex, ey, ez, 0.5, ew);
-            offset += total * 60;
-         }
-      } END_MAP_FOR_EACH;
+/* relight around a block whose opacity changed */
+static void light_block(Chunk *chunk, int x, int y, int z, int previous, int w)
+{
+   Model *g = (Model*)&model;
 
-      free(opaque);
-      free(light);
-      free(highest);
+   if (!SHOW_LIGHTS || !chunk->loaded)
+      return;
+   if (is_transparent(previous) == is_transparent(w))
+      return;
+   if (is_transparent(w))
+      light_unblock(&g->light_world, x, y, z);
+   else if (!map_get(&chunk->lights, x, y, z))
+      light_remove(&g->light_world, x, y, z);
+}
 
-      item->miny = miny;
-      item->maxy = maxy;
-      item->faces = faces;
-      free(item->data);
-      item->data = data;
+static void compute_chunk(WorkerItem *item)
+{
+   Mesh mesh;
+   item->meshed = 0;
+   if (mesh_chunk(&mesh, item->p, item->q, item->block_maps,
+            SHOW_LIGHTS ? item->level_maps : NULL, GREEDY_MESHING))
+      return;
+   item->miny = mesh.miny;
+   item->maxy = mesh.maxy;
+   item->faces = mesh.faces;
+   free(item->data);
+   free(item->packed);
+   item->data = mesh.data;
+   item->packed = NULL;
+   item->meshed = 1;
+#if PACKED_VERTICES
+   /* packed positions reach about 500 blocks above miny */
+   if (mesh.faces && mesh.maxy - mesh.miny < 500)
+   {
+      item->packed = (short*)malloc(sizeof(short) * 6 * 4 * mesh.faces);
+      if (item->packed)
+      {
+         pack_block_vertices(
+               item->packed, mesh.data, mesh.faces * 4,
+               item->p * CHUNK_SIZE, mesh.miny, item->q * CHUNK_SIZE);
+         free(item->data);
+         item->data = NULL;
+      }
    }
+#endif
 }
 
 static void generate_chunk(Chunk *chunk, WorkerItem *item) {
@@ -1422,8 +1352,13 @@ static void generate_chunk(Chunk *chunk, WorkerItem *item) {
     chunk->maxy = item->maxy;
     chunk->faces = item->faces;
     renderer_del_buffer(chunk->buffer);
-    chunk->buffer = renderer_gen_faces(10, item->faces, item->data);
+    chunk->packed = item->packed != NULL;
+    if (chunk->packed)
+        chunk->buffer = renderer_gen_packed_quads(item->faces, item->packed);
+    else
+        chunk->buffer = renderer_gen_quads(10, item->faces, item->data);
     item->data = 0;
+    item->packed = 0;
     gen_sign_buffer(chunk);
 }
 
@@ -1450,12 +1385,12 @@ static void gen_chunk_buffer(Chunk *chunk)
          if (other)
          {
             item->block_maps[dp + 1][dq + 1] = &other->map;
-            item->light_maps[dp + 1][dq + 1] = &other->lights;
+            item->level_maps[dp + 1][dq + 1] = &other->levels;
          }
          else
          {
             item->block_maps[dp + 1][dq + 1] = 0;
-            item->light_maps[dp + 1][dq + 1] = 0;
+            item->level_maps[dp + 1][dq + 1] = 0;
          }
       }
    }
@@ -1464,26 +1399,53 @@ static void gen_chunk_buffer(Chunk *chunk)
    chunk->dirty = 0;
 }
 
-static void map_set_func(int x, int y, int z, int w, void *arg)
+static void map_reserve_func(int count, void *arg)
+{
+    map_reserve((Map *)arg, count);
+}
+
+static void map_fill_func(int x, int y0, int y1, int z, int w, void *arg)
 {
-    Map *map = (Map *)arg;
-    map_set(map, x, y, z, w);
+    map_fill_column((Map *)arg, x, y0, y1, z, w);
 }
 
 static void load_chunk(WorkerItem *item)
 {
+    Model *g = (Model*)&model;
     int p = item->p;
     int q = item->q;
     Map *block_map = item->block_maps[1][1];
     Map *light_map = item->light_maps[1][1];
-    create_world(p, q, map_set_func, block_map);
+    // baked terrain replaces generation when present
+    if (!g->terrain_path[0] ||
+        !region_load_chunk(g->terrain_path, g->world_gen, p, q, block_map))
+    {
+        create_world_fill(g->world_gen, p, q,
+            map_reserve_func, map_fill_func, block_map);
+    }
     db_load_blocks(block_map, p, q);
     db_load_lights(light_map, p, q);
+    sign_list_alloc(&item->signs, 16);
+    db_load_signs(&item->signs, p, q);
+    item->key = db_get_key(p, q);
 }
 
-static void request_chunk(int p, int q)
+/* signs set while the chunk was loading are newer than the loaded ones */
+static void swap_signs(Chunk *chunk, SignList *signs)
+{
+   unsigned int i;
+   for (i = 0; i < chunk->signs.size; i++)
+   {
+      Sign *e = chunk->signs.data + i;
+      sign_list_add(signs, e->x, e->y, e->z, e->face, e->text);
+   }
+   sign_list_free(&chunk->signs);
+   chunk->signs = *signs;
+   memset(signs, 0, sizeof(SignList));
+}
+
+static void request_chunk(int p, int q, int key)
 {
-   int key = db_get_key(p, q);
    client_chunk(p, q, key);
 }
 
@@ -1493,17 +1455,21 @@ static void init_chunk(Chunk *chunk, int p, int q)
    Map *block_map;
    Map *light_map;
    SignList *signs;
+   Model *g = (Model*)&model;
 
    chunk->p = p;
    chunk->q = q;
    chunk->faces = 0;
    chunk->sign_faces = 0;
+   chunk->packed = 0;
+   chunk->pending = 0;
    chunk->buffer = 0;
    chunk->sign_buffer = 0;
+   chunk->loaded = 0;
+   chunk_index_set(&g->chunk_index, p, q, chunk - g->chunks);
    dirty_chunk(chunk);
    signs = &chunk->signs;
    sign_list_alloc(signs, 16);
-   db_load_signs(signs, p, q);
    block_map = &chunk->map;
    light_map = &chunk->lights;
    dx = p * CHUNK_SIZE - 1;
@@ -1511,6 +1477,7 @@ static void init_chunk(Chunk *chunk, int p, int q)
    dz = q * CHUNK_SIZE - 1;
    map_alloc(block_map, dx, dy, dz, 0x7fff);
    map_alloc(light_map, dx, dy, dz, 0xf);
+   map_alloc(&chunk->levels, dx, dy, dz, 0xf);
 }
 
 static void create_chunk(Chunk *chunk, int p, int q)
@@ -1526,8 +1493,11 @@ static void create_chunk(Chunk *chunk, int p, int q)
    item->block_maps[1][1] = &chunk->map;
    item->light_maps[1][1] = &chunk->lights;
    load_chunk(item);
+   swap_signs(chunk, &item->signs);
+   chunk->loaded = 1;
+   light_chunk(chunk);
 
-   request_chunk(p, q);
+   request_chunk(p, q, item->key);
 }
 
 static void delete_chunks(void)
@@ -1561,13 +1531,20 @@ static void delete_chunks(void)
       {
          Chunk *other;
 
+         unlight_chunk(chunk);
          map_free(&chunk->map);
          map_free(&chunk->lights);
+         map_free(&chunk->levels);
          sign_list_free(&chunk->signs);
          renderer_del_buffer(chunk->buffer);
          renderer_del_buffer(chunk->sign_buffer);
+         chunk_index_remove(&g->chunk_index, chunk->p, chunk->q);
          other = g->chunks + (--count);
-         memcpy(chunk, other, sizeof(Chunk));
+         if (other != chunk)
+         {
+            memcpy(chunk, other, sizeof(Chunk));
+            chunk_index_set(&g->chunk_index, chunk->p, chunk->q, i);
+         }
       }
    }
    g->chunk_count = count;
@@ -1582,63 +1559,94 @@ static void delete_all_chunks(void)
       Chunk *chunk = g->chunks + i;
       map_free(&chunk->map);
       map_free(&chunk->lights);
+      map_free(&chunk->levels);
       sign_list_free(&chunk->signs);
       renderer_del_buffer(chunk->buffer);
       renderer_del_buffer(chunk->sign_buffer);
    }
    g->chunk_count = 0;
+   chunk_index_clear(&g->chunk_index);
 }
 
 static void check_workers(void)
 {
    int i;
-   for (i = 0; i < WORKERS; i++)
+   Model *g = (Model*)&model;
+   for (i = 0; i < MAX_JOBS; i++)
    {
-      Model *g = (Model*)&model;
-      Worker *worker = g->workers + i;
-      mtx_lock(&worker->mtx);
-      if (worker->state == WORKER_DONE)
+      Job *job = g->jobs + i;
+      int a;
+      WorkerItem *item;
+      Chunk *chunk;
+
+      mtx_lock(&g->job_mtx);
+      a = job->state;
+      mtx_unlock(&g->job_mtx);
+      if (a != JOB_DONE)
+         continue;
+
+      /* done jobs are left alone by the workers until set idle */
+      item = &job->item;
+      chunk = find_chunk(item->p, item->q);
+      /* results for an older incarnation of the chunk are dropped */
+      if (chunk && chunk->pending == i + 1)
       {
-         int a;
-         WorkerItem *item = &worker->item;
-         Chunk *chunk = find_chunk(item->p, item->q);
-         if (chunk)
+         chunk->pending = 0;
+         if (item->load)
          {
-            if (item->load)
-            {
-               Map *block_map = item->block_maps[1][1];
-               Map *light_map = item->light_maps[1][1];
-               map_free(&chunk->map);
-               map_free(&chunk->lights);
-               map_copy(&chunk->map, block_map);
-               map_copy(&chunk->lights, light_map);
-               request_chunk(item->p, item->q);
-            }
-            generate_chunk(chunk, item);
+            /* the loaded maps belong to this job, move them over */
+            Map *block_map = item->block_maps[1][1];
+            Map *light_map = item->light_maps[1][1];
+            map_free(&chunk->map);
+            map_free(&chunk->lights);
+            chunk->map = *block_map;
+            chunk->lights = *light_map;
+            free(block_map);
+            free(light_map);
+            item->block_maps[1][1] = 0;
+            item->light_maps[1][1] = 0;
+            swap_signs(chunk, &item->signs);
+            chunk->loaded = 1;
+            light_chunk(chunk);
+            request_chunk(item->p, item->q, item->key);
          }
-         for (a = 0; a < 3; a++)
+         if (item->meshed)
+            generate_chunk(chunk, item);
+         else
+            dirty_chunk(chunk);
+      }
+      for (a = 0; a < 3; a++)
+      {
+         int b;
+         for (b = 0; b < 3; b++)
          {
-            int b;
-            for (b = 0; b < 3; b++)
+            Map *block_map = item->block_maps[a][b];
+            Map *light_map = item->light_maps[a][b];
+            Map *level_map = item->level_maps[a][b];
+            if (block_map)
             {
-               Map *block_map = item->block_maps[a][b];
-               Map *light_map = item->light_maps[a][b];
-               if (block_map)
-               {
-                  map_free(block_map);
-                  free(block_map);
-               }
+               map_free(block_map);
+               free(block_map);
+            }
 
-               if (light_map)
-               {
-                  map_free(light_map);
-                  free(light_map);
-               }
+            if (light_map)
+            {
+               map_free(light_map);
+               free(light_map);
+            }
+
+            if (level_map)
+            {
+               map_free(level_map);
+               free(level_map);
             }
          }
-         worker->state = WORKER_IDLE;
       }
-      mtx_unlock(&worker->mtx);
+      sign_list_free(&item->signs);
+      memset(&item->signs, 0, sizeof(SignList));
+      mtx_lock(&g->job_mtx);
+      job->state = JOB_IDLE;
+      mtx_unlock(&g->job_mtx);
    }
 }
 
@@ -1673,13 +1681,27 @@ static void force_chunks(Player *player)
    }
 }
 
-static void ensure_chunks_worker(Player *player, Worker *worker)
+/* hand the best scored chunks to idle job slots, workers then take
+ * queued jobs lowest score first */
+static void ensure_chunks_jobs(Player *player)
 {
-   int best_score, best_a, best_b;
-   int start = 0x0fffffff;
+   int i, count = 0, slots = 0;
+   int scores[MAX_JOBS], best_a[MAX_JOBS], best_b[MAX_JOBS];
    State *s = &player->state;
    float matrix[16];
    Model *g = (Model*)&model;
+   int limit = g->worker_count * JOBS_PER_WORKER;
+
+   mtx_lock(&g->job_mtx);
+   for (i = 0; i < limit; i++)
+   {
+      if (g->jobs[i].state == JOB_IDLE)
+         slots++;
+   }
+   mtx_unlock(&g->job_mtx);
+   if (!slots)
+      return;
+
    set_matrix_3d(
          matrix, g->width, g->height,
          s->x, s->y, s->z, s->rx, s->ry, g->fov, g->ortho, RENDER_CHUNK_RADIUS);
@@ -1690,9 +1712,6 @@ static void ensure_chunks_worker(Player *player, Worker *worker)
       int p = chunked(s->x);
       int q = chunked(s->z);
       int r = g->create_radius;
-      best_score = start;
-      best_a = 0;
-      best_b = 0;
       frustum_planes(planes, RENDER_CHUNK_RADIUS, matrix);
 
       for (dp = -r; dp <= r; dp++)
@@ -1700,42 +1719,47 @@ static void ensure_chunks_worker(Player *player, Worker *worker)
          int dq;
          for (dq = -r; dq <= r; dq++)
          {
-            int score;
+            int score, j;
             int distance, invisible;
             Chunk *chunk;
             int priority = 0;
             int a = p + dp;
             int b = q + dq;
-            int index = (ABS(a) ^ ABS(b)) % WORKERS;
 
-            if (index != worker->index)
-               continue;
             chunk = find_chunk(a, b);
-            if (chunk && !chunk->dirty)
+            if (chunk && (!chunk->dirty || chunk->pending))
                continue;
             distance = MAX(ABS(dp), ABS(dq));
             invisible = !chunk_visible(planes, a, b, 0, MAX_BLOCK_HEIGHT);
             if (chunk)
                priority = chunk->buffer && chunk->dirty;
             score = (invisible << 24) | (priority << 16) | distance;
-            if (score < best_score)
+            if (count == slots && score >= scores[count - 1])
+               continue;
+
+            /* keep the best few sorted by score */
+            if (count < slots)
+               count++;
+            for (j = count - 1; j > 0 && scores[j - 1] > score; j--)
             {
-               best_score = score;
-               best_a = a;
-               best_b = b;
+               scores[j] = scores[j - 1];
+               best_a[j] = best_a[j - 1];
+               best_b[j] = best_b[j - 1];
             }
+            scores[j] = score;
+            best_a[j] = a;
+            best_b[j] = b;
          }
       }
    }
 
-   if (best_score == start)
-      return;
-
+   for (i = 0; i < count; i++)
    {
-      int dp;
-      int a = best_a;
-      int b = best_b;
+      int dp, index;
+      int a = best_a[i];
+      int b = best_b[i];
       int load = 0;
+      Job *job = NULL;
       Chunk *chunk = find_chunk(a, b);
       if (!chunk)
       {
@@ -1749,8 +1773,22 @@ static void ensure_chunks_worker(Player *player, Worker *worker)
             return;
       }
 
+      /* only this thread moves jobs out of idle */
+      mtx_lock(&g->job_mtx);
+      for (index = 0; index < limit; index++)
+      {
+         if (g->jobs[index].state == JOB_IDLE)
+         {
+            job = g->jobs + index;
+            break;
+         }
+      }
+      mtx_unlock(&g->job_mtx);
+      if (!job)
+         return;
+
       {
-         WorkerItem *item = &worker->item;
+         WorkerItem *item = &job->item;
          item->p = chunk->p;
          item->q = chunk->q;
          item->load = load;
@@ -1763,68 +1801,131 @@ static void ensure_chunks_worker(Player *player, Worker *worker)
                if (dp || dq)
                   other = find_chunk(chunk->p + dp, chunk->q + dq);
 
+               item->light_maps[dp + 1][dq + 1] = 0;
                if (other)
                {
-                  Map *light_map;
+                  /* read-only views, writes on this thread copy first */
                   Map *block_map = malloc(sizeof(Map));
-                  map_copy(block_map, &other->map);
-                  light_map = malloc(sizeof(Map));
-                  map_copy(light_map, &other->lights);
+                  Map *level_map = malloc(sizeof(Map));
+                  if (load && other == chunk)
+                     map_copy(block_map, &other->map);
+                  else
+                     map_share(block_map, &other->map);
+                  map_share(level_map, &other->levels);
                   item->block_maps[dp + 1][dq + 1] = block_map;
-                  item->light_maps[dp + 1][dq + 1] = light_map;
+                  item->level_maps[dp + 1][dq + 1] = level_map;
                }
                else
                {
                   item->block_maps[dp + 1][dq + 1] = 0;
-                  item->light_maps[dp + 1][dq + 1] = 0;
+                  item->level_maps[dp + 1][dq + 1] = 0;
                }
             }
          }
+         if (load)
+         {
+            Map *light_map = malloc(sizeof(Map));
+            map_copy(light_map, &chunk->lights);
+            item->light_maps[1][1] = light_map;
+         }
          chunk->dirty = 0;
-         worker->state = WORKER_BUSY;
-         cnd_signal(&worker->cnd);
+         chunk->pending = index + 1;
+         mtx_lock(&g->job_mtx);
+         job->score = scores[i];
+         job->state = JOB_QUEUED;
+         cnd_signal(&g->job_cnd);
+         mtx_unlock(&g->job_mtx);
       }
    }
 }
 
 static void ensure_chunks(Player *player)
 {
-   int i;
    check_workers();
    force_chunks(player);
+   ensure_chunks_jobs(player);
+}
 
-   for (i = 0; i < WORKERS; i++)
+/* a loaded chunk that light_chunk is going to relight is meshed once
+ * its levels are in, rather than here and again after */
+static int load_lit(WorkerItem *item)
+{
+   int a, b;
+   if (!SHOW_LIGHTS || !item->load)
+      return 0;
+   if (item->light_maps[1][1]->size)
+      return 1;
+   for (a = 0; a < 3; a++)
    {
-      Model *g = (Model*)&model;
-      Worker *worker = g->workers + i;
-      mtx_lock(&worker->mtx);
-      if (worker->state == WORKER_IDLE)
-         ensure_chunks_worker(player, worker);
-      mtx_unlock(&worker->mtx);
+      for (b = 0; b < 3; b++)
+      {
+         Map *map = item->level_maps[a][b];
+         if (map && map->size)
+            return 1;
+      }
    }
+   return 0;
 }
 
 static int worker_run(void *arg)
 {
-    Worker *worker = (Worker *)arg;
-    int running = 1;
-    while (running)
+    Model *g = (Model*)&model;
+    (void)arg;
+    for (;;)
     {
-       WorkerItem *item;
-
-       mtx_lock(&worker->mtx);
-       while (worker->state != WORKER_BUSY)
-          cnd_wait(&worker->cnd, &worker->mtx);
-       mtx_unlock(&worker->mtx);
-       item = &worker->item;
-       if (item->load)
-          load_chunk(item);
-       compute_chunk(item);
-       mtx_lock(&worker->mtx);
-       worker->state = WORKER_DONE;
-       mtx_unlock(&worker->mtx);
+       int i;
+       Job *job = NULL;
+
+       mtx_lock(&g->job_mtx);
+       while (!job)
+       {
+          if (g->workers_exit)
+          {
+             mtx_unlock(&g->job_mtx);
+             return 0;
+          }
+          for (i = 0; i < MAX_JOBS; i++)
+          {
+             Job *other = g->jobs + i;
+             if (other->state != JOB_QUEUED)
+                continue;
+             if (!job || other->score < job->score)
+                job = other;
+          }
+          if (!job)
+             cnd_wait(&g->job_cnd, &g->job_mtx);
+       }
+       job->state = JOB_BUSY;
+       mtx_unlock(&g->job_mtx);
+       if (job->item.load)
+          load_chunk(&job->item);
+       if (load_lit(&job->item))
+          job->item.meshed = 0;
+       else
+          compute_chunk(&job->item);
+       mtx_lock(&g->job_mtx);
+       job->state = JOB_DONE;
+       mtx_unlock(&g->job_mtx);
     }
-    return 0;
+}
+
+/* workers finish the job in hand and exit, nothing they read may be
+ * freed before this returns */
+static void stop_workers(void)
+{
+   int i;
+   Model *g = (Model*)&model;
+   if (!g->worker_count)
+      return;
+   mtx_lock(&g->job_mtx);
+   g->workers_exit = 1;
+   cnd_broadcast(&g->job_cnd);
+   mtx_unlock(&g->job_mtx);
+   for (i = 0; i < g->worker_count; i++)
+      thrd_join(g->workers[i].thrd, NULL);
+   g->worker_count = 0;
+   mtx_destroy(&g->job_mtx);
+   cnd_destroy(&g->job_cnd);
 }
 
 static void unset_sign(int x, int y, int z)
@@ -1893,6 +1994,17 @@ static void set_sign(int x, int y, int z, int face, const char *text)
     client_sign(x, y, z, face, text);
 }
 
+static void update_light(Chunk *chunk, int x, int y, int z, int w)
+{
+    Model *g = (Model*)&model;
+    if (!SHOW_LIGHTS || !chunk->loaded)
+        return;
+    if (w)
+        light_add(&g->light_world, x, y, z, w);
+    else
+        light_remove(&g->light_world, x, y, z);
+}
+
 static void toggle_light(int x, int y, int z)
 {
     int p = chunked(x);
@@ -1904,7 +2016,7 @@ static void toggle_light(int x, int y, int z)
         map_set(map, x, y, z, w);
         db_insert_light(p, q, x, y, z, w);
         client_light(x, y, z, w);
-        dirty_chunk(chunk);
+        update_light(chunk, x, y, z, w);
     }
 }
 
@@ -1916,7 +2028,7 @@ static void set_light(int p, int q, int x, int y, int z, int w)
       Map *map = &chunk->lights;
       if (map_set(map, x, y, z, w))
       {
-         dirty_chunk(chunk);
+         update_light(chunk, x, y, z, w);
          db_insert_light(p, q, x, y, z, w);
       }
    }
@@ -1930,11 +2042,14 @@ static void _set_block(int p, int q, int x, int y, int z, int w, int dirty)
     if (chunk)
     {
         Map *map = &chunk->map;
+        int previous = map_get(map, x, y, z);
         if (map_set(map, x, y, z, w))
         {
             if (dirty)
                 dirty_chunk(chunk);
             db_insert_block(p, q, x, y, z, w);
+            if (chunked(x) == p && chunked(z) == q)
+                light_block(chunk, x, y, z, previous, w);
         }
     }
     else
@@ -2006,9 +2121,10 @@ static void builder_block(int x, int y, int z, int w)
       set_block(x, y, z, w);
 }
 
-static int render_chunks(Attrib *attrib, Player *player)
+static int render_chunks(Attrib *attrib, Attrib *packed_attrib, Player *player)
 {
    unsigned i;
+   int pass;
    float matrix[16];
    float planes[6][4];
    struct shader_program_info info = {0};
@@ -2048,21 +2164,41 @@ static int render_chunks(Attrib *attrib, Player *player)
       info.timer.enable    = true;
       info.timer.data      = time_of_day();
 
-      render_shader_program(&info);
-
-      for (i = 0; i < g->chunk_count; i++)
+      /* float chunks first, then packed ones with their own program */
+      for (pass = 0; pass <= PACKED_VERTICES; pass++)
       {
-         Chunk *chunk = g->chunks + i;
+         info.attrib = pass ? packed_attrib : attrib;
+         render_shader_program(&info);
 
-         if (chunk_distance(chunk, p, q) > RENDER_CHUNK_RADIUS)
-            continue;
+         for (i = 0; i < g->chunk_count; i++)
+         {
+            Chunk *chunk = g->chunks + i;
 
-         if (!chunk_visible(
-                  planes, chunk->p, chunk->q, chunk->miny, chunk->maxy))
-            continue;
+            if (chunk->packed != pass)
+               continue;
+
+            if (chunk_distance(chunk, p, q) > RENDER_CHUNK_RADIUS)
+               continue;
 
-         draw_triangles_3d_ao(attrib, chunk->buffer, chunk->faces * 6);
-         result += chunk->faces;
+            if (!chunk_visible(
+                     planes, chunk->p, chunk->q, chunk->miny, chunk->maxy))
+               continue;
+
+            if (chunk->packed)
+            {
+               struct shader_program_info origin = {0};
+               origin.attrib        = packed_attrib;
+               origin.origin.enable = true;
+               origin.origin.x      = chunk->p * CHUNK_SIZE;
+               origin.origin.y      = chunk->miny;
+               origin.origin.z      = chunk->q * CHUNK_SIZE;
+               render_shader_program(&origin);
+               draw_quads_3d_packed(packed_attrib, chunk->buffer, chunk->faces);
+            }
+            else
+               draw_quads_3d_ao(attrib, chunk->buffer, chunk->faces);
+            result += chunk->faces;
+         }
       }
    }
    return result;
@@ -2108,7 +2244,7 @@ static void render_water(Attrib *attrib, Player *player)
    buffer = gen_water_buffer(
          s->x, 11 + sinf(glfwGetTime() * 2) * 0.05, s->z,
          RENDER_CHUNK_RADIUS * CHUNK_SIZE);
-   draw_triangles_3d_ao(attrib, buffer, 12);
+   draw_quads_3d_ao(attrib, buffer, 2);
    renderer_del_buffer(buffer);
    renderer_disable_blend();
 }
@@ -2243,7 +2379,7 @@ static void render_players(Attrib *attrib, Player *player)
 
       /* draw player? */
       if (other != player)
-         draw_triangles_3d_ao(attrib, other->buffer, 36);
+         draw_quads_3d_ao(attrib, other->buffer, 6);
    }
 }
 
@@ -2363,15 +2499,15 @@ static void render_item(Attrib *attrib)
    if (is_plant(w))
    {
       buffer = gen_plant_buffer(0, 0, 0, 0.5, w);
-      count  = 24;
+      count  = 4;
    }
    else
    {
       buffer = gen_cube_buffer(0, 0, 0, 0.5, w);
-      count  = 36;
+      count  = 6;
    }
 
-   draw_triangles_3d_ao(attrib, buffer, count);
+   draw_quads_3d_ao(attrib, buffer, count);
 
    renderer_del_buffer(buffer);
 }
@@ -2691,10 +2827,12 @@ static void main_set_db_path(void)
 #endif
       snprintf(g->db_path, MAX_PATH_LENGTH, "%s%c%s", dir, slash, DB_PATH);
       snprintf(g->db_auth_path, MAX_PATH_LENGTH, "%s%c%s", dir, slash, DB_AUTH_PATH);
+      snprintf(g->terrain_path, MAX_PATH_LENGTH, "%s%c%s", dir, slash, TERRAIN_PATH);
    }
    else {
       snprintf(g->db_path, MAX_PATH_LENGTH, "%s", DB_PATH);
       snprintf(g->db_auth_path, MAX_PATH_LENGTH, "%s", DB_AUTH_PATH);
+      snprintf(g->terrain_path, MAX_PATH_LENGTH, "%s", TERRAIN_PATH);
    }
 }
 
@@ -3170,104 +3308,364 @@ void handle_movement(double dt)
    }
 }
 
-static void parse_buffer(char *buffer)
+static void recv_you(int pid, float x, float y, float z, float rx, float ry)
 {
    Model *g = (Model*)&model;
-    Player *me = g->players;
-    State *s = &g->players->state;
-    char *key;
-    char *line = tokenize(buffer, "\n", &key);
-    while (line)
-    {
-        int pid;
-        float ux, uy, uz, urx, ury;
-        float px, py, pz, prx, pry;
-        int bp, bq, bx, by, bz, bw;
-        int face;
-        char text[MAX_SIGN_LENGTH] = {0};
-        char name[MAX_NAME_LENGTH];
-        int kp, kq, kk;
-        double elapsed;
-        int day_length;
-        char format[64];
-
-        if (sscanf(line, "U,%d,%f,%f,%f,%f,%f",
-            &pid, &ux, &uy, &uz, &urx, &ury) == 6)
-        {
-            me->id = pid;
-            s->x = ux; s->y = uy; s->z = uz; s->rx = urx; s->ry = ury;
-            force_chunks(me);
-            if (uy == 0)
-                s->y = highest_block(s->x, s->z) + 2;
-        }
-        if (sscanf(line, "B,%d,%d,%d,%d,%d,%d",
-            &bp, &bq, &bx, &by, &bz, &bw) == 6)
-        {
-            _set_block(bp, bq, bx, by, bz, bw, 0);
-            if (player_intersects_block(2, s->x, s->y, s->z, bx, by, bz))
-                s->y = highest_block(s->x, s->z) + 2;
-        }
-        if (sscanf(line, "L,%d,%d,%d,%d,%d,%d",
-            &bp, &bq, &bx, &by, &bz, &bw) == 6)
-            set_light(bp, bq, bx, by, bz, bw);
+   Player *me = g->players;
+   State *s = &g->players->state;
+   me->id = pid;
+   s->x = x; s->y = y; s->z = z; s->rx = rx; s->ry = ry;
+   force_chunks(me);
+   if (y == 0)
+      s->y = highest_block(s->x, s->z) + 2;
+}
 
-        if (sscanf(line, "P,%d,%f,%f,%f,%f,%f",
-            &pid, &px, &py, &pz, &prx, &pry) == 6)
-        {
-            Player *player = find_player(pid);
-            if (!player && g->player_count < MAX_PLAYERS) {
-                player = g->players + g->player_count;
-                g->player_count++;
-                player->id = pid;
-                player->buffer = 0;
-                snprintf(player->name, MAX_NAME_LENGTH, "player%d", pid);
-                update_player(player, px, py, pz, prx, pry, 1); // twice
-            }
-            if (player)
-                update_player(player, px, py, pz, prx, pry, 1);
-        }
-        if (sscanf(line, "D,%d", &pid) == 1)
-            delete_player(pid);
+static void recv_block(int p, int q, int x, int y, int z, int w)
+{
+   Model *g = (Model*)&model;
+   State *s = &g->players->state;
+   _set_block(p, q, x, y, z, w, 0);
+   if (player_intersects_block(2, s->x, s->y, s->z, x, y, z))
+      s->y = highest_block(s->x, s->z) + 2;
+}
 
+static void recv_player(
+   int pid, float x, float y, float z, float rx, float ry)
+{
+   Model *g = (Model*)&model;
+   Player *player = find_player(pid);
+   if (!player && g->player_count < MAX_PLAYERS) {
+      player = g->players + g->player_count;
+      g->player_count++;
+      player->id = pid;
+      player->buffer = 0;
+      snprintf(player->name, MAX_NAME_LENGTH, "player%d", pid);
+      update_player(player, x, y, z, rx, ry, 1); // twice
+   }
+   if (player)
+      update_player(player, x, y, z, rx, ry, 1);
+}
 
-        if (sscanf(line, "K,%d,%d,%d", &kp, &kq, &kk) == 3)
-            db_set_key(kp, kq, kk);
+static void recv_redraw(int p, int q)
+{
+   Chunk *chunk = find_chunk(p, q);
+   if (chunk)
+      dirty_chunk(chunk);
+}
 
-        if (sscanf(line, "R,%d,%d", &kp, &kq) == 2)
-        {
-            Chunk *chunk = find_chunk(kp, kq);
-            if (chunk)
-                dirty_chunk(chunk);
-        }
+static void recv_time(double elapsed, int day_length)
+{
+   Model *g = (Model*)&model;
+   glfwSetTime(fmod(elapsed, day_length));
+   g->day_length = day_length;
+   g->time_changed = 1;
+}
 
+static void recv_nick(int pid, const char *name)
+{
+   Player *player = find_player(pid);
+   if (player)
+      snprintf(player->name, MAX_NAME_LENGTH, "%.*s", MAX_NAME_LENGTH - 1,
+            name);
+}
 
-        if (sscanf(line, "E,%lf,%d", &elapsed, &day_length) == 2)
-        {
-            glfwSetTime(fmod(elapsed, day_length));
-            g->day_length = day_length;
-            g->time_changed = 1;
-        }
-        if (line[0] == 'T' && line[1] == ',') {
-            char *text = line + 2;
-            add_message(text);
-        }
-        snprintf(
-            format, sizeof(format), "N,%%d,%%%ds", MAX_NAME_LENGTH - 1);
+static void parse_line(char *line)
+{
+   Message m;
+   int *v = m.v;
+   float *f = m.f;
+   if (!message_parse(line, &m))
+      return;
+   switch (m.type) {
+      case 'U':
+         recv_you(v[0], f[0], f[1], f[2], f[3], f[4]);
+         break;
+      case 'P':
+         recv_player(v[0], f[0], f[1], f[2], f[3], f[4]);
+         break;
+      case 'B':
+         recv_block(v[0], v[1], v[2], v[3], v[4], v[5]);
+         break;
+      case 'L':
+         set_light(v[0], v[1], v[2], v[3], v[4], v[5]);
+         break;
+      case 'S':
+         _set_sign(v[0], v[1], v[2], v[3], v[4], v[5], m.text, 0);
+         break;
+      case 'D':
+         delete_player(v[0]);
+         break;
+      case 'K':
+         db_set_key(v[0], v[1], v[2]);
+         break;
+      case 'R':
+         recv_redraw(v[0], v[1]);
+         break;
+      case 'E':
+         recv_time(m.elapsed, v[0]);
+         break;
+      case 'T':
+         add_message(m.text);
+         break;
+      case 'V':
+         client_protocol(v[0]);
+         break;
+      case 'N':
+         recv_nick(v[0], m.text);
+         break;
+   }
+}
 
-        if (sscanf(line, format, &pid, name) == 2)
-        {
-            Player *player = find_player(pid);
-            if (player)
-                strncpy(player->name, name, MAX_NAME_LENGTH);
-        }
-        snprintf(
-            format, sizeof(format),
-            "S,%%d,%%d,%%d,%%d,%%d,%%d,%%%d[^\n]", MAX_SIGN_LENGTH - 1);
-        if (sscanf(line, format,
-            &bp, &bq, &bx, &by, &bz, &face, text) >= 6)
-            _set_sign(bp, bq, bx, by, bz, face, text, 0);
-        line = tokenize(NULL, "\n", &key);
-    }
+/* a chunk sync in one message: the key, then counted lists of blocks,
+ * lights and signs, applied with one db batch and one dirty mark. a
+ * sync split over several messages only carries the key in the last */
+static void recv_chunk(FrameReader *r)
+{
+   Model *g = (Model*)&model;
+   State *s = &g->players->state;
+   char text[MAX_SIGN_LENGTH];
+   int p = frame_int(r);
+   int q = frame_int(r);
+   int key = frame_varint(r);
+   int x0 = p * CHUNK_SIZE;
+   int z0 = q * CHUNK_SIZE;
+   unsigned int count, i;
+   int x, y, z, w;
+   int blocks = 0, changes = 0, intersects = 0;
+   Chunk *chunk;
+
+   if (r->error)
+      return;
+   chunk = find_chunk(p, q);
+   db_begin_batch();
+
+   // a block takes at least four bytes
+   count = frame_count(r, 4);
+   if (chunk && count > 0)
+      map_reserve(&chunk->map, chunk->map.size + count);
+   for (i = 0; i < count && !r->error; i++) {
+      x = frame_int(r) + x0;
+      y = frame_int(r);
+      z = frame_int(r) + z0;
+      w = frame_int(r);
+      if (r->error)
+         break;
+      _set_block(p, q, x, y, z, w, 0);
+      if (player_intersects_block(2, s->x, s->y, s->z, x, y, z))
+         intersects = 1;
+      blocks++;
+   }
+
+   count = r->error ? 0 : frame_count(r, 4);
+   for (i = 0; i < count && !r->error; i++) {
+      x = frame_int(r) + x0;
+      y = frame_int(r);
+      z = frame_int(r) + z0;
+      w = frame_int(r);
+      if (r->error)
+         break;
+      set_light(p, q, x, y, z, w);
+      changes++;
+   }
+
+   count = r->error ? 0 : frame_count(r, 5);
+   for (i = 0; i < count && !r->error; i++) {
+      int length;
+      x = frame_int(r) + x0;
+      y = frame_int(r);
+      z = frame_int(r) + z0;
+      w = frame_int(r);
+      length = frame_varint(r);
+      if (r->error || length > r->end - r->data) {
+         r->error = 1;
+         break;
+      }
+      snprintf(text, MAX_SIGN_LENGTH, "%.*s", length, (const char *)r->data);
+      r->data += length;
+      _set_sign(p, q, x, y, z, w, text, 0);
+      changes++;
+   }
+
+   if (blocks && key && !r->error)
+      db_set_key(p, q, key);
+   db_end_batch();
+   if (blocks || changes)
+      recv_redraw(p, q);
+   if (intersects)
+      s->y = highest_block(s->x, s->z) + 2;
+}
+
+/* framed messages carry block coordinates relative to the chunk origin */
+static void parse_frame(int type, FrameReader *r)
+{
+   int pid, p, q, x, y, z, w;
+   float f[5];
+   double elapsed;
+   char text[MAX_TEXT_LENGTH];
+   switch (type) {
+      case 'U':
+      case 'P':
+         pid = frame_int(r);
+         for (x = 0; x < 5; x++)
+            f[x] = frame_float(r);
+         if (r->error)
+            break;
+         if (type == 'U')
+            recv_you(pid, f[0], f[1], f[2], f[3], f[4]);
+         else
+            recv_player(pid, f[0], f[1], f[2], f[3], f[4]);
+         break;
+      case 'B':
+      case 'L':
+      case 'S':
+         p = frame_int(r);
+         q = frame_int(r);
+         x = frame_int(r) + p * CHUNK_SIZE;
+         y = frame_int(r);
+         z = frame_int(r) + q * CHUNK_SIZE;
+         w = frame_int(r);
+         if (r->error)
+            break;
+         if (type == 'B')
+            recv_block(p, q, x, y, z, w);
+         else if (type == 'L')
+            set_light(p, q, x, y, z, w);
+         else {
+            frame_text(r, text, MAX_SIGN_LENGTH);
+            _set_sign(p, q, x, y, z, w, text, 0);
+         }
+         break;
+      case 'D':
+         pid = frame_int(r);
+         if (!r->error)
+            delete_player(pid);
+         break;
+      case 'K':
+      case 'R':
+         p = frame_int(r);
+         q = frame_int(r);
+         w = type == 'K' ? frame_int(r) : 0;
+         if (r->error)
+            break;
+         if (type == 'K')
+            db_set_key(p, q, w);
+         else
+            recv_redraw(p, q);
+         break;
+      case 'E':
+         elapsed = frame_double(r);
+         w = frame_int(r);
+         if (!r->error)
+            recv_time(elapsed, w);
+         break;
+      case 'T':
+         frame_text(r, text, MAX_TEXT_LENGTH);
+         add_message(text);
+         break;
+      case 'N':
+         pid = frame_int(r);
+         if (r->error)
+            break;
+         frame_text(r, text, MAX_NAME_LENGTH);
+         recv_nick(pid, text);
+         break;
+      case 'H':
+         recv_chunk(r);
+         break;
+   }
+}
+
+static void apply_message(unsigned char *data, int size)
+{
+   if (data[0] & FRAME_BIT)
+   {
+      FrameReader reader;
+      reader.data = data + 1;
+      reader.end = data + size;
+      reader.error = 0;
+      frame_varint(&reader);
+      parse_frame(data[0] & ~FRAME_BIT, &reader);
+   }
+   else
+      parse_line((char *)data);
+}
+
+/* chunk of a world message (blocks, lights, signs, keys and redraws),
+ * 0 for messages about players, time and chat */
+static int message_chunk(unsigned char *data, int size, int *p, int *q)
+{
+   if (data[0] & FRAME_BIT)
+   {
+      FrameReader reader;
+      switch (data[0] & ~FRAME_BIT) {
+         case 'B': case 'L': case 'S': case 'K': case 'R': case 'H':
+            reader.data = data + 1;
+            reader.end = data + size;
+            reader.error = 0;
+            frame_varint(&reader);
+            *p = frame_int(&reader);
+            *q = frame_int(&reader);
+            return !reader.error;
+      }
+      return 0;
+   }
+   switch (data[0]) {
+      case 'B': case 'L': case 'S': case 'K': case 'R':
+      {
+         Message m;
+         if (!message_parse((char *)data, &m))
+            return 0;
+         *p = m.v[0];
+         *q = m.v[1];
+         return 1;
+      }
+   }
+   return 0;
+}
+
+/* player, time and chat messages apply as they arrive, world messages
+ * queue in the inbox for process_inbox */
+static void parse_buffer(char *buffer, int length)
+{
+   int offset = 0;
+   int run = inbox_run(&inbox, buffer);
+   int size, p, q;
+   while ((size = client_message_size(buffer + offset, length - offset)) > 0)
+   {
+      unsigned char *data = (unsigned char *)buffer + offset;
+      if (!(data[0] & FRAME_BIT))
+         data[size - 1] = '\0';
+      if (message_chunk(data, size, &p, &q))
+         inbox_add(&inbox, run, p, q, (char *)data, size);
+      else
+         apply_message(data, size);
+      offset += size;
+   }
+   client_release(inbox_close_run(&inbox, run));
+}
+
+/* applies queued world messages, the chunk nearest the player first,
+ * until NET_BUDGET milliseconds of the frame are used; MAX_INBOX_APPLY
+ * bounds the frame even when the clock does not move */
+static void process_inbox(void)
+{
+   Model *g = (Model*)&model;
+   State *s = &g->players->state;
+   int p = chunked(s->x);
+   int q = chunked(s->z);
+   double start = wall_clock();
+   int applied = 0;
+   int index;
+   while (applied < MAX_INBOX_APPLY &&
+         (index = inbox_next(&inbox, p, q)) >= 0)
+   {
+      InboxMessage *message = inbox.messages + index;
+      apply_message((unsigned char *)message->data, message->size);
+      client_release(inbox_done(&inbox, index));
+      applied++;
+      if (NET_BUDGET && wall_clock() - start > NET_BUDGET / 1000.0)
+         break;
+   }
 }
 
 void reset_model(void)
@@ -3276,6 +3674,7 @@ void reset_model(void)
 
    memset(g->chunks, 0, sizeof(Chunk) * MAX_CHUNKS);
    g->chunk_count = 0;
+   chunk_index_clear(&g->chunk_index);
    memset(g->players, 0, sizeof(Player) * MAX_PLAYERS);
    g->player_count = 0;
    g->observe1 = 0;
@@ -3291,8 +3690,6 @@ void reset_model(void)
    g->time_changed = 1;
 }
 
-static craft_info_t info;
-
 int main_init(void)
 {
    // INITIALIZATION //
@@ -3363,15 +3760,22 @@ int main_load_game(int argc, char **argv)
    g->create_radius = CREATE_CHUNK_RADIUS;
    g->delete_radius = DELETE_CHUNK_RADIUS;
    g->sign_radius   = RENDER_SIGN_RADIUS;
+   chunk_index_alloc(&g->chunk_index, CHUNK_INDEX_SIZE);
+   light_world_init(&g->light_world,
+         light_level_get, light_level_set, light_opaque, light_source, 0);
 
    // INITIALIZE WORKER THREADS
-   for (i = 0; i < WORKERS; i++) {
+   g->world_gen = world_gen_create();
+   g->worker_count = WORKER_THREADS ? WORKER_THREADS : cpu_count() - 1;
+   g->worker_count = MAX(1, MIN(g->worker_count, MAX_WORKERS));
+   memset(g->jobs, 0, sizeof(g->jobs));
+   g->workers_exit = 0;
+   mtx_init(&g->job_mtx, mtx_plain);
+   cnd_init(&g->job_cnd);
+   for (i = 0; i < g->worker_count; i++) {
       Worker *worker = g->workers + i;
       memset(worker, 0, sizeof(*worker));
       worker->index = i;
-      worker->state = WORKER_IDLE;
-      mtx_init(&worker->mtx, mtx_plain);
-      cnd_init(&worker->cnd);
       thrd_create(&worker->thrd, worker_run, worker);
    }
 
@@ -3380,7 +3784,7 @@ int main_load_game(int argc, char **argv)
    {
       int rc;
       db_enable();
-      rc = db_init(g->db_path, g->db_auth_path);
+      rc = db_init(g->db_path, g->db_auth_path, g->worker_count);
       if (rc) {
          LOG_ERROR("Error initing db %s+%s: %d\n",
                 g->db_path, g->db_auth_path, rc);
@@ -3396,8 +3800,9 @@ int main_load_game(int argc, char **argv)
    if (g->mode == MODE_ONLINE) {
       client_enable();
       client_connect(g->server_addr, g->server_port);
+      inbox_alloc(&inbox);
       client_start();
-      client_version(1);
+      client_version(PROTOCOL_VERSION);
       login();
    }
 
@@ -3409,6 +3814,7 @@ int main_load_game(int argc, char **argv)
    info.last_commit = glfwGetTime();
    info.last_update = glfwGetTime();
    info.sky_buffer = gen_sky_buffer();
+   info.quad_buffer = renderer_gen_quad_indices();
 
    info.me = g->players;
    info.s = &g->players->state;
@@ -3420,6 +3826,17 @@ int main_load_game(int argc, char **argv)
    {
       // LOAD STATE FROM DATABASE //
       int loaded = db_load_state(&info.s->x, &info.s->y, &info.s->z, &info.s->rx, &info.s->ry);
+      /* baked in the background, chunks loaded before their region
+       * file is written are generated as usual */
+      if (PREGEN_RADIUS && g->terrain_path[0]) {
+         int p = chunked(info.s->x);
+         int q = chunked(info.s->z);
+         int r = PREGEN_RADIUS;
+         g->bake = region_bake_start(g->terrain_path, g->world_gen,
+               p - r, q - r, p + r, q + r, g->worker_count);
+         if (!g->bake)
+            LOG_ERROR("Error baking terrain to %s\n", g->terrain_path);
+      }
       force_chunks(info.me);
       if (!loaded)
          info.s->y = highest_block(info.s->x, info.s->z) + 2;
@@ -3441,14 +3858,27 @@ void main_unload_game(void)
 
 void main_deinit(void)
 {
+   Model *g = (Model*)&model;
+   stop_workers();
+   if (g->bake)
+   {
+      if (region_bake_finish(g->bake, 1) < 0)
+         LOG_ERROR("Error baking terrain to %s\n", g->terrain_path);
+      g->bake = NULL;
+   }
    db_save_state(info.s->x, info.s->y, info.s->z, info.s->rx, info.s->ry);
    db_close();
    db_disable();
    client_stop();
    client_disable();
+   inbox_free(&inbox);
    renderer_del_buffer(info.sky_buffer);
+   renderer_del_buffer(info.quad_buffer);
    delete_all_chunks();
+   chunk_index_free(&g->chunk_index);
    delete_all_players();
+   world_gen_free(g->world_gen);
+   light_world_free(&g->light_world);
 }
 
 int main_run(void)
@@ -3456,6 +3886,7 @@ int main_run(void)
    int i;
    double now, dt;
    char *buffer;
+   int length;
    char text_buffer[1024];
    float ts, tx, ty;
    int face_count;
@@ -3487,13 +3918,18 @@ int main_run(void)
    // HANDLE MOVEMENT //
    handle_movement(dt);
 
-   // HANDLE DATA FROM SERVER //
-   buffer = client_recv();
-   if (buffer) {
-      parse_buffer(buffer);
-      free(buffer);
+   // REBUILD CHUNKS WHEN THE MESHING MODE CHANGES //
+   if (g->greedy_meshing != (int)GREEDY_MESHING) {
+      g->greedy_meshing = GREEDY_MESHING;
+      for (i = 0; i < g->chunk_count; i++)
+         g->chunks[i].dirty = 1;
    }
 
+   // HANDLE DATA FROM SERVER //
+   while (inbox.size < MAX_INBOX && (buffer = client_recv(&length)))
+      parse_buffer(buffer, length);
+   process_inbox();
+
    // FLUSH DATABASE //
    if (now - info.last_commit > COMMIT_INTERVAL) {
       info.last_commit = now;
@@ -3530,7 +3966,7 @@ int main_run(void)
    renderer_clear_depthbuffer();
    render_sky(&info.sky_attrib, player, info.sky_buffer);
    renderer_clear_depthbuffer();
-   face_count = render_chunks(&info.block_attrib, player);
+   face_count = render_chunks(&info.block_attrib, &info.block_packed_attrib, player);
    render_signs(&info.text_attrib, player);
    render_sign(&info.text_attrib, player);
    render_players(&info.block_attrib, player);
@@ -3554,6 +3990,15 @@ int main_run(void)
    if (SHOW_INFO_TEXT) {
       int hour = time_of_day() * 24;
       char am_pm = hour < 12 ? 'a' : 'p';
+      /* mesh bytes now vs 6 unshared float vertices per face */
+      int mesh_bytes = 0;
+      int unindexed_bytes = 0;
+      for (i = 0; i < g->chunk_count; i++) {
+         Chunk *chunk = g->chunks + i;
+         mesh_bytes += chunk->faces * 4 *
+            (chunk->packed ? sizeof(short) * 6 : sizeof(float) * 10);
+         unindexed_bytes += chunk->faces * 6 * sizeof(float) * 10;
+      }
       hour = hour % 12;
       hour = hour ? hour : 12;
       snprintf(
@@ -3564,6 +4009,23 @@ int main_run(void)
             face_count * 2, hour, am_pm, info.fps.fps);
       render_text(&info.text_attrib, ALIGN_LEFT, tx, ty, ts, text_buffer);
       ty -= ts * 2;
+      snprintf(
+            text_buffer, 1024,
+            "mesh %d bytes/chunk (%d unindexed)",
+            g->chunk_count ? mesh_bytes / g->chunk_count : 0,
+            g->chunk_count ? unindexed_bytes / g->chunk_count : 0);
+      render_text(&info.text_attrib, ALIGN_LEFT, tx, ty, ts, text_buffer);
+      ty -= ts * 2;
+      if (g->mode == MODE_ONLINE) {
+         int sent, received, queued;
+         client_stats(&sent, &received, &queued);
+         snprintf(
+               text_buffer, 1024,
+               "net %dk in (%dk queued) %dk out",
+               received / 1024, queued / 1024, sent / 1024);
+         render_text(&info.text_attrib, ALIGN_LEFT, tx, ty, ts, text_buffer);
+         ty -= ts * 2;
+      }
    }
    if (SHOW_CHAT_TEXT) {
       int i;
@@ -3622,7 +4084,7 @@ int main_run(void)
 
          render_sky(&info.sky_attrib, player, info.sky_buffer);
          renderer_clear_depthbuffer();
-         render_chunks(&info.block_attrib, player);
+         render_chunks(&info.block_attrib, &info.block_packed_attrib, player);
          render_signs(&info.text_attrib, player);
          render_players(&info.block_attrib, player);
          renderer_clear_depthbuffer();
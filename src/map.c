@@ -20,6 +20,288 @@ int hash(int x, int y, int z) {
     return x ^ y ^ z;
 }
 
+#if MAP_SECTIONS
+
+/* local coordinates a section map accepts, the same for set and get */
+#define SECTION_LIMIT (MAX_BLOCK_HEIGHT - 1)
+
+#define SECTION_INDEX(x, y, z) \
+    ((((y) & (MAP_SECTION_Y - 1)) << 10) | \
+     (((x) & (MAP_SECTION_XZ - 1)) << 5) | ((z) & (MAP_SECTION_XZ - 1)))
+
+static MapSection *section_alloc(int x, int y, int z) {
+    MapSection *section = (MapSection *)calloc(1, sizeof(MapSection));
+    section->x = x;
+    section->y = y;
+    section->z = z;
+    section->refs = 1;
+    section->bits = 1;
+    section->palette_size = 1;
+    section->palette = (int16_t *)calloc(2, sizeof(int16_t));
+    section->data = (uint32_t *)calloc(
+        MAP_SECTION_VOLUME / 32, sizeof(uint32_t));
+    return section;
+}
+
+static void section_free(MapSection *section) {
+    free(section->palette);
+    free(section->data);
+    free(section);
+}
+
+static MapSection *section_copy(MapSection *src) {
+    MapSection *dst = (MapSection *)malloc(sizeof(MapSection));
+    size_t words = MAP_SECTION_VOLUME / 32 * src->bits;
+    *dst = *src;
+    dst->refs = 1;
+    dst->palette = (int16_t *)malloc(
+        (1u << src->bits) * sizeof(int16_t));
+    memcpy(dst->palette, src->palette,
+        src->palette_size * sizeof(int16_t));
+    dst->data = (uint32_t *)malloc(words * sizeof(uint32_t));
+    memcpy(dst->data, src->data, words * sizeof(uint32_t));
+    return dst;
+}
+
+static void section_release(MapSection *section) {
+    if (!--section->refs)
+        section_free(section);
+}
+
+static void section_put(MapSection *section, unsigned int i, unsigned int v) {
+    unsigned int bit = i * section->bits;
+    uint32_t mask = ((1u << section->bits) - 1) << (bit & 31);
+    uint32_t *word = section->data + (bit >> 5);
+    *word = (*word & ~mask) | (v << (bit & 31));
+}
+
+static void section_widen(MapSection *section) {
+    MapSection old = *section;
+    unsigned int i;
+    section->bits <<= 1;
+    section->palette = (int16_t *)realloc(section->palette,
+        (1u << section->bits) * sizeof(int16_t));
+    section->data = (uint32_t *)calloc(
+        MAP_SECTION_VOLUME / 32 * section->bits, sizeof(uint32_t));
+    for (i = 0; i < MAP_SECTION_VOLUME; i++) {
+        unsigned int bit = i * old.bits;
+        unsigned int v = (old.data[bit >> 5] >> (bit & 31)) &
+            ((1u << old.bits) - 1);
+        if (v)
+            section_put(section, i, v);
+    }
+    free(old.data);
+}
+
+static unsigned int section_palette(MapSection *section, int w) {
+    unsigned int i;
+    for (i = 0; i < section->palette_size; i++) {
+        if (section->palette[i] == w)
+            return i;
+    }
+    if (section->palette_size == (1u << section->bits))
+        section_widen(section);
+    section->palette[section->palette_size] = w;
+    return section->palette_size++;
+}
+
+static MapSection **section_slot(Map *map, int x, int y, int z) {
+    unsigned int index = hash(x, y, z) & map->mask;
+    MapSection **slot = map->sections + index;
+    while (*slot) {
+        MapSection *section = *slot;
+        if (section->x == x && section->y == y && section->z == z)
+            break;
+        index = (index + 1) & map->mask;
+        slot = map->sections + index;
+    }
+    return slot;
+}
+
+/* mask only sizes the hash backend; the section directory starts small */
+void map_alloc(Map *map, int dx, int dy, int dz, int mask) {
+    map->dx = dx;
+    map->dy = dy;
+    map->dz = dz;
+    map->mask = 0xf;
+    map->size = 0;
+    map->count = 0;
+    map->sections = (MapSection **)calloc(
+        map->mask + 1, sizeof(MapSection *));
+}
+
+void map_free(Map *map) {
+    unsigned int i;
+    for (i = 0; i <= map->mask; i++) {
+        if (map->sections[i])
+            section_release(map->sections[i]);
+    }
+    free(map->sections);
+}
+
+void map_copy(Map *dst, Map *src) {
+    unsigned int i;
+    *dst = *src;
+    dst->sections = (MapSection **)calloc(
+        dst->mask + 1, sizeof(MapSection *));
+    for (i = 0; i <= src->mask; i++) {
+        if (src->sections[i])
+            dst->sections[i] = section_copy(src->sections[i]);
+    }
+}
+
+/* the directory is copied, sections are shared until either side
+ * writes to them */
+void map_share(Map *dst, Map *src) {
+    unsigned int i;
+    *dst = *src;
+    dst->sections = (MapSection **)malloc(
+        (dst->mask + 1) * sizeof(MapSection *));
+    for (i = 0; i <= src->mask; i++) {
+        dst->sections[i] = src->sections[i];
+        if (dst->sections[i])
+            dst->sections[i]->refs++;
+    }
+}
+
+int map_set(Map *map, int x, int y, int z, int w) {
+    MapSection **slot;
+    MapSection *section;
+    unsigned int i;
+    int previous;
+    x -= map->dx;
+    y -= map->dy;
+    z -= map->dz;
+    if (x < 0 || x > SECTION_LIMIT) return 0;
+    if (y < 0 || y > SECTION_LIMIT) return 0;
+    if (z < 0 || z > SECTION_LIMIT) return 0;
+    slot = section_slot(map,
+        x / MAP_SECTION_XZ, y / MAP_SECTION_Y, z / MAP_SECTION_XZ);
+    section = *slot;
+    if (!section) {
+        if (!w)
+            return 0;
+        section = *slot = section_alloc(
+            x / MAP_SECTION_XZ, y / MAP_SECTION_Y, z / MAP_SECTION_XZ);
+        map->count++;
+        if (map->count * 2 > map->mask)
+            map_grow(map);
+    }
+    i = SECTION_INDEX(x, y, z);
+    previous = MAP_SECTION_GET(section, i);
+    if (previous == w)
+        return 0;
+    if (section->refs > 1) {
+        section->refs--;
+        section = *slot = section_copy(section);
+    }
+    if (!previous) {
+        section->count++;
+        map->size++;
+    }
+    else if (!w) {
+        section->count--;
+        map->size--;
+    }
+    section_put(section, i, w ? section_palette(section, w) : 0);
+    return 1;
+}
+
+int map_get(Map *map, int x, int y, int z) {
+    MapSection *section;
+    x -= map->dx;
+    y -= map->dy;
+    z -= map->dz;
+    if (x < 0 || x > SECTION_LIMIT) return 0;
+    if (y < 0 || y > SECTION_LIMIT) return 0;
+    if (z < 0 || z > SECTION_LIMIT) return 0;
+    section = *section_slot(map,
+        x / MAP_SECTION_XZ, y / MAP_SECTION_Y, z / MAP_SECTION_XZ);
+    if (!section)
+        return 0;
+    return MAP_SECTION_GET(section, SECTION_INDEX(x, y, z));
+}
+
+void map_grow(Map *map) {
+    MapSection **sections = map->sections;
+    unsigned int mask = map->mask;
+    unsigned int i;
+    map->mask = (mask << 1) | 1;
+    map->sections = (MapSection **)calloc(
+        map->mask + 1, sizeof(MapSection *));
+    for (i = 0; i <= mask; i++) {
+        MapSection *section = sections[i];
+        if (section)
+            *section_slot(map, section->x, section->y, section->z) = section;
+    }
+    free(sections);
+}
+
+/* directory sized for count blocks packed into full sections */
+void map_reserve(Map *map, unsigned int count) {
+    unsigned int sections = count / MAP_SECTION_VOLUME + 1;
+    while (sections * 2 > map->mask)
+        map_grow(map);
+}
+
+/* set blocks y0 to y1 - 1 of a column, one section lookup and palette
+ * search per section crossed */
+void map_fill_column(Map *map, int x, int y0, int y1, int z, int w) {
+    x -= map->dx;
+    z -= map->dz;
+    y0 -= map->dy;
+    y1 -= map->dy;
+    if (x < 0 || x > SECTION_LIMIT) return;
+    if (z < 0 || z > SECTION_LIMIT) return;
+    if (y0 < 0) y0 = 0;
+    if (y1 > SECTION_LIMIT + 1) y1 = SECTION_LIMIT + 1;
+    while (y0 < y1) {
+        int sy = y0 / MAP_SECTION_Y;
+        int end = (sy + 1) * MAP_SECTION_Y;
+        MapSection **slot = section_slot(map,
+            x / MAP_SECTION_XZ, sy, z / MAP_SECTION_XZ);
+        MapSection *section = *slot;
+        unsigned int v;
+        int y;
+        if (end > y1)
+            end = y1;
+        if (!section) {
+            if (!w) {
+                y0 = end;
+                continue;
+            }
+            section = *slot = section_alloc(
+                x / MAP_SECTION_XZ, sy, z / MAP_SECTION_XZ);
+            map->count++;
+            if (map->count * 2 > map->mask)
+                map_grow(map);
+        }
+        else if (section->refs > 1) {
+            section->refs--;
+            section = *slot = section_copy(section);
+        }
+        v = w ? section_palette(section, w) : 0;
+        for (y = y0; y < end; y++) {
+            unsigned int i = SECTION_INDEX(x, y, z);
+            int previous = MAP_SECTION_GET(section, i);
+            if (previous == w)
+                continue;
+            if (!previous) {
+                section->count++;
+                map->size++;
+            }
+            else if (!w) {
+                section->count--;
+                map->size--;
+            }
+            section_put(section, i, v);
+        }
+        y0 = end;
+    }
+}
+
+#else
+
 void map_alloc(Map *map, int dx, int dy, int dz, int mask) {
     map->dx = dx;
     map->dy = dy;
@@ -27,9 +309,13 @@ void map_alloc(Map *map, int dx, int dy, int dz, int mask) {
     map->mask = mask;
     map->size = 0;
     map->data = (MapEntry *)calloc(map->mask + 1, sizeof(MapEntry));
+    map->refs = NULL;
 }
 
 void map_free(Map *map) {
+    if (map->refs && --*map->refs)
+        return;
+    free(map->refs);
     free(map->data);
 }
 
@@ -40,9 +326,37 @@ void map_copy(Map *dst, Map *src) {
     dst->mask = src->mask;
     dst->size = src->size;
     dst->data = (MapEntry *)calloc(dst->mask + 1, sizeof(MapEntry));
+    dst->refs = NULL;
     memcpy(dst->data, src->data, (dst->mask + 1) * sizeof(MapEntry));
 }
 
+/* dst reads the same entries as src until either side writes */
+void map_share(Map *dst, Map *src) {
+    if (!src->refs) {
+        src->refs = (unsigned int *)malloc(sizeof(unsigned int));
+        *src->refs = 1;
+    }
+    (*src->refs)++;
+    *dst = *src;
+}
+
+/* take a private copy of shared entries before writing */
+static void map_detach(Map *map) {
+    MapEntry *data;
+    if (!map->refs)
+        return;
+    if (*map->refs == 1) {
+        free(map->refs);
+        map->refs = NULL;
+        return;
+    }
+    (*map->refs)--;
+    map->refs = NULL;
+    data = (MapEntry *)malloc((map->mask + 1) * sizeof(MapEntry));
+    memcpy(data, map->data, (map->mask + 1) * sizeof(MapEntry));
+    map->data = data;
+}
+
 int map_set(Map *map, int x, int y, int z, int w)
 {
    MapEntry *entry;
@@ -62,11 +376,15 @@ int map_set(Map *map, int x, int y, int z, int w)
    }
    if (overwrite) {
       if (entry->e.w != w) {
+         map_detach(map);
+         entry = map->data + index;
          entry->e.w = w;
          return 1;
       }
    }
    else if (w) {
+      map_detach(map);
+      entry = map->data + index;
       entry->e.x = x;
       entry->e.y = y;
       entry->e.z = z;
@@ -108,11 +426,28 @@ void map_grow(Map *map) {
     new_map.mask = (map->mask << 1) | 1;
     new_map.size = 0;
     new_map.data = (MapEntry *)calloc(new_map.mask + 1, sizeof(MapEntry));
+    new_map.refs = NULL;
     MAP_FOR_EACH(map, ex, ey, ez, ew) {
         map_set(&new_map, ex, ey, ez, ew);
     } END_MAP_FOR_EACH;
-    free(map->data);
+    map_free(map);
+    map->refs = NULL;
     map->mask = new_map.mask;
     map->size = new_map.size;
     map->data = new_map.data;
 }
+
+/* grow once up front rather than rehashing while count blocks arrive */
+void map_reserve(Map *map, unsigned int count) {
+    while (count * 2 > map->mask)
+        map_grow(map);
+}
+
+void map_fill_column(Map *map, int x, int y0, int y1, int z, int w) {
+    int y;
+    for (y = y0; y < y1; y++) {
+        map_set(map, x, y, z, w);
+    }
+}
+
+#endif
@@ -2,6 +2,61 @@
 #define _map_h_
 
 #include <stdint.h>
+#include "config.h"
+
+#if MAP_SECTIONS
+
+/* sections are 32x32x16 blocks (x, z, y) stored as palette indices
+ * bit-packed into 32-bit words; only non-empty sections are allocated */
+#define MAP_SECTION_XZ 32
+#define MAP_SECTION_Y 16
+#define MAP_SECTION_VOLUME (MAP_SECTION_XZ * MAP_SECTION_XZ * MAP_SECTION_Y)
+
+#define MAP_SECTION_GET(section, i) \
+    ((section)->palette[((section)->data[((i) * (section)->bits) >> 5] >> \
+        (((i) * (section)->bits) & 31)) & ((1u << (section)->bits) - 1)])
+
+#define MAP_FOR_EACH(map, ex, ey, ez, ew) \
+{ \
+   unsigned int i, j; \
+   int ex, ey, ez, ew; \
+   for (j = 0; j <= map->mask; j++) { \
+      MapSection *section = map->sections[j]; \
+      if (!section || !section->count) \
+         continue; \
+      for (i = 0; i < MAP_SECTION_VOLUME; i++) { \
+         ew = MAP_SECTION_GET(section, i); \
+         if (!ew) \
+            continue; \
+         ex = section->x * MAP_SECTION_XZ + ((i >> 5) & 31) + map->dx; \
+         ey = section->y * MAP_SECTION_Y + (i >> 10) + map->dy; \
+         ez = section->z * MAP_SECTION_XZ + (i & 31) + map->dz;
+
+#define END_MAP_FOR_EACH } } }
+
+typedef struct {
+    uint16_t x;
+    uint16_t y;
+    uint16_t z;
+    uint16_t count;
+    unsigned int refs;
+    unsigned int bits;
+    unsigned int palette_size;
+    int16_t *palette;
+    uint32_t *data;
+} MapSection;
+
+typedef struct {
+    int dx;
+    int dy;
+    int dz;
+    unsigned int mask;
+    unsigned int size;
+    unsigned int count;
+    MapSection **sections;
+} Map;
+
+#else
 
 #define EMPTY_ENTRY(entry) ((entry)->value == 0L)
 
@@ -37,12 +92,18 @@ typedef struct {
     unsigned int mask;
     unsigned int size;
     MapEntry *data;
+    unsigned int *refs;
 } Map;
 
+#endif
+
 void map_alloc(Map *map, int dx, int dy, int dz, int mask);
 void map_free(Map *map);
 void map_copy(Map *dst, Map *src);
+void map_share(Map *dst, Map *src);
 void map_grow(Map *map);
+void map_reserve(Map *map, unsigned int count);
+void map_fill_column(Map *map, int x, int y0, int y1, int z, int w);
 int map_set(Map *map, int x, int y, int z, int w);
 int map_get(Map *map, int x, int y, int z);
 
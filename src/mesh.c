@@ -0,0 +1,438 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include "config.h"
+#include "cube.h"
+#include "item.h"
+#include "mesh.h"
+#include "noise.h"
+#include "util.h"
+
+static void occlusion(
+    int8_t neighbors[27], int8_t lights[27], float shades[27],
+    float ao[6][4], float light[6][4])
+{
+   unsigned i, j;
+    static const int lookup3[6][4][3] = {
+        {{0, 1, 3}, {2, 1, 5}, {6, 3, 7}, {8, 5, 7}},
+        {{18, 19, 21}, {20, 19, 23}, {24, 21, 25}, {26, 23, 25}},
+        {{6, 7, 15}, {8, 7, 17}, {24, 15, 25}, {26, 17, 25}},
+        {{0, 1, 9}, {2, 1, 11}, {18, 9, 19}, {20, 11, 19}},
+        {{0, 3, 9}, {6, 3, 15}, {18, 9, 21}, {24, 15, 21}},
+        {{2, 5, 11}, {8, 5, 17}, {20, 11, 23}, {26, 17, 23}}
+    };
+   static const int lookup4[6][4][4] = {
+        {{0, 1, 3, 4}, {1, 2, 4, 5}, {3, 4, 6, 7}, {4, 5, 7, 8}},
+        {{18, 19, 21, 22}, {19, 20, 22, 23}, {21, 22, 24, 25}, {22, 23, 25, 26}},
+        {{6, 7, 15, 16}, {7, 8, 16, 17}, {15, 16, 24, 25}, {16, 17, 25, 26}},
+        {{0, 1, 9, 10}, {1, 2, 10, 11}, {9, 10, 18, 19}, {10, 11, 19, 20}},
+        {{0, 3, 9, 12}, {3, 6, 12, 15}, {9, 12, 18, 21}, {12, 15, 21, 24}},
+        {{2, 5, 11, 14}, {5, 8, 14, 17}, {11, 14, 20, 23}, {14, 17, 23, 26}}
+    };
+    static const float curve[4] = {0.0, 0.25, 0.5, 0.75};
+
+    for (i = 0; i < 6; i++)
+    {
+        for (j = 0; j < 4; j++)
+        {
+           float total;
+           unsigned k;
+           int corner = neighbors[lookup3[i][j][0]];
+           int side1 = neighbors[lookup3[i][j][1]];
+           int side2 = neighbors[lookup3[i][j][2]];
+           int value = side1 && side2 ? 3 : corner + side1 + side2;
+           float shade_sum = 0;
+           float light_sum = 0;
+           int is_light = lights[13] == 15;
+
+           for (k = 0; k < 4; k++) {
+              shade_sum += shades[lookup4[i][j][k]];
+              light_sum += lights[lookup4[i][j][k]];
+           }
+           if (is_light)
+              light_sum = 15 * 4 * 10;
+           total = curve[value] + shade_sum / 4.0;
+           ao[i][j] = MIN(total, 1.0);
+           light[i][j] = light_sum / 15.0 / 4.0;
+        }
+    }
+}
+
+#define XZ_SIZE (CHUNK_SIZE * 3 + 2)
+#define XYZ(x, y, z) ((y) * XZ_SIZE * XZ_SIZE + (x) * XZ_SIZE + (z))
+#define XZ(x, z) ((x) * XZ_SIZE + (z))
+
+#define MASK_INDEX(face, x, y, z) \
+   ((((face) * mask_h + (y)) * CHUNK_SIZE + (x)) * CHUNK_SIZE + (z))
+
+/* merge runs of identical faces into quads of up to CHUNK_SIZE blocks
+ * a side, sweeping each face direction one slice at a time */
+static int greedy_merge(
+      float *data, uint32_t *mask, int mask_h, int bx, int by, int bz)
+{
+   int offset = 0;
+   int face;
+   for (face = 0; face < 6; face++)
+   {
+      int size[3] = {CHUNK_SIZE, mask_h, CHUNK_SIZE};
+      int n  = face / 2;
+      int a1 = n == 1 ? 0 : 1;
+      int a2 = n == 2 ? 0 : 2;
+      int c;
+      for (c = 0; c < size[n]; c++)
+      {
+         int u;
+         for (u = 0; u < size[a1]; u++)
+         {
+            int v;
+            for (v = 0; v < size[a2]; v++)
+            {
+               int p[3], e[3];
+               int du, dv;
+               uint32_t key;
+               p[n] = c;
+               p[a1] = u;
+               p[a2] = v;
+               key = mask[MASK_INDEX(face, p[0], p[1], p[2])];
+               if (!key)
+                  continue;
+               for (dv = 1; v + dv < size[a2] && dv < CHUNK_SIZE; dv++)
+               {
+                  p[a2] = v + dv;
+                  if (mask[MASK_INDEX(face, p[0], p[1], p[2])] != key)
+                     break;
+               }
+               for (du = 1; u + du < size[a1] && du < CHUNK_SIZE; du++)
+               {
+                  int k;
+                  p[a1] = u + du;
+                  for (k = 0; k < dv; k++)
+                  {
+                     p[a2] = v + k;
+                     if (mask[MASK_INDEX(face, p[0], p[1], p[2])] != key)
+                        break;
+                  }
+                  if (k < dv)
+                     break;
+               }
+               for (p[a1] = u; p[a1] < u + du; p[a1]++)
+                  for (p[a2] = v; p[a2] < v + dv; p[a2]++)
+                     mask[MASK_INDEX(face, p[0], p[1], p[2])] = 0;
+               p[a1] = u;
+               p[a2] = v;
+               e[n] = 1;
+               e[a1] = du;
+               e[a2] = dv;
+               make_cube_face_repeat(
+                     data + offset,
+                     ((key >> 9) & 0x3f) / 32.0,
+                     (key >> 15) / 15.0 / 4.0,
+                     face, (key >> 1) & 0xff,
+                     bx + p[0], by + p[1], bz + p[2], 0.5,
+                     e[0], e[1], e[2]);
+               offset += 40;
+            }
+         }
+      }
+   }
+   return offset;
+}
+
+/* builds the faces of chunk p, q from the 3x3 block maps around it;
+ * the level maps may be null when lights are off. returns -1 when out
+ * of memory, the mesh is left as it was */
+int mesh_chunk(
+      Mesh *mesh, int p, int q,
+      Map *block_maps[3][3], Map *level_maps[3][3], int greedy)
+{
+   Map *map;
+   unsigned a, b;
+   int miny = MAX_BLOCK_HEIGHT;
+   int maxy = 0;
+   int faces = 0;
+   int lo = MAX_BLOCK_HEIGHT;
+   int hi = -1;
+   int y_size;
+   int8_t *opaque;
+   int8_t *light;
+   int *highest;
+   int ox        = p * CHUNK_SIZE - CHUNK_SIZE - 1;
+   int oy;
+   int oz        = q * CHUNK_SIZE - CHUNK_SIZE - 1;
+   /* check for lights */
+   int has_light = 0;
+   int mask_h    = 0;
+   uint32_t *mask = NULL;
+
+   if (level_maps)
+   {
+      for (a = 0; a < 3; a++)
+      {
+         for (b = 0; b < 3; b++)
+         {
+            Map *map = level_maps[a][b];
+            if (map && map->size)
+               has_light = 1;
+         }
+      }
+   }
+
+   /* bound the working set by the height of the neighborhood,
+    * with one empty layer above and below */
+   for (a = 0; a < 3; a++)
+   {
+      for (b = 0; b < 3; b++)
+      {
+         Map *map = block_maps[a][b];
+         if (!map)
+            continue;
+         MAP_FOR_EACH(map, ex, ey, ez, ew)
+         {
+            (void)ex; (void)ez; (void)ew;
+            lo = MIN(lo, ey);
+            hi = MAX(hi, ey);
+         } END_MAP_FOR_EACH;
+      }
+   }
+   if (hi < lo)
+      lo = hi = 0;
+   oy      = lo - 1;
+   y_size  = hi - lo + 3;
+   opaque  = (int8_t*)calloc(XZ_SIZE * XZ_SIZE * y_size, sizeof(int8_t));
+   light   = (int8_t*)calloc(XZ_SIZE * XZ_SIZE * y_size, sizeof(int8_t));
+   highest = (int*)calloc(XZ_SIZE * XZ_SIZE, sizeof(int));
+
+   if (!opaque || !light || !highest)
+   {
+      free(opaque);
+      free(light);
+      free(highest);
+      return -1;
+   }
+
+   // populate opaque array
+   for (a = 0; a < 3; a++)
+   {
+      for (b = 0; b < 3; b++)
+      {
+         Map *map = block_maps[a][b];
+         if (!map)
+            continue;
+         MAP_FOR_EACH(map, ex, ey, ez, ew)
+         {
+            int x = ex - ox;
+            int y = ey - oy;
+            int z = ez - oz;
+            int w = ew;
+            // TODO: this should be unnecessary
+            if (x < 0 || y < 0 || z < 0)
+               continue;
+            if (x >= XZ_SIZE || y >= y_size || z >= XZ_SIZE)
+               continue;
+            // END TODO
+            opaque[XYZ(x, y, z)] = !is_transparent(w);
+            if (opaque[XYZ(x, y, z)])
+               highest[XZ(x, z)] = MAX(highest[XZ(x, z)], y);
+         } END_MAP_FOR_EACH;
+      }
+   }
+
+   // copy propagated light levels
+   if (has_light)
+   {
+      for (a = 0; a < 3; a++)
+      {
+         for (b = 0; b < 3; b++)
+         {
+            Map *map = level_maps[a][b];
+            if (!map)
+               continue;
+            MAP_FOR_EACH(map, ex, ey, ez, ew)
+            {
+               int x = ex - ox;
+               int y = ey - oy;
+               int z = ez - oz;
+               if (x < 0 || y < 0 || z < 0)
+                  continue;
+               if (x >= XZ_SIZE || y >= y_size || z >= XZ_SIZE)
+                  continue;
+               light[XYZ(x, y, z)] = ew;
+            } END_MAP_FOR_EACH;
+         }
+      }
+   }
+
+   map = block_maps[1][1];
+
+   /* count exposed faces */
+   MAP_FOR_EACH(map, ex, ey, ez, ew) {
+      if (ew <= 0)
+         continue;
+      {
+         int x = ex - ox;
+         int y = ey - oy;
+         int z = ez - oz;
+         int f1 = !opaque[XYZ(x - 1, y, z)];
+         int f2 = !opaque[XYZ(x + 1, y, z)];
+         int f3 = !opaque[XYZ(x, y + 1, z)];
+         int f4 = !opaque[XYZ(x, y - 1, z)] && (ey > 0);
+         int f5 = !opaque[XYZ(x, y, z - 1)];
+         int f6 = !opaque[XYZ(x, y, z + 1)];
+         int total = f1 + f2 + f3 + f4 + f5 + f6;
+         if (total == 0)
+            continue;
+         if (is_plant(ew))
+            total = 4;
+         miny = MIN(miny, ey);
+         maxy = MAX(maxy, ey);
+         faces += total;
+      }
+   } END_MAP_FOR_EACH;
+
+   /* uniform faces are collected per direction and merged below */
+   if (greedy && faces)
+   {
+      mask_h = maxy - miny + 1;
+      mask   = (uint32_t*)calloc(6 * mask_h * CHUNK_SIZE * CHUNK_SIZE,
+            sizeof(uint32_t));
+   }
+
+   {
+      // generate geometry
+      float *data = (float*)malloc(sizeof(float) * 4 * 10 * faces);
+      int offset = 0;
+      MAP_FOR_EACH(map, ex, ey, ez, ew) {
+         int8_t neighbors[27] = {0};
+         int8_t lights[27] = {0};
+         float shades[27] = {0};
+         int index = 0;
+         int dx;
+         int x = ex - ox;
+         int y = ey - oy;
+         int z = ez - oz;
+         int f1 = !opaque[XYZ(x - 1, y, z)];
+         int f2 = !opaque[XYZ(x + 1, y, z)];
+         int f3 = !opaque[XYZ(x, y + 1, z)];
+         int f4 = !opaque[XYZ(x, y - 1, z)] && (ey > 0);
+         int f5 = !opaque[XYZ(x, y, z - 1)];
+         int f6 = !opaque[XYZ(x, y, z + 1)];
+         int total = f1 + f2 + f3 + f4 + f5 + f6;
+         if (ew <= 0) {
+            continue;
+         }
+         if (total == 0) {
+            continue;
+         }
+         for (dx = -1; dx <= 1; dx++) {
+            int dy;
+            for (dy = -1; dy <= 1; dy++) {
+               int dz;
+               for (dz = -1; dz <= 1; dz++) {
+                  neighbors[index] = opaque[XYZ(x + dx, y + dy, z + dz)];
+                  lights[index] = light[XYZ(x + dx, y + dy, z + dz)];
+                  shades[index] = 0;
+                  if (y + dy <= highest[XZ(x + dx, z + dz)]) {
+                     int oy;
+                     for (oy = 0; oy < 8; oy++) {
+                        if (opaque[XYZ(x + dx, y + dy + oy, z + dz)]) {
+                           shades[index] = 1.0 - oy * 0.125;
+                           break;
+                        }
+                     }
+                  }
+                  index++;
+               }
+            }
+         }
+
+         {
+            float ao[6][4];
+            float light[6][4];
+            occlusion(neighbors, lights, shades, ao, light);
+
+            if (is_plant(ew))
+            {
+               int a;
+               float rotation;
+               float min_ao = 1;
+               float max_light = 0;
+               total = 4;
+               for (a = 0; a < 6; a++)
+               {
+                  int b;
+                  for (b = 0; b < 4; b++)
+                  {
+                     min_ao = MIN(min_ao, ao[a][b]);
+                     max_light = MAX(max_light, light[a][b]);
+                  }
+               }
+               rotation = simplex2(ex, ez, 4, 0.5, 2) * 360;
+               make_plant(
+                     data + offset, min_ao, max_light,
+                     ex, ey, ez, 0.5, ew, rotation);
+            }
+            else if (mask)
+            {
+               int f[6] = {f1, f2, f3, f4, f5, f6};
+               int lx   = x - CHUNK_SIZE - 1;
+               int lz   = z - CHUNK_SIZE - 1;
+               int k;
+               total = 0;
+               for (k = 0; k < 6; k++)
+               {
+                  int w = blocks[ew][k];
+                  if (!f[k])
+                     continue;
+                  if (lx >= 0 && lx < CHUNK_SIZE &&
+                        lz >= 0 && lz < CHUNK_SIZE &&
+                        ao[k][0] == ao[k][1] && ao[k][0] == ao[k][2] &&
+                        ao[k][0] == ao[k][3] &&
+                        light[k][0] == light[k][1] &&
+                        light[k][0] == light[k][2] &&
+                        light[k][0] == light[k][3])
+                  {
+                     /* ao is a multiple of 1/32 and light a sum of four
+                      * levels over 60, so the key holds them exactly and
+                      * merged quads shade like the faces they replace */
+                     uint32_t aoq = (uint32_t)(ao[k][0] * 32 + 0.5);
+                     uint32_t lq  = (uint32_t)(light[k][0] * 60 + 0.5);
+                     mask[MASK_INDEX(k, lx, ey - miny, lz)] =
+                        1 | w << 1 | aoq << 9 | lq << 15;
+                     continue;
+                  }
+                  make_cube_faces(
+                        data + offset + total * 40, ao, light,
+                        k == 0, k == 1, k == 2, k == 3, k == 4, k == 5,
+                        w, w, w, w, w, w,
+                        ex, ey, ez, 0.5);
+                  total++;
+               }
+            }
+            else
+               make_cube(
+                     data + offset, ao, light,
+                     f1, f2, f3, f4, f5, f6,
+                     ex, ey, ez, 0.5, ew);
+            offset += total * 40;
+         }
+      } END_MAP_FOR_EACH;
+
+      free(opaque);
+      free(light);
+      free(highest);
+
+      if (mask)
+      {
+         offset += greedy_merge(
+               data + offset, mask, mask_h,
+               p * CHUNK_SIZE, miny, q * CHUNK_SIZE);
+         free(mask);
+         faces = offset / 40;
+      }
+
+      mesh->miny = miny;
+      mesh->maxy = maxy;
+      mesh->faces = faces;
+      mesh->data = data;
+   }
+   return 0;
+}
@@ -0,0 +1,18 @@
+#ifndef _mesh_h_
+#define _mesh_h_
+
+#include "map.h"
+
+/* chunk geometry as quads of 4 vertices with 10 floats each */
+typedef struct {
+    int miny;
+    int maxy;
+    int faces;
+    float *data;
+} Mesh;
+
+int mesh_chunk(
+    Mesh *mesh, int p, int q,
+    Map *block_maps[3][3], Map *level_maps[3][3], int greedy);
+
+#endif
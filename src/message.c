@@ -0,0 +1,123 @@
+#include <stdlib.h>
+#include "message.h"
+
+/* field scanners for message_parse, each reading the comma before its
+ * field and accepting what the %d, %f and %lf conversions they replace
+ * did */
+#define SCAN_SPACE(c) ((c) == ' ' || ((c) >= '\t' && (c) <= '\r'))
+
+static int scan_int(char **line, int *value)
+{
+   char *p = *line;
+   unsigned int result = 0;
+   int negative = 0;
+   if (*p++ != ',')
+      return 0;
+   while (SCAN_SPACE(*p))
+      p++;
+   if (*p == '-' || *p == '+')
+      negative = *p++ == '-';
+   if (*p < '0' || *p > '9')
+      return 0;
+   while (*p >= '0' && *p <= '9')
+      result = result * 10 + (*p++ - '0');
+   *value = negative ? -(int)result : (int)result;
+   *line = p;
+   return 1;
+}
+
+static int scan_ints(char **line, int *values, int count)
+{
+   int i;
+   for (i = 0; i < count; i++)
+      if (!scan_int(line, values + i))
+         return 0;
+   return 1;
+}
+
+/* glibc's %f also swallows an exponent without digits ("1e,"), strtof
+ * leaves it and the next field then fails */
+static int scan_float(char **line, float *value)
+{
+   char *end;
+   if (**line != ',')
+      return 0;
+   *value = strtof(*line + 1, &end);
+   if (end == *line + 1)
+      return 0;
+   *line = end;
+   return 1;
+}
+
+static int scan_double(char **line, double *value)
+{
+   char *end;
+   if (**line != ',')
+      return 0;
+   *value = strtod(*line + 1, &end);
+   if (end == *line + 1)
+      return 0;
+   *line = end;
+   return 1;
+}
+
+/* copies at most length - 1 characters up to a space (or to the end of
+ * the line when stop_at_space is 0) after a comma, like %s and %[^\n] */
+static int scan_text(char **line, char *text, int length, int stop_at_space)
+{
+   char *p = *line;
+   int size = 0;
+   if (*p++ != ',')
+      return 0;
+   if (stop_at_space)
+      while (SCAN_SPACE(*p))
+         p++;
+   while (*p && size < length - 1 && !(stop_at_space && SCAN_SPACE(*p)))
+      text[size++] = *p++;
+   text[size] = '\0';
+   *line = p;
+   return size > 0;
+}
+
+/* returns 1 with the fields of a known and well formed line; trailing
+ * characters after the last field are ignored */
+int message_parse(char *line, Message *message)
+{
+   int *v = message->v;
+   float *f = message->f;
+   char *p = line + 1;
+   message->type = line[0];
+   message->text = message->buffer;
+   switch (line[0]) {
+      case 'U':
+      case 'P':
+         return scan_int(&p, v) && scan_float(&p, f) &&
+            scan_float(&p, f + 1) && scan_float(&p, f + 2) &&
+            scan_float(&p, f + 3) && scan_float(&p, f + 4);
+      case 'B':
+      case 'L':
+         return scan_ints(&p, v, 6);
+      case 'S':
+         if (!scan_ints(&p, v, 6))
+            return 0;
+         if (!scan_text(&p, message->buffer, MAX_SIGN_LENGTH, 0))
+            message->buffer[0] = '\0';
+         return 1;
+      case 'D':
+      case 'V':
+         return scan_int(&p, v);
+      case 'K':
+         return scan_ints(&p, v, 3);
+      case 'R':
+         return scan_ints(&p, v, 2);
+      case 'E':
+         return scan_double(&p, &message->elapsed) && scan_int(&p, v);
+      case 'T':
+         message->text = line + 2;
+         return line[1] == ',';
+      case 'N':
+         return scan_int(&p, v) &&
+            scan_text(&p, message->buffer, MAX_NAME_LENGTH, 1);
+   }
+   return 0;
+}
@@ -0,0 +1,20 @@
+#ifndef _message_h_
+#define _message_h_
+
+#include "renderer.h"
+#include "sign.h"
+
+/* the fields of one text protocol line; v holds the integers in line
+ * order, text points into buffer or, for T, into the line itself */
+typedef struct {
+    int type;
+    int v[6];
+    float f[5];
+    double elapsed;
+    const char *text;
+    char buffer[MAX_SIGN_LENGTH];
+} Message;
+
+int message_parse(char *line, Message *message);
+
+#endif
@@ -0,0 +1,1063 @@
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "config.h"
+#include "region.h"
+#include "tinycthread.h"
+
+#if REGION_MMAP
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+/* version 1 files have no stamp, their slot table follows the magic
+ * and version directly */
+#define REGION_MAGIC "CRGN"
+#define REGION_VERSION 2
+#define REGION_PREAMBLE 16
+#define REGION_HEADER (REGION_PREAMBLE + REGION_SLOTS * 8)
+#define REGION_HEADER_V1 (8 + REGION_SLOTS * 8)
+#define GRID_SIZE (CHUNK_SIZE + 2)
+/* files at least this large are rewritten once half of them is payloads
+ * that no slot points at anymore */
+#define REGION_COMPACT (1 << 20)
+
+static unsigned int get_u32(const unsigned char *data) {
+    return data[0] | (data[1] << 8) | (data[2] << 16) |
+        ((unsigned int)data[3] << 24);
+}
+
+static void put_u32(unsigned char *data, unsigned int value) {
+    data[0] = value & 0xff;
+    data[1] = (value >> 8) & 0xff;
+    data[2] = (value >> 16) & 0xff;
+    data[3] = (value >> 24) & 0xff;
+}
+
+static int floor_div(int a, int b) {
+    return a >= 0 ? a / b : (a + 1) / b - 1;
+}
+
+int region_index(int p, int q, int *rx, int *rq) {
+    *rx = floor_div(p, REGION_CHUNKS);
+    *rq = floor_div(q, REGION_CHUNKS);
+    return (p - *rx * REGION_CHUNKS) * REGION_CHUNKS +
+        (q - *rq * REGION_CHUNKS);
+}
+
+void region_path(char *path, int length, const char *prefix, int rx, int rq) {
+    snprintf(path, length, "%s.%d.%d", prefix, rx, rq);
+}
+
+/* returns where the slot table starts, or 0 if data does not begin
+ * with a region header */
+static unsigned int slot_table(const unsigned char *data, size_t size) {
+    unsigned int start;
+    if (size < 8 || memcmp(data, REGION_MAGIC, 4))
+        return 0;
+    switch (get_u32(data + 4)) {
+        case 1:
+            start = 8;
+            break;
+        case REGION_VERSION:
+            start = REGION_PREAMBLE;
+            break;
+        default:
+            return 0;
+    }
+    return size >= start + REGION_SLOTS * 8 ? start : 0;
+}
+
+/* reads the preamble and fills in the stamp; returns where the slot
+ * table starts, or 0 */
+static unsigned int read_header(FILE *file, unsigned int stamp[2]) {
+    unsigned char header[REGION_PREAMBLE];
+    unsigned int start;
+    stamp[0] = stamp[1] = 0;
+    if (fread(header, 1, 8, file) != 8)
+        return 0;
+    start = slot_table(header, REGION_HEADER);
+    if (start == REGION_PREAMBLE) {
+        if (fread(header + 8, 1, 8, file) != 8)
+            return 0;
+        stamp[0] = get_u32(header + 8);
+        stamp[1] = get_u32(header + 12);
+    }
+    return start;
+}
+
+/* read the payload of one chunk, returns 0 if the file or chunk is
+ * missing */
+static int region_read(
+    const char *path, int index, unsigned int stamp[2],
+    unsigned char **data, unsigned int *size)
+{
+    unsigned char entry[8];
+    unsigned int offset, start;
+    FILE *file = fopen(path, "rb");
+    if (!file)
+        return 0;
+    if (!(start = read_header(file, stamp)) ||
+        fseek(file, start + index * 8, SEEK_SET) ||
+        fread(entry, 1, 8, file) != 8)
+    {
+        fclose(file);
+        return 0;
+    }
+    offset = get_u32(entry);
+    *size = get_u32(entry + 4);
+    if (!*size || fseek(file, offset, SEEK_SET)) {
+        fclose(file);
+        return 0;
+    }
+    *data = (unsigned char *)malloc(*size);
+    if (fread(*data, 1, *size, file) != *size) {
+        free(*data);
+        fclose(file);
+        return 0;
+    }
+    fclose(file);
+    return 1;
+}
+
+/* returns 1 once every payload is read, 0 if there is no file yet and
+ * -1 if one exists that cannot be read whole, which must not be
+ * written over */
+int region_read_all(const char *path, RegionData *region) {
+    unsigned char *header;
+    int i;
+    FILE *file;
+    memset(region, 0, sizeof(RegionData));
+    file = fopen(path, "rb");
+    if (!file)
+        return errno == ENOENT ? 0 : -1;
+    header = (unsigned char *)malloc(REGION_SLOTS * 8);
+    if (!read_header(file, region->stamp) ||
+        fread(header, 1, REGION_SLOTS * 8, file) != REGION_SLOTS * 8)
+    {
+        free(header);
+        fclose(file);
+        return -1;
+    }
+    for (i = 0; i < REGION_SLOTS; i++) {
+        unsigned int offset = get_u32(header + i * 8);
+        unsigned int size = get_u32(header + 4 + i * 8);
+        if (!size)
+            continue;
+        region->data[i] = (unsigned char *)malloc(size);
+        if (fseek(file, offset, SEEK_SET) ||
+            fread(region->data[i], 1, size, file) != size)
+        {
+            free(header);
+            fclose(file);
+            region_data_free(region);
+            return -1;
+        }
+        region->size[i] = size;
+    }
+    free(header);
+    fclose(file);
+    return 1;
+}
+
+/* written beside the old file and renamed over it, so readers see
+ * either version whole */
+int region_write_all(const char *path, RegionData *region) {
+    char temp[REGION_PATH + 4];
+    unsigned char *header = (unsigned char *)calloc(1, REGION_HEADER);
+    unsigned int offset = REGION_HEADER;
+    int i, ok;
+    FILE *file;
+    snprintf(temp, sizeof(temp), "%s.tmp", path);
+    file = fopen(temp, "wb");
+    if (!file) {
+        free(header);
+        return -1;
+    }
+    memcpy(header, REGION_MAGIC, 4);
+    put_u32(header + 4, REGION_VERSION);
+    put_u32(header + 8, region->stamp[0]);
+    put_u32(header + 12, region->stamp[1]);
+    for (i = 0; i < REGION_SLOTS; i++) {
+        if (!region->size[i])
+            continue;
+        put_u32(header + REGION_PREAMBLE + i * 8, offset);
+        put_u32(header + REGION_PREAMBLE + 4 + i * 8, region->size[i]);
+        offset += region->size[i];
+    }
+    ok = fwrite(header, 1, REGION_HEADER, file) == REGION_HEADER;
+    for (i = 0; ok && i < REGION_SLOTS; i++) {
+        if (region->size[i]) {
+            ok = fwrite(region->data[i], 1, region->size[i], file) ==
+                region->size[i];
+        }
+    }
+    free(header);
+    if (fclose(file) || !ok) {
+        remove(temp);
+        return -1;
+    }
+#ifdef _WIN32
+    // rename does not replace an existing file there
+    remove(path);
+#endif
+    return rename(temp, path) ? -1 : 0;
+}
+
+void region_data_free(RegionData *region) {
+    int i;
+    for (i = 0; i < REGION_SLOTS; i++) {
+        free(region->data[i]);
+    }
+    memset(region, 0, sizeof(RegionData));
+}
+
+/* baked terrain is stamped with the generator version and seed */
+static void bake_stamp(WorldGen *gen, unsigned int stamp[2]) {
+    stamp[0] = WORLD_GEN_VERSION;
+    stamp[1] = world_gen_get_seed(gen);
+}
+
+/* baked terrain is the list of runs create_world_fill emitted, each as
+ * varints: column delta, y0, length and block, after the block count */
+typedef struct {
+    unsigned char *data;
+    unsigned int size;
+    unsigned int capacity;
+    int x;
+    int z;
+    int column;
+    unsigned int count;
+    int bad;
+} Payload;
+
+static void put_varint(Payload *payload, unsigned int value) {
+    if (payload->size + 5 > payload->capacity) {
+        payload->capacity = payload->capacity ? payload->capacity * 2 : 4096;
+        payload->data = (unsigned char *)realloc(
+            payload->data, payload->capacity);
+    }
+    while (value >= 0x80) {
+        payload->data[payload->size++] = (value & 0x7f) | 0x80;
+        value >>= 7;
+    }
+    payload->data[payload->size++] = value;
+}
+
+static int get_varint(
+    const unsigned char **data, const unsigned char *end,
+    unsigned int *value)
+{
+    int shift = 0;
+    *value = 0;
+    while (*data < end && shift < 32) {
+        unsigned char byte = *(*data)++;
+        *value |= (unsigned int)(byte & 0x7f) << shift;
+        if (!(byte & 0x80))
+            return 1;
+        shift += 7;
+    }
+    return 0;
+}
+
+#define ZIGZAG(v) \
+    (((unsigned int)(v) << 1) ^ (unsigned int)((v) < 0 ? -1 : 0))
+#define UNZIGZAG(v) ((int)((v) >> 1) ^ -(int)((v) & 1))
+
+static void bake_fill(int x, int y0, int y1, int z, int w, void *arg) {
+    Payload *payload = (Payload *)arg;
+    int dx = x - payload->x;
+    int dz = z - payload->z;
+    int column = dx * GRID_SIZE + dz;
+    if (dx < 0 || dz < 0 || dx >= GRID_SIZE || dz >= GRID_SIZE ||
+        y0 < 0 || y1 < y0)
+    {
+        payload->bad = 1;
+        return;
+    }
+    put_varint(payload, ZIGZAG(column - payload->column));
+    put_varint(payload, y0);
+    put_varint(payload, y1 - y0);
+    put_varint(payload, ZIGZAG(w));
+    payload->column = column;
+    payload->count += y1 - y0;
+}
+
+/* walks the runs, filling map when given; returns 0 on a bad payload */
+static int decode_runs(
+    const unsigned char *data, unsigned int size, int p, int q, Map *map)
+{
+    const unsigned char *end = data + size;
+    unsigned int count, delta, y0, length, w;
+    int column = 0;
+    if (!get_varint(&data, end, &count))
+        return 0;
+    if (map)
+        map_reserve(map, count);
+    while (data < end) {
+        int x, z;
+        if (!get_varint(&data, end, &delta) ||
+            !get_varint(&data, end, &y0) ||
+            !get_varint(&data, end, &length) ||
+            !get_varint(&data, end, &w))
+        {
+            return 0;
+        }
+        column += UNZIGZAG(delta);
+        if (column < 0 || column >= GRID_SIZE * GRID_SIZE)
+            return 0;
+        if (!map)
+            continue;
+        x = p * CHUNK_SIZE - 1 + column / GRID_SIZE;
+        z = q * CHUNK_SIZE - 1 + column % GRID_SIZE;
+        map_fill_column(map, x, y0, y0 + length, z, UNZIGZAG(w));
+    }
+    return 1;
+}
+
+/* fills map from the baked chunk p, q; returns 0 if it is missing or
+ * was baked by another generator or seed than gen */
+int region_load_chunk(
+    const char *prefix, WorldGen *gen, int p, int q, Map *map)
+{
+    char path[REGION_PATH];
+    unsigned char *data;
+    unsigned int size, stamp[2], expected[2];
+    int rx, rq, ok;
+    int index = region_index(p, q, &rx, &rq);
+    region_path(path, sizeof(path), prefix, rx, rq);
+    if (!region_read(path, index, stamp, &data, &size))
+        return 0;
+    bake_stamp(gen, expected);
+    ok = stamp[0] == expected[0] && stamp[1] == expected[1] &&
+        decode_runs(data, size, p, q, 0);
+    if (ok)
+        decode_runs(data, size, p, q, map);
+    free(data);
+    return ok;
+}
+
+/* a bake in progress; mtx guards next and stop */
+struct RegionBake {
+    char prefix[REGION_PREFIX];
+    WorldGen *gen;
+    int p0;
+    int q0;
+    int p1;
+    int q1;
+    int threads;
+    RegionData *region;
+    int rx;
+    int rq;
+    int *todo;
+    int count;
+    int next;
+    int stop;
+    int result;
+    thrd_t thrd;
+    mtx_t mtx;
+};
+
+static int bake_run(void *arg) {
+    RegionBake *bake = (RegionBake *)arg;
+    while (1) {
+        Payload runs, payload;
+        int index, p, q;
+        mtx_lock(&bake->mtx);
+        index = !bake->stop && bake->next < bake->count ?
+            bake->todo[bake->next++] : -1;
+        mtx_unlock(&bake->mtx);
+        if (index < 0)
+            break;
+        p = bake->rx * REGION_CHUNKS + index / REGION_CHUNKS;
+        q = bake->rq * REGION_CHUNKS + index % REGION_CHUNKS;
+        memset(&runs, 0, sizeof(runs));
+        runs.x = p * CHUNK_SIZE - 1;
+        runs.z = q * CHUNK_SIZE - 1;
+        create_world_fill(bake->gen, p, q, 0, bake_fill, &runs);
+        if (!runs.bad) {
+            memset(&payload, 0, sizeof(payload));
+            put_varint(&payload, runs.count);
+            payload.data = (unsigned char *)realloc(
+                payload.data, payload.size + runs.size);
+            memcpy(payload.data + payload.size, runs.data, runs.size);
+            bake->region->data[index] = payload.data;
+            bake->region->size[index] = payload.size + runs.size;
+        }
+        free(runs.data);
+    }
+    return 0;
+}
+
+/* bakes region by region; a stop keeps the chunks already generated
+ * in the current region, which is still written */
+static int bake_all(RegionBake *bake) {
+    int rx0 = floor_div(bake->p0, REGION_CHUNKS);
+    int rq0 = floor_div(bake->q0, REGION_CHUNKS);
+    int rx1 = floor_div(bake->p1, REGION_CHUNKS);
+    int rq1 = floor_div(bake->q1, REGION_CHUNKS);
+    int threads = bake->threads < 1 ? 1 : bake->threads;
+    int rx, rq, stop = 0, baked = 0;
+    unsigned int stamp[2];
+    thrd_t *thrds = (thrd_t *)malloc(threads * sizeof(thrd_t));
+    bake_stamp(bake->gen, stamp);
+    bake->todo = (int *)malloc(REGION_SLOTS * sizeof(int));
+    for (rx = rx0; rx <= rx1 && !stop; rx++) {
+        for (rq = rq0; rq <= rq1 && !stop; rq++) {
+            char path[REGION_PATH];
+            RegionData region;
+            int i, started = 0, written = 0;
+            region_path(path, sizeof(path), bake->prefix, rx, rq);
+            if (region_read_all(path, &region) < 0) {
+                baked = -1;
+                break;
+            }
+            // chunks of another generator or seed are baked again
+            if (region.stamp[0] != stamp[0] || region.stamp[1] != stamp[1]) {
+                region_data_free(&region);
+                region.stamp[0] = stamp[0];
+                region.stamp[1] = stamp[1];
+            }
+            mtx_lock(&bake->mtx);
+            bake->region = &region;
+            bake->rx = rx;
+            bake->rq = rq;
+            bake->count = 0;
+            bake->next = 0;
+            for (i = 0; i < REGION_SLOTS; i++) {
+                int p = rx * REGION_CHUNKS + i / REGION_CHUNKS;
+                int q = rq * REGION_CHUNKS + i % REGION_CHUNKS;
+                if (p < bake->p0 || p > bake->p1 ||
+                    q < bake->q0 || q > bake->q1)
+                {
+                    continue;
+                }
+                if (!region.size[i])
+                    bake->todo[bake->count++] = i;
+            }
+            mtx_unlock(&bake->mtx);
+            // the calling thread is the last of the threads
+            for (i = 0; i < threads - 1 && i < bake->count; i++) {
+                if (thrd_create(thrds + i, bake_run, bake) != thrd_success)
+                    break;
+                started++;
+            }
+            bake_run(bake);
+            for (i = 0; i < started; i++) {
+                thrd_join(thrds[i], NULL);
+            }
+            mtx_lock(&bake->mtx);
+            stop = bake->stop;
+            mtx_unlock(&bake->mtx);
+            // chunks the generator could not encode stay empty
+            for (i = 0; i < bake->count; i++) {
+                if (region.size[bake->todo[i]])
+                    written++;
+            }
+            if (written) {
+                if (region_write_all(path, &region)) {
+                    region_data_free(&region);
+                    baked = -1;
+                    break;
+                }
+                baked += written;
+            }
+            region_data_free(&region);
+        }
+        if (baked < 0)
+            break;
+    }
+    free(bake->todo);
+    free(thrds);
+    return baked;
+}
+
+static void bake_init(
+    RegionBake *bake, const char *prefix, WorldGen *gen,
+    int p0, int q0, int p1, int q1, int threads)
+{
+    memset(bake, 0, sizeof(RegionBake));
+    snprintf(bake->prefix, sizeof(bake->prefix), "%s", prefix);
+    bake->gen = gen;
+    bake->p0 = p0;
+    bake->q0 = q0;
+    bake->p1 = p1;
+    bake->q1 = q1;
+    bake->threads = threads;
+    mtx_init(&bake->mtx, mtx_plain);
+}
+
+/* generate chunks p0..p1, q0..q1 (inclusive) that are not baked yet on
+ * that many threads and add them to their region files; returns the
+ * number of chunks written or -1 if a file could not be written */
+int region_bake(
+    const char *prefix, WorldGen *gen,
+    int p0, int q0, int p1, int q1, int threads)
+{
+    RegionBake bake;
+    int baked;
+    bake_init(&bake, prefix, gen, p0, q0, p1, q1, threads);
+    baked = bake_all(&bake);
+    mtx_destroy(&bake.mtx);
+    return baked;
+}
+
+static int bake_thread(void *arg) {
+    RegionBake *bake = (RegionBake *)arg;
+    int baked = bake_all(bake);
+    mtx_lock(&bake->mtx);
+    bake->result = baked;
+    mtx_unlock(&bake->mtx);
+    return 0;
+}
+
+/* runs region_bake in the background, gen must outlive it; returns 0
+ * if the thread could not be started */
+RegionBake *region_bake_start(
+    const char *prefix, WorldGen *gen,
+    int p0, int q0, int p1, int q1, int threads)
+{
+    RegionBake *bake = (RegionBake *)malloc(sizeof(RegionBake));
+    bake_init(bake, prefix, gen, p0, q0, p1, q1, threads);
+    if (thrd_create(&bake->thrd, bake_thread, bake) != thrd_success) {
+        mtx_destroy(&bake->mtx);
+        free(bake);
+        return 0;
+    }
+    return bake;
+}
+
+/* waits for a background bake, stopping it first when asked, and
+ * returns what region_bake would have */
+int region_bake_finish(RegionBake *bake, int stop) {
+    int baked;
+    mtx_lock(&bake->mtx);
+    bake->stop = stop;
+    mtx_unlock(&bake->mtx);
+    thrd_join(bake->thrd, NULL);
+    baked = bake->result;
+    mtx_destroy(&bake->mtx);
+    free(bake);
+    return baked;
+}
+
+/* block edits are stored per chunk as a varint count followed by the
+ * sorted keys from edit_key, delta coded, each followed by its block */
+typedef struct {
+    unsigned int key;
+    int w;
+} Edit;
+
+typedef struct {
+    Edit *data;
+    int count;
+    int p;
+    int q;
+} EditList;
+
+static int edit_key(int p, int q, int x, int y, int z, unsigned int *key) {
+    int dx = x - p * CHUNK_SIZE + 1;
+    int dz = z - q * CHUNK_SIZE + 1;
+    if (dx < 0 || dz < 0 || dx >= GRID_SIZE || dz >= GRID_SIZE ||
+        y < 0 || y > 0xffff)
+    {
+        return 0;
+    }
+    *key = ((unsigned int)(dx * GRID_SIZE + dz) << 16) | y;
+    return 1;
+}
+
+/* fills edit for block x, y, z of chunk p, q; returns 0 if the block
+ * is outside the chunk and its border */
+int region_edit(RegionEdit *edit, int p, int q, int x, int y, int z, int w) {
+    if (!edit_key(p, q, x, y, z, &edit->key))
+        return 0;
+    edit->index = region_index(p, q, &edit->rx, &edit->rq);
+    edit->w = w;
+    return 1;
+}
+
+/* walks the edits, calling func when given; returns the edit count or
+ * -1 on a bad payload */
+static int decode_edits(
+    const unsigned char *data, unsigned int size, int p, int q,
+    region_block_func func, void *arg)
+{
+    const unsigned char *end = data + size;
+    unsigned int count, delta, w, key = 0, i;
+    if (!get_varint(&data, end, &count))
+        return -1;
+    for (i = 0; i < count; i++) {
+        int column;
+        if (!get_varint(&data, end, &delta) ||
+            !get_varint(&data, end, &w))
+        {
+            return -1;
+        }
+        key += delta;
+        column = key >> 16;
+        if (column >= GRID_SIZE * GRID_SIZE)
+            return -1;
+        if (func) {
+            func(p, q, p * CHUNK_SIZE - 1 + column / GRID_SIZE,
+                key & 0xffff, q * CHUNK_SIZE - 1 + column % GRID_SIZE,
+                UNZIGZAG(w), arg);
+        }
+    }
+    return data == end ? (int)count : -1;
+}
+
+static void gather_edit(
+    int p, int q, int x, int y, int z, int w, void *arg)
+{
+    EditList *list = (EditList *)arg;
+    Edit *edit = list->data + list->count++;
+    edit_key(p, q, x, y, z, &edit->key);
+    edit->w = w;
+}
+
+static int region_edit_compare(const void *a, const void *b) {
+    const RegionEdit *e1 = (const RegionEdit *)a;
+    const RegionEdit *e2 = (const RegionEdit *)b;
+    if (e1->rx != e2->rx)
+        return e1->rx < e2->rx ? -1 : 1;
+    if (e1->rq != e2->rq)
+        return e1->rq < e2->rq ? -1 : 1;
+    if (e1->index != e2->index)
+        return e1->index < e2->index ? -1 : 1;
+    if (e1->key != e2->key)
+        return e1->key < e2->key ? -1 : 1;
+    return e1->order < e2->order ? -1 : e1->order > e2->order;
+}
+
+/* sorts edits by chunk and position, equal positions in order */
+void region_edits_sort(RegionEdit *edits, unsigned int count) {
+    qsort(edits, count, sizeof(RegionEdit), region_edit_compare);
+}
+
+/* calls func for every edit of a payload once it is known to be whole;
+ * returns the edit count or -1 on a bad payload */
+int region_edits_each(
+    const unsigned char *data, unsigned int size, int p, int q,
+    region_block_func func, void *arg)
+{
+    if (decode_edits(data, size, p, q, 0, 0) < 0)
+        return -1;
+    return decode_edits(data, size, p, q, func, arg);
+}
+
+/* merges the sorted edits for chunk p, q into the payload in data,
+ * which is replaced; a new edit replaces an old one at the same
+ * position */
+void region_edits_merge(
+    unsigned char **data, unsigned int *size, int p, int q,
+    const RegionEdit *edits, int count)
+{
+    EditList old;
+    Payload payload;
+    Edit *merged;
+    unsigned int key = 0;
+    int i = 0, j = 0, n = 0, length = 0;
+    memset(&old, 0, sizeof(old));
+    memset(&payload, 0, sizeof(payload));
+    if (*data) {
+        length = decode_edits(*data, *size, p, q, 0, 0);
+        length = length < 0 ? 0 : length;
+    }
+    old.data = (Edit *)malloc((length + 1) * sizeof(Edit));
+    if (length) {
+        decode_edits(*data, *size, p, q, gather_edit, &old);
+    }
+    merged = (Edit *)malloc((length + count) * sizeof(Edit));
+    while (i < old.count || j < count) {
+        Edit *a = old.data + i;
+        if (j < count && (i == old.count || edits[j].key <= a->key)) {
+            // the last of a run of equal keys is the newest
+            if (i < old.count && edits[j].key == a->key)
+                i++;
+            if (j + 1 < count && edits[j + 1].key == edits[j].key) {
+                j++;
+                continue;
+            }
+            merged[n].key = edits[j].key;
+            merged[n++].w = edits[j++].w;
+        }
+        else {
+            merged[n++] = *a;
+            i++;
+        }
+    }
+    put_varint(&payload, n);
+    for (i = 0; i < n; i++) {
+        put_varint(&payload, merged[i].key - key);
+        put_varint(&payload, ZIGZAG(merged[i].w));
+        key = merged[i].key;
+    }
+    free(*data);
+    *data = payload.data;
+    *size = payload.size;
+    free(merged);
+    free(old.data);
+}
+
+static void unmap_file(RegionFile *file) {
+#if REGION_MMAP
+    if (file->data)
+        munmap(file->data, file->size);
+#else
+    free(file->data);
+#endif
+    file->data = 0;
+    file->size = 0;
+}
+
+/* maps or reads a whole region file, data stays 0 if it is missing */
+static void map_file(RegionFile *file, const char *path) {
+#if REGION_MMAP
+    struct stat info;
+    void *data;
+    int fd = open(path, O_RDONLY);
+    file->missing = fd < 0 && errno == ENOENT;
+    if (fd < 0)
+        return;
+    if (!fstat(fd, &info) && info.st_size >= REGION_HEADER_V1) {
+        data = mmap(0, info.st_size, PROT_READ, MAP_SHARED, fd, 0);
+        if (data != MAP_FAILED) {
+            file->data = (unsigned char *)data;
+            file->size = info.st_size;
+        }
+    }
+    close(fd);
+#else
+    long size;
+    FILE *handle = fopen(path, "rb");
+    file->missing = !handle && errno == ENOENT;
+    if (!handle)
+        return;
+    if (!fseek(handle, 0, SEEK_END) && (size = ftell(handle)) >=
+        REGION_HEADER_V1 && !fseek(handle, 0, SEEK_SET))
+    {
+        file->data = (unsigned char *)malloc(size);
+        if (fread(file->data, 1, size, handle) == (size_t)size) {
+            file->size = size;
+        }
+        else {
+            free(file->data);
+            file->data = 0;
+        }
+    }
+    fclose(handle);
+#endif
+}
+
+/* maps the file again; its mtx is held or it is being written */
+static void load_file(RegionStore *store, RegionFile *file) {
+    char path[REGION_PATH];
+    unmap_file(file);
+    region_path(path, sizeof(path), store->prefix, file->rx, file->rq);
+    map_file(file, path);
+    file->slots = file->data ? slot_table(file->data, file->size) : 0;
+    if (!file->slots)
+        unmap_file(file);
+    file->loaded = 1;
+}
+
+/* returns the file of region rx, rq, shared with other readers or,
+ * for a writer, once every reader has let go; 0 when every cached file
+ * is in use. store->mtx only guards the table, the payloads are read
+ * without it */
+static RegionFile *store_acquire(
+    RegionStore *store, int rx, int rq, int write)
+{
+    RegionFile *file, *spare;
+    mtx_lock(&store->mtx);
+    store->tick++;
+    while (1) {
+        int i;
+        file = spare = 0;
+        for (i = 0; i < REGION_FILES; i++) {
+            RegionFile *other = store->files + i;
+            if (other->valid && other->rx == rx && other->rq == rq) {
+                file = other;
+                break;
+            }
+            if (other->refs || other->writing)
+                continue;
+            if (!spare || !other->valid ||
+                (spare->valid && other->tick < spare->tick))
+            {
+                spare = other;
+            }
+        }
+        if (!file || !file->writing)
+            break;
+        cnd_wait(&store->cnd, &store->mtx);
+    }
+    if (!file && (file = spare)) {
+        // mapped by whoever uses it first
+        file->valid = 1;
+        file->rx = rx;
+        file->rq = rq;
+        file->loaded = 0;
+    }
+    if (file) {
+        file->tick = store->tick;
+        if (write) {
+            file->writing = 1;
+            while (file->refs) {
+                cnd_wait(&store->cnd, &store->mtx);
+            }
+        }
+        else {
+            file->refs++;
+        }
+    }
+    mtx_unlock(&store->mtx);
+    if (!file)
+        return 0;
+    mtx_lock(&file->mtx);
+    if (!file->loaded)
+        load_file(store, file);
+    mtx_unlock(&file->mtx);
+    return file;
+}
+
+static void store_release(RegionStore *store, RegionFile *file, int write) {
+    mtx_lock(&store->mtx);
+    if (write)
+        file->writing = 0;
+    else
+        file->refs--;
+    cnd_broadcast(&store->cnd);
+    mtx_unlock(&store->mtx);
+}
+
+/* finds the payload of slot index in a mapped file, 0 if it is empty */
+static unsigned int file_payload(
+    RegionFile *file, int index, const unsigned char **data)
+{
+    unsigned int offset, size;
+    if (!file->data)
+        return 0;
+    offset = get_u32(file->data + file->slots + index * 8);
+    size = get_u32(file->data + file->slots + 4 + index * 8);
+    if (!size || offset > file->size || size > file->size - offset)
+        return 0;
+    *data = file->data + offset;
+    return size;
+}
+
+void region_store_open(RegionStore *store, const char *prefix) {
+    int i;
+    memset(store, 0, sizeof(RegionStore));
+    snprintf(store->prefix, sizeof(store->prefix), "%s", prefix);
+    mtx_init(&store->mtx, mtx_plain);
+    cnd_init(&store->cnd);
+    for (i = 0; i < REGION_FILES; i++) {
+        mtx_init(&store->files[i].mtx, mtx_plain);
+    }
+}
+
+void region_store_close(RegionStore *store) {
+    int i;
+    for (i = 0; i < REGION_FILES; i++) {
+        unmap_file(store->files + i);
+        mtx_destroy(&store->files[i].mtx);
+    }
+    free(store->edits);
+    cnd_destroy(&store->cnd);
+    mtx_destroy(&store->mtx);
+}
+
+/* queues an edit for the next region_store_flush */
+void region_store_put(
+    RegionStore *store, int p, int q, int x, int y, int z, int w)
+{
+    RegionEdit *edit;
+    if (store->count == store->capacity) {
+        store->capacity = store->capacity ? store->capacity * 2 : 1024;
+        store->edits = (RegionEdit *)realloc(
+            store->edits, store->capacity * sizeof(RegionEdit));
+    }
+    edit = store->edits + store->count;
+    if (region_edit(edit, p, q, x, y, z, w))
+        edit->order = store->count++;
+}
+
+/* rewrites a file whose dead payloads outweigh the live ones */
+static int compact_file(RegionStore *store, RegionFile *file) {
+    char path[REGION_PATH];
+    RegionData region;
+    size_t live = REGION_HEADER;
+    int i, result;
+    for (i = 0; i < REGION_SLOTS; i++) {
+        live += get_u32(file->data + file->slots + 4 + i * 8);
+    }
+    if (file->size < REGION_COMPACT || file->size / 2 < live)
+        return 0;
+    region_path(path, sizeof(path), store->prefix, file->rx, file->rq);
+    if (region_read_all(path, &region) < 0)
+        return -1;
+    result = region_write_all(path, &region);
+    region_data_free(&region);
+    load_file(store, file);
+    return result;
+}
+
+/* appends the merged payloads of the edited chunks of one region and
+ * only then points their slots at them, so a reader or a crash sees
+ * each chunk whole, before or after; the caller is the only user of
+ * the file */
+static int flush_region(
+    RegionStore *store, RegionFile *file,
+    const RegionEdit *edits, int count)
+{
+    char path[REGION_PATH];
+    unsigned char entry[8];
+    unsigned int *slots;
+    unsigned int start = file->slots;
+    long end;
+    int i = 0, n = 0, ok;
+    FILE *out;
+    region_path(path, sizeof(path), store->prefix, file->rx, file->rq);
+    if (!file->data) {
+        RegionData empty;
+        // a file that exists but cannot be read must not be written over
+        memset(&empty, 0, sizeof(empty));
+        if (!file->missing || region_write_all(path, &empty))
+            return -1;
+        start = REGION_PREAMBLE;
+    }
+    if (!(out = fopen(path, "r+b")))
+        return -1;
+    slots = (unsigned int *)malloc(count * 3 * sizeof(unsigned int));
+    ok = !fseek(out, 0, SEEK_END) && (end = ftell(out)) >= 0;
+    while (ok && i < count) {
+        const unsigned char *old;
+        unsigned char *data = 0;
+        unsigned int size;
+        int index = edits[i].index;
+        int j = i;
+        while (j < count && edits[j].index == index) {
+            j++;
+        }
+        if ((size = file_payload(file, index, &old))) {
+            data = (unsigned char *)malloc(size);
+            memcpy(data, old, size);
+        }
+        region_edits_merge(&data, &size,
+            file->rx * REGION_CHUNKS + index / REGION_CHUNKS,
+            file->rq * REGION_CHUNKS + index % REGION_CHUNKS,
+            edits + i, j - i);
+        // offsets are 32 bits
+        ok = (unsigned long)end <= 0xffffffffUL - size &&
+            fwrite(data, 1, size, out) == size;
+        slots[n * 3] = index;
+        slots[n * 3 + 1] = end;
+        slots[n * 3 + 2] = size;
+        end += size;
+        n++;
+        free(data);
+        i = j;
+    }
+    ok = ok && !fflush(out);
+    for (i = 0; ok && i < n; i++) {
+        put_u32(entry, slots[i * 3 + 1]);
+        put_u32(entry + 4, slots[i * 3 + 2]);
+        ok = !fseek(out, start + slots[i * 3] * 8, SEEK_SET) &&
+            fwrite(entry, 1, 8, out) == 8;
+    }
+    if (fclose(out))
+        ok = 0;
+    free(slots);
+    load_file(store, file);
+    return ok && file->data ? compact_file(store, file) : -1;
+}
+
+/* writes the queued edits into their region files, chunk by chunk;
+ * returns 0 or -1 if a file could not be read or written, whose edits
+ * then stay queued for the next flush */
+int region_store_flush(RegionStore *store) {
+    RegionEdit *edits = store->edits;
+    unsigned int kept = 0;
+    int i = 0, result = 0;
+    region_edits_sort(edits, store->count);
+    while (i < (int)store->count) {
+        RegionFile *file;
+        int rx = edits[i].rx;
+        int rq = edits[i].rq;
+        int start = i, ok = 0;
+        while (i < (int)store->count &&
+            edits[i].rx == rx && edits[i].rq == rq)
+        {
+            i++;
+        }
+        if ((file = store_acquire(store, rx, rq, 1))) {
+            ok = !flush_region(store, file, edits + start, i - start);
+            store_release(store, file, 1);
+        }
+        if (!ok) {
+            // renumbered in sorted order so later puts still win
+            for (; start < i; start++) {
+                edits[kept] = edits[start];
+                edits[kept].order = kept;
+                kept++;
+            }
+            result = -1;
+        }
+    }
+    store->count = kept;
+    return result;
+}
+
+static void load_edit(int p, int q, int x, int y, int z, int w, void *arg) {
+    map_set((Map *)arg, x, y, z, w);
+}
+
+static int store_each(
+    RegionStore *store, int p, int q, region_block_func func, void *arg)
+{
+    RegionFile *file;
+    const unsigned char *data;
+    unsigned int size;
+    int rx, rq, index, count = 0;
+    index = region_index(p, q, &rx, &rq);
+    if ((file = store_acquire(store, rx, rq, 0))) {
+        if ((size = file_payload(file, index, &data)))
+            count = region_edits_each(data, size, p, q, func, arg);
+        store_release(store, file, 0);
+    }
+    else {
+        // every cached file is in use, read the one chunk instead
+        char path[REGION_PATH];
+        unsigned char *copy;
+        unsigned int stamp[2];
+        region_path(path, sizeof(path), store->prefix, rx, rq);
+        if (region_read(path, index, stamp, &copy, &size)) {
+            count = region_edits_each(copy, size, p, q, func, arg);
+            free(copy);
+        }
+    }
+    return count < 0 ? 0 : count;
+}
+
+/* applies the stored edits of chunk p, q to map, returns their count */
+int region_store_load(RegionStore *store, int p, int q, Map *map) {
+    return store_each(store, p, q, load_edit, map);
+}
+
+/* calls func for every stored edit in region rx, rq; returns the count */
+int region_store_each(
+    RegionStore *store, int rx, int rq, region_block_func func, void *arg)
+{
+    int i, count = 0;
+    for (i = 0; i < REGION_SLOTS; i++) {
+        count += store_each(store,
+            rx * REGION_CHUNKS + i / REGION_CHUNKS,
+            rq * REGION_CHUNKS + i % REGION_CHUNKS, func, arg);
+    }
+    return count;
+}
@@ -0,0 +1,112 @@
+#ifndef _region_h_
+#define _region_h_
+
+#include <stddef.h>
+#include "map.h"
+#include "tinycthread.h"
+#include "world.h"
+
+/* a region file holds up to 32x32 chunks: a header with one offset and
+ * size per chunk followed by the chunk payloads */
+#define REGION_CHUNKS 32
+#define REGION_SLOTS (REGION_CHUNKS * REGION_CHUNKS)
+
+/* stamp is the generator version and seed of baked terrain, 0 for
+ * block edits */
+typedef struct {
+    unsigned int stamp[2];
+    unsigned char *data[REGION_SLOTS];
+    unsigned int size[REGION_SLOTS];
+} RegionData;
+
+typedef struct RegionBake RegionBake;
+
+/* block edit files are mapped for reads where mmap is available and
+ * read whole otherwise; the store keeps REGION_FILES of them open */
+#if defined(__linux__) || defined(__APPLE__) || defined(__FreeBSD__)
+#define REGION_MMAP 1
+#else
+#define REGION_MMAP 0
+#endif
+#define REGION_FILES 16
+
+/* a path is the prefix followed by the region as ".rx.rq" */
+#define REGION_PREFIX 512
+#define REGION_PATH (REGION_PREFIX + 24)
+
+typedef void (*region_block_func)(
+    int p, int q, int x, int y, int z, int w, void *arg);
+
+typedef struct {
+    int rx;
+    int rq;
+    int index;
+    unsigned int key;
+    int w;
+    unsigned int order;
+} RegionEdit;
+
+/* the store's mtx guards valid, rx, rq, tick, refs and writing: any
+ * number of readers or one writer use a file, which is not evicted
+ * meanwhile; the file's own mtx guards mapping it */
+typedef struct {
+    int valid;
+    int rx;
+    int rq;
+    int refs;
+    int writing;
+    int loaded;
+    int missing;
+    unsigned int slots;
+    unsigned int tick;
+    unsigned char *data;
+    size_t size;
+    mtx_t mtx;
+} RegionFile;
+
+typedef struct {
+    char prefix[REGION_PREFIX];
+    mtx_t mtx;
+    cnd_t cnd;
+    unsigned int tick;
+    RegionFile files[REGION_FILES];
+    RegionEdit *edits;
+    unsigned int count;
+    unsigned int capacity;
+} RegionStore;
+
+int region_index(int p, int q, int *rx, int *rq);
+void region_path(char *path, int length, const char *prefix, int rx, int rq);
+int region_read_all(const char *path, RegionData *region);
+int region_write_all(const char *path, RegionData *region);
+void region_data_free(RegionData *region);
+
+int region_load_chunk(
+    const char *prefix, WorldGen *gen, int p, int q, Map *map);
+int region_bake(
+    const char *prefix, WorldGen *gen,
+    int p0, int q0, int p1, int q1, int threads);
+RegionBake *region_bake_start(
+    const char *prefix, WorldGen *gen,
+    int p0, int q0, int p1, int q1, int threads);
+int region_bake_finish(RegionBake *bake, int stop);
+
+int region_edit(RegionEdit *edit, int p, int q, int x, int y, int z, int w);
+void region_edits_sort(RegionEdit *edits, unsigned int count);
+int region_edits_each(
+    const unsigned char *data, unsigned int size, int p, int q,
+    region_block_func func, void *arg);
+void region_edits_merge(
+    unsigned char **data, unsigned int *size, int p, int q,
+    const RegionEdit *edits, int count);
+
+void region_store_open(RegionStore *store, const char *prefix);
+void region_store_close(RegionStore *store);
+void region_store_put(
+    RegionStore *store, int p, int q, int x, int y, int z, int w);
+int region_store_flush(RegionStore *store);
+int region_store_load(RegionStore *store, int p, int q, Map *map);
+int region_store_each(
+    RegionStore *store, int rx, int rq, region_block_func func, void *arg);
+
+#endif
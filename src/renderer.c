@@ -2,6 +2,7 @@
 
 #include <glsm/glsmsym.h>
 
+#include "config.h"
 #include "renderer.h"
 
 #define ARRAY_SIZE(a) (sizeof(a) / sizeof((a)[0]))
@@ -10,6 +11,7 @@ enum shader_program_type
 {
    SHADER_PROGRAM_NONE = 0,
    SHADER_PROGRAM_BLOCK,
+   SHADER_PROGRAM_BLOCK_PACKED,
    SHADER_PROGRAM_LINE,
    SHADER_PROGRAM_TEXT,
    SHADER_PROGRAM_SKY,
@@ -151,6 +153,7 @@ static const char *block_fragment_shader[] = {
     "uniform float daylight;\n",
     "uniform int ortho;\n",
     "varying vec2 fragment_uv;\n",
+    "varying vec2 fragment_tile;\n",
     "varying float fragment_ao;\n",
     "varying float fragment_light;\n",
     "varying float fog_factor;\n",
@@ -158,7 +161,12 @@ static const char *block_fragment_shader[] = {
     "varying float diffuse;\n",
     "const float pi = 3.14159265;\n",
     "void main() {\n",
-    "  vec3 color = vec3(texture2D(sampler, fragment_uv));\n",
+    "  vec2 uv = fragment_uv;\n",
+    "  if (fragment_tile.x >= 0.0) {\n",
+    "    uv = fragment_tile + 1.0 / 2048.0 +\n"
+    "        fract(fragment_uv) * (0.0625 - 2.0 / 2048.0);\n",
+    "  }\n",
+    "  vec3 color = vec3(texture2D(sampler, uv));\n",
     "  if (color == vec3(1.0, 0.0, 1.0)) {\n",
     "    discard;\n",
     "  }\n",
@@ -192,6 +200,7 @@ static const char *block_vertex_shader[] = {
    "attribute vec3 normal;\n",
    "attribute vec4 uv;\n",
    "varying vec2 fragment_uv;\n",
+   "varying vec2 fragment_tile;\n",
    "varying float fragment_ao;\n",
    "varying float fragment_light;\n",
    "varying float fog_factor;\n",
@@ -201,7 +210,16 @@ static const char *block_vertex_shader[] = {
    "const vec3 light_direction = normalize(vec3(-1.0, 1.0, -1.0));\n",
    "void main() {\n",
    "  gl_Position = matrix * position;\n",
-   "  fragment_uv = uv.xy;\n",
+   "  if (uv.x < 0.0) {\n",
+   "    vec2 t = -uv.xy - 1.0;\n",
+   "    vec2 tile = floor(t / 64.0);\n",
+   "    fragment_tile = tile * 0.0625;\n",
+   "    fragment_uv = t - tile * 64.0;\n",
+   "  }\n",
+   "  else {\n",
+   "    fragment_tile = vec2(-1.0);\n",
+   "    fragment_uv = uv.xy;\n",
+   "  }\n",
    "  fragment_ao = 0.3 + (1.0 - uv.z) * 0.7;\n",
    "  fragment_light = uv.w;\n",
    "  diffuse = max(0.0, dot(normal, light_direction));\n",
@@ -218,6 +236,59 @@ static const char *block_vertex_shader[] = {
    "  }\n",
    "}\n",
 };
+
+#if PACKED_VERTICES
+/* decodes the vertices written by pack_block_vertices */
+static const char *block_packed_vertex_shader[] = {
+   "#version " GLSL_VERSION "\n"
+   "uniform mat4 matrix;\n",
+   "uniform vec3 camera;\n",
+   "uniform vec3 origin;\n",
+   "uniform float fog_distance;\n",
+   "uniform int ortho;\n",
+   "attribute vec4 position;\n",
+   "attribute vec2 uv;\n",
+   "varying vec2 fragment_uv;\n",
+   "varying vec2 fragment_tile;\n",
+   "varying float fragment_ao;\n",
+   "varying float fragment_light;\n",
+   "varying float fog_factor;\n",
+   "varying float fog_height;\n",
+   "varying float diffuse;\n",
+   "const float pi = 3.14159265;\n",
+   "void main() {\n",
+   "  vec4 world = vec4(origin + position.xyz / 64.0, 1.0);\n",
+   "  float shade = floor((position.w + 0.5) / 33.0);\n",
+   "  float ao = position.w - shade * 33.0;\n",
+   "  float df = floor((shade + 0.5) / 61.0);\n",
+   "  gl_Position = matrix * world;\n",
+   "  if (uv.x < 0.0) {\n",
+   "    vec2 t = -uv - 1.0;\n",
+   "    vec2 tile = floor(t / 64.0);\n",
+   "    fragment_tile = tile * 0.0625;\n",
+   "    fragment_uv = t - tile * 64.0;\n",
+   "  }\n",
+   "  else {\n",
+   "    fragment_tile = vec2(-1.0);\n",
+   "    fragment_uv = uv / 2048.0;\n",
+   "  }\n",
+   "  fragment_ao = 0.3 + (1.0 - ao / 32.0) * 0.7;\n",
+   "  fragment_light = (shade - df * 61.0) / 60.0;\n",
+   "  diffuse = df / 15.0;\n",
+   "  if (bool(ortho)) {\n",
+   "    fog_factor = 0.0;\n",
+   "    fog_height = 0.0;\n",
+   "  }\n",
+   "  else {\n",
+   "    float camera_distance = distance(camera, vec3(world));\n",
+   "    fog_factor = pow(clamp(camera_distance / fog_distance, 0.0, 1.0), 4.0);\n",
+   "    float dy = world.y - camera.y;\n",
+   "    float dx = distance(world.xz, camera.xz);\n",
+   "    fog_height = (atan(dy, dx) + pi / 2.0) / pi;\n",
+   "  }\n",
+   "}\n",
+};
+#endif
 #endif
 
 static void renderer_load_shader(craft_info_t *info, size_t len, size_t len2,
@@ -295,6 +366,26 @@ static void renderer_load_shader_type(craft_info_t *info, enum shader_program_ty
          info->block_attrib.extra4   = glGetUniformLocation(info->program, "ortho");
          info->block_attrib.camera   = glGetUniformLocation(info->program, "camera");
          info->block_attrib.timer    = glGetUniformLocation(info->program, "timer");
+#endif
+         break;
+      case SHADER_PROGRAM_BLOCK_PACKED:
+#if (defined(HAVE_OPENGL) || defined(HAVE_OPENGLES)) && PACKED_VERTICES
+         renderer_load_shader(info, ARRAY_SIZE(block_packed_vertex_shader), ARRAY_SIZE(block_fragment_shader),
+               block_packed_vertex_shader, block_fragment_shader);
+
+         info->block_packed_attrib.program  = info->program;
+         info->block_packed_attrib.position = glGetAttribLocation(info->program, "position");
+         info->block_packed_attrib.normal   = -1;
+         info->block_packed_attrib.uv       = glGetAttribLocation(info->program, "uv");
+         info->block_packed_attrib.matrix   = glGetUniformLocation(info->program, "matrix");
+         info->block_packed_attrib.sampler  = glGetUniformLocation(info->program, "sampler");
+         info->block_packed_attrib.extra1   = glGetUniformLocation(info->program, "sky_sampler");
+         info->block_packed_attrib.extra2   = glGetUniformLocation(info->program, "daylight");
+         info->block_packed_attrib.extra3   = glGetUniformLocation(info->program, "fog_distance");
+         info->block_packed_attrib.extra4   = glGetUniformLocation(info->program, "ortho");
+         info->block_packed_attrib.camera   = glGetUniformLocation(info->program, "camera");
+         info->block_packed_attrib.timer    = glGetUniformLocation(info->program, "timer");
+         info->block_packed_attrib.origin   = glGetUniformLocation(info->program, "origin");
 #endif
          break;
       case SHADER_PROGRAM_LINE:
@@ -359,6 +450,7 @@ static void renderer_load_shader_type(craft_info_t *info, enum shader_program_ty
 void renderer_load_shaders(craft_info_t *info)
 {
    renderer_load_shader_type(info, SHADER_PROGRAM_BLOCK);
+   renderer_load_shader_type(info, SHADER_PROGRAM_BLOCK_PACKED);
    renderer_load_shader_type(info, SHADER_PROGRAM_LINE);
    renderer_load_shader_type(info, SHADER_PROGRAM_TEXT);
    renderer_load_shader_type(info, SHADER_PROGRAM_SKY);
@@ -439,6 +531,9 @@ void render_shader_program(struct shader_program_info *info)
 
    if (info->timer.enable)
       glUniform1f(info->attrib->timer,    info->timer.data);
+
+   if (info->origin.enable)
+      glUniform3f(info->attrib->origin, info->origin.x, info->origin.y, info->origin.z);
 #endif
 }
 
@@ -473,6 +568,60 @@ uintptr_t renderer_gen_faces(int components, int faces, float *data)
 #endif
 }
 
+uintptr_t renderer_gen_quads(int components, int faces, float *data)
+{
+#if defined(HAVE_OPENGL) || defined(HAVE_OPENGLES)
+    GLuint buffer = (GLuint)renderer_gen_buffer(
+        sizeof(GLfloat) * 4 * components * faces, data);
+    free(data);
+    return buffer;
+#endif
+}
+
+uintptr_t renderer_gen_packed_quads(int faces, short *data)
+{
+#if defined(HAVE_OPENGL) || defined(HAVE_OPENGLES)
+    GLuint buffer;
+    glGenBuffers(1, &buffer);
+    glBindBuffer(GL_ARRAY_BUFFER, buffer);
+    glBufferData(GL_ARRAY_BUFFER,
+        (GLsizei)(sizeof(GLshort) * 6 * 4 * faces), data, GL_STATIC_DRAW);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    free(data);
+    return buffer;
+#endif
+}
+
+/* element buffer shared by every quad mesh, 16 bit indices cover
+ * MAX_QUAD_BATCH quads per draw */
+uintptr_t renderer_gen_quad_indices(void)
+{
+#if defined(HAVE_OPENGL) || defined(HAVE_OPENGLES)
+    GLuint buffer;
+    unsigned i;
+    GLushort *data = (GLushort*)malloc(
+        sizeof(GLushort) * 6 * MAX_QUAD_BATCH);
+    if (!data)
+        return 0;
+    for (i = 0; i < MAX_QUAD_BATCH; i++)
+    {
+        data[i * 6 + 0] = i * 4 + 0;
+        data[i * 6 + 1] = i * 4 + 1;
+        data[i * 6 + 2] = i * 4 + 2;
+        data[i * 6 + 3] = i * 4 + 0;
+        data[i * 6 + 4] = i * 4 + 2;
+        data[i * 6 + 5] = i * 4 + 3;
+    }
+    glGenBuffers(1, &buffer);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, buffer);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER,
+        (GLsizei)(sizeof(GLushort) * 6 * MAX_QUAD_BATCH), data, GL_STATIC_DRAW);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+    free(data);
+    return buffer;
+#endif
+}
+
 void renderer_clear_backbuffer(void)
 {
 #if defined(HAVE_OPENGL) || defined(HAVE_OPENGLES)
@@ -533,17 +682,27 @@ void renderer_unbind_array_buffer(Attrib *attrib,
 void renderer_modify_array_buffer(Attrib *attrib,
       unsigned attrib_size,
       unsigned normal, unsigned uv, unsigned mod)
+{
+   renderer_modify_array_buffer_from(attrib, attrib_size, normal, uv, mod, 0);
+}
+
+/* same as above with the attributes starting at vertex first */
+void renderer_modify_array_buffer_from(Attrib *attrib,
+      unsigned attrib_size,
+      unsigned normal, unsigned uv, unsigned mod, unsigned first)
 {
 #if defined(HAVE_OPENGL) || defined(HAVE_OPENGLES)
+   size_t base = sizeof(GLfloat) * mod * first;
+
    if (attrib->position != -1)
       glVertexAttribPointer(attrib->position, attrib_size, GL_FLOAT, GL_FALSE,
-            sizeof(GLfloat) * mod, 0);
+            sizeof(GLfloat) * mod, (GLvoid *)base);
 
    if (normal)
    {
       if (attrib->normal != -1)
          glVertexAttribPointer(attrib->normal, 3, GL_FLOAT, GL_FALSE,
-               sizeof(GLfloat) * mod, (GLvoid *)(sizeof(GLfloat) * 3));
+               sizeof(GLfloat) * mod, (GLvoid *)(base + sizeof(GLfloat) * 3));
    }
    if (uv)
    {
@@ -551,18 +710,33 @@ void renderer_modify_array_buffer(Attrib *attrib,
       {
          if (attrib->uv != -1)
             glVertexAttribPointer(attrib->uv, 4, GL_FLOAT, GL_FALSE,
-                  sizeof(GLfloat) * mod, (GLvoid *)(sizeof(GLfloat) * 6));
+                  sizeof(GLfloat) * mod, (GLvoid *)(base + sizeof(GLfloat) * 6));
       }
       else
       {
          if (attrib->uv != -1)
             glVertexAttribPointer(attrib->uv, 2, GL_FLOAT, GL_FALSE,
-                  sizeof(GLfloat) * mod, (GLvoid *)(sizeof(GLfloat) * attrib_size));
+                  sizeof(GLfloat) * mod,
+                  (GLvoid *)(base + sizeof(GLfloat) * attrib_size));
       }
    }
 #endif
 }
 
+void renderer_modify_packed_array_buffer(Attrib *attrib, unsigned first)
+{
+#if defined(HAVE_OPENGL) || defined(HAVE_OPENGLES)
+   size_t base = sizeof(GLshort) * 6 * first;
+
+   if (attrib->position != -1)
+      glVertexAttribPointer(attrib->position, 4, GL_SHORT, GL_FALSE,
+            sizeof(GLshort) * 6, (GLvoid *)base);
+   if (attrib->uv != -1)
+      glVertexAttribPointer(attrib->uv, 2, GL_SHORT, GL_FALSE,
+            sizeof(GLshort) * 6, (GLvoid *)(base + sizeof(GLshort) * 4));
+#endif
+}
+
 void renderer_enable_polygon_offset_fill(void)
 {
 #if defined(HAVE_OPENGL) || defined(HAVE_OPENGLES)
@@ -596,6 +770,27 @@ void renderer_draw_triangle_arrays(enum draw_prim_type type, unsigned count)
 #endif
 }
 
+void renderer_draw_elements(enum draw_prim_type type,
+      uintptr_t indices, unsigned count)
+{
+#if defined(HAVE_OPENGL) || defined(HAVE_OPENGLES)
+   GLenum gl_prim_type;
+
+   switch (type)
+   {
+      case DRAW_PRIM_TRIANGLES:
+         gl_prim_type = GL_TRIANGLES;
+         break;
+      case DRAW_PRIM_LINES:
+         gl_prim_type = GL_LINES;
+         break;
+   }
+   glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, (GLuint)indices);
+   glDrawElements(gl_prim_type, count, GL_UNSIGNED_SHORT, 0);
+   glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+#endif
+}
+
 void renderer_enable_scissor_test(void)
 {
 #if defined(HAVE_OPENGL) || defined(HAVE_OPENGLES)
@@ -8,6 +8,9 @@
 
 #define MAX_NAME_LENGTH 32
 
+/* quads per draw call with the shared 16 bit index buffer */
+#define MAX_QUAD_BATCH 16384
+
 typedef struct craft_info craft_info_t;
 
 enum shader_type
@@ -63,17 +66,20 @@ typedef struct
    uintptr_t extra2;
    uintptr_t extra3;
    uintptr_t extra4;
+   uintptr_t origin;
 } Attrib;
 
 struct craft_info
 {
    Attrib block_attrib;
+   Attrib block_packed_attrib;
    Attrib line_attrib;
    Attrib text_attrib;
    Attrib sky_attrib;
    Attrib water_attrib;
 
    uintptr_t sky_buffer;
+   uintptr_t quad_buffer;
    uintptr_t program;
    uintptr_t texture;
    uintptr_t font;
@@ -153,6 +159,14 @@ typedef struct shader_program_info
       bool enable;
       float *data;
    } matrix;
+
+   struct
+   {
+      bool enable;
+      float x;
+      float y;
+      float z;
+   } origin;
 } shader_program_info_t;
 
 
@@ -189,6 +203,12 @@ void renderer_disable_blend(void);
 
 uintptr_t renderer_gen_faces(int components, int faces, float *data);
 
+uintptr_t renderer_gen_quads(int components, int faces, float *data);
+
+uintptr_t renderer_gen_packed_quads(int faces, short *data);
+
+uintptr_t renderer_gen_quad_indices(void);
+
 void renderer_bind_array_buffer(Attrib *attrib, uintptr_t buffer,
       unsigned normal, unsigned uv);
 
@@ -199,12 +219,21 @@ void renderer_modify_array_buffer(Attrib *attrib,
       unsigned attrib_size,
       unsigned normal, unsigned uv, unsigned mod);
 
+void renderer_modify_array_buffer_from(Attrib *attrib,
+      unsigned attrib_size,
+      unsigned normal, unsigned uv, unsigned mod, unsigned first);
+
+void renderer_modify_packed_array_buffer(Attrib *attrib, unsigned first);
+
 void renderer_enable_polygon_offset_fill(void);
 
 void renderer_disable_polygon_offset_fill(void);
 
 void renderer_draw_triangle_arrays(enum draw_prim_type type, unsigned count);
 
+void renderer_draw_elements(enum draw_prim_type type,
+      uintptr_t indices, unsigned count);
+
 void renderer_enable_scissor_test(void);
 
 void renderer_disable_scissor_test(void);
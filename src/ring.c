@@ -2,6 +2,31 @@
 #include <string.h>
 #include "ring.h"
 
+#ifdef _MSC_VER
+#include <windows.h>
+
+static unsigned int ring_load(volatile unsigned int *value)
+{
+   unsigned int result = *value;
+   MemoryBarrier();
+   return result;
+}
+
+static void ring_store(volatile unsigned int *value, unsigned int result)
+{
+   MemoryBarrier();
+   *value = result;
+}
+
+#define RING_LOAD(p) ring_load((volatile unsigned int *)(p))
+#define RING_STORE(p, v) ring_store((volatile unsigned int *)(p), (v))
+#define RING_FENCE() MemoryBarrier()
+#else
+#define RING_LOAD(p) __atomic_load_n((p), __ATOMIC_ACQUIRE)
+#define RING_STORE(p, v) __atomic_store_n((p), (v), __ATOMIC_RELEASE)
+#define RING_FENCE() __atomic_thread_fence(__ATOMIC_SEQ_CST)
+#endif
+
 void ring_alloc(Ring *ring, int capacity)
 {
    ring->capacity = capacity;
@@ -118,3 +143,116 @@ int ring_get(Ring *ring, RingEntry *entry)
    ring->start = (ring->start + 1) % ring->capacity;
    return 1;
 }
+
+/* capacity is rounded up to a power of two */
+void spsc_ring_alloc(SpscRing *ring, int capacity)
+{
+   unsigned int size = 2;
+   while (size < (unsigned int)capacity)
+      size <<= 1;
+   ring->mask = size - 1;
+   ring->head = 0;
+   ring->tail = 0;
+   ring->waiting = 0;
+   ring->overflowed = 0;
+   ring->data = (RingEntry *)calloc(size, sizeof(RingEntry));
+   mtx_init(&ring->mtx, mtx_plain);
+   cnd_init(&ring->cnd);
+   ring_alloc(&ring->overflow, 1024);
+}
+
+void spsc_ring_free(SpscRing *ring)
+{
+   cnd_destroy(&ring->cnd);
+   mtx_destroy(&ring->mtx);
+   free(ring->data);
+   ring_free(&ring->overflow);
+}
+
+/* either side may ask, the answer can be stale for the other one */
+int spsc_ring_empty(SpscRing *ring)
+{
+   return RING_LOAD(&ring->head) == RING_LOAD(&ring->tail) &&
+      !RING_LOAD(&ring->overflowed);
+}
+
+/* the producer's stores to tail and overflowed and the consumer's store
+ * to waiting are each followed by a full fence, so at least one side
+ * sees the other; the first put to find the consumer asleep clears
+ * waiting, so the rest do not signal again before it has run */
+static void spsc_ring_notify(SpscRing *ring)
+{
+   RING_FENCE();
+   if (!RING_LOAD(&ring->waiting))
+      return;
+   mtx_lock(&ring->mtx);
+   if (ring->waiting)
+   {
+      RING_STORE(&ring->waiting, 0);
+      cnd_signal(&ring->cnd);
+   }
+   mtx_unlock(&ring->mtx);
+}
+
+/* producer only; once the ring is full entries queue up in the
+ * overflow under mtx, and keep doing so until the consumer has taken
+ * them all, which keeps them in order */
+void spsc_ring_put(SpscRing *ring, RingEntry *entry)
+{
+   unsigned int tail = ring->tail;
+   if (!RING_LOAD(&ring->overflowed) &&
+         tail - RING_LOAD(&ring->head) <= ring->mask)
+   {
+      memcpy(ring->data + (tail & ring->mask), entry, sizeof(RingEntry));
+      RING_STORE(&ring->tail, tail + 1);
+      spsc_ring_notify(ring);
+      return;
+   }
+   mtx_lock(&ring->mtx);
+   ring_put(&ring->overflow, entry);
+   RING_STORE(&ring->overflowed, ring->overflowed + 1);
+   mtx_unlock(&ring->mtx);
+   spsc_ring_notify(ring);
+}
+
+/* consumer only; the overflow is taken from once the ring is empty,
+ * which is checked again after seeing it in use since the producer
+ * only writes the ring while the overflow is empty */
+int spsc_ring_get(SpscRing *ring, RingEntry *entry)
+{
+   unsigned int head = ring->head;
+   if (head == RING_LOAD(&ring->tail))
+   {
+      if (!RING_LOAD(&ring->overflowed))
+         return 0;
+      if (head == RING_LOAD(&ring->tail))
+      {
+         mtx_lock(&ring->mtx);
+         ring_get(&ring->overflow, entry);
+         RING_STORE(&ring->overflowed, ring->overflowed - 1);
+         mtx_unlock(&ring->mtx);
+         return 1;
+      }
+   }
+   memcpy(entry, ring->data + (head & ring->mask), sizeof(RingEntry));
+   RING_STORE(&ring->head, head + 1);
+   return 1;
+}
+
+/* consumer only, returns once there is an entry to get */
+void spsc_ring_wait(SpscRing *ring)
+{
+   if (!spsc_ring_empty(ring))
+      return;
+   mtx_lock(&ring->mtx);
+   while (1)
+   {
+      RING_STORE(&ring->waiting, 1);
+      RING_FENCE();
+      if (!spsc_ring_empty(ring))
+         break;
+      cnd_wait(&ring->cnd, &ring->mtx);
+   }
+   RING_STORE(&ring->waiting, 0);
+   mtx_unlock(&ring->mtx);
+}
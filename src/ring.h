@@ -1,6 +1,8 @@
 #ifndef _ring_h_
 #define _ring_h_
 
+#include "tinycthread.h"
+
 typedef enum {
     BLOCK,
     LIGHT,
@@ -27,6 +29,23 @@ typedef struct {
     RingEntry *data;
 } Ring;
 
+/* bounded ring for exactly one producer and one consumer thread; the
+ * indices only grow and are masked on access, the consumer sleeps on
+ * cnd only while there is nothing to get. what does not fit waits in
+ * the overflow ring, guarded by mtx and drained by the consumer after
+ * the ring, so a put never blocks; overflowed counts its entries */
+typedef struct {
+    unsigned int mask;
+    unsigned int head;
+    unsigned int tail;
+    unsigned int waiting;
+    unsigned int overflowed;
+    RingEntry *data;
+    mtx_t mtx;
+    cnd_t cnd;
+    Ring overflow;
+} SpscRing;
+
 void ring_alloc(Ring *ring, int capacity);
 void ring_free(Ring *ring);
 int ring_empty(Ring *ring);
@@ -41,4 +60,11 @@ void ring_put_commit(Ring *ring);
 void ring_put_exit(Ring *ring);
 int ring_get(Ring *ring, RingEntry *entry);
 
+void spsc_ring_alloc(SpscRing *ring, int capacity);
+void spsc_ring_free(SpscRing *ring);
+int spsc_ring_empty(SpscRing *ring);
+void spsc_ring_put(SpscRing *ring, RingEntry *entry);
+int spsc_ring_get(SpscRing *ring, RingEntry *entry);
+void spsc_ring_wait(SpscRing *ring);
+
 #endif
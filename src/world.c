@@ -1,5 +1,8 @@
+#include <stdlib.h>
+#include <string.h>
 #include "config.h"
 #include "noise.h"
+#include "tinycthread.h"
 #include "world.h"
 
 void create_world1(int p, int q, world_func func, void *arg)
@@ -87,123 +90,402 @@ void create_world1(int p, int q, world_func func, void *arg)
    }
 }
 
-void biome0(int x, int z, int flag, world_func func, void *arg)
+#define GRID_SIZE (CHUNK_SIZE + 2)
+#define GRID_AREA (GRID_SIZE * GRID_SIZE)
+#define GRID_RUN 64
+
+#define REGION_SIZE 128
+#define REGION_AREA (REGION_SIZE * REGION_SIZE)
+#define MAX_REGIONS 64
+
+#define COLUMN_VALID 1
+#define COLUMN_BIOME1 2
+#define COLUMN_GRASS 4
+
+/* the 2d decisions for one column: biome0 keeps its ground height and
+ * block in low and high, biome1 the top of its base layer and the
+ * ceiling of its rock noise */
+typedef struct {
+    unsigned char flags;
+    unsigned char low;
+    unsigned char high;
+    unsigned char flower;
+} Column;
+
+typedef struct {
+    int x;
+    int z;
+    unsigned int used;
+    Column *columns;
+} Region;
+
+struct WorldGen {
+    Noise noise;
+    unsigned int seed;
+    mtx_t mtx;
+    unsigned int tick;
+    Region regions[MAX_REGIONS];
+};
+
+WorldGen *world_gen_create(void) {
+    WorldGen *gen = (WorldGen *)calloc(1, sizeof(WorldGen));
+    noise_init(&gen->noise);
+    mtx_init(&gen->mtx, mtx_plain);
+    return gen;
+}
+
+/* switch to a table shuffled from seed, dropping cached columns; not
+ * safe while chunks are being generated with this gen. seed 0 is the
+ * default table of world_gen_create */
+void world_gen_seed(WorldGen *gen, unsigned int seed) {
+    int i;
+    if (seed)
+        noise_seed(&gen->noise, seed);
+    else
+        noise_init(&gen->noise);
+    gen->seed = seed;
+    for (i = 0; i < MAX_REGIONS; i++) {
+        gen->regions[i].used = 0;
+    }
+}
+
+unsigned int world_gen_get_seed(WorldGen *gen) {
+    return gen->seed;
+}
+
+void world_gen_free(WorldGen *gen) {
+    int i;
+    if (!gen)
+        return;
+    for (i = 0; i < MAX_REGIONS; i++) {
+        free(gen->regions[i].columns);
+    }
+    mtx_destroy(&gen->mtx);
+    free(gen);
+}
+
+static int region_of(int x) {
+    return x >= 0 ? x / REGION_SIZE : (x + 1) / REGION_SIZE - 1;
+}
+
+/* called with gen->mtx held, evicts the least recently used region
+ * when creating and the cache is full */
+static Region *find_region(WorldGen *gen, int x, int z, int create) {
+    Region *oldest = gen->regions;
+    int i;
+    for (i = 0; i < MAX_REGIONS; i++) {
+        Region *region = gen->regions + i;
+        if (region->used && region->x == x && region->z == z) {
+            region->used = ++gen->tick;
+            return region;
+        }
+        if (region->used < oldest->used) {
+            oldest = region;
+        }
+    }
+    if (!create)
+        return 0;
+    if (!oldest->columns) {
+        oldest->columns = (Column *)malloc(REGION_AREA * sizeof(Column));
+    }
+    memset(oldest->columns, 0, REGION_AREA * sizeof(Column));
+    oldest->x = x;
+    oldest->z = z;
+    oldest->used = ++gen->tick;
+    return oldest;
+}
+
+/* copy the cached columns of the padded grid for chunk (p, q), or store
+ * the listed ones back; a chunk grid spans at most 2x2 regions */
+static void cache_columns(
+    WorldGen *gen, int p, int q, Column *grid, const int *columns,
+    int count, int store)
 {
-   int y;
-   float f = simplex2(x * 0.01, z * 0.01, 4, 0.5, 2);
-   float g = simplex2(-x * 0.01, -z * 0.01, 2, 0.9, 2);
-   int mh = g * 32 + 16;
-   int h = f * mh;
-   int w = 1;
-   int t = 12;
-   if (h <= t) {
-      h = t;
-      w = 2;
-   }
+    Region *table[2][2];
+    int x0 = region_of(p * CHUNK_SIZE - 1);
+    int z0 = region_of(q * CHUNK_SIZE - 1);
+    int i, j;
+    mtx_lock(&gen->mtx);
+    for (i = 0; i < 2; i++) {
+        for (j = 0; j < 2; j++) {
+            table[i][j] = find_region(gen, x0 + i, z0 + j, store);
+        }
+    }
+    for (i = 0; i < count; i++) {
+        int c = columns ? columns[i] : i;
+        int x = p * CHUNK_SIZE + c / GRID_SIZE - 1;
+        int z = q * CHUNK_SIZE + c % GRID_SIZE - 1;
+        int rx = region_of(x);
+        int rz = region_of(z);
+        Region *region = table[rx - x0][rz - z0];
+        Column *column;
+        if (!region)
+            continue;
+        column = region->columns +
+            (x - rx * REGION_SIZE) * REGION_SIZE + (z - rz * REGION_SIZE);
+        if (store) *column = grid[c];
+        else grid[c] = *column;
+    }
+    mtx_unlock(&gen->mtx);
+}
+
+/* 2d noise for the listed columns of the padded chunk grid, stored back
+ * by column so each biome only evaluates the columns it owns */
+static void grid_noise(
+    const Noise *noise, int p, int q, const int *columns, int count, double sx, double sz,
+    int octaves, float persistence, float *out)
+{
+    // zeroed like the column lists, gcc cannot tell that only count
+    // entries are read
+    float x[GRID_AREA] = {0};
+    float z[GRID_AREA] = {0};
+    float value[GRID_AREA];
+    int i;
+    if (!count)
+        return;
+    for (i = 0; i < count; i++) {
+        int c = columns[i];
+        x[i] = (p * CHUNK_SIZE + c / GRID_SIZE - 1) * sx;
+        z[i] = (q * CHUNK_SIZE + c % GRID_SIZE - 1) * sz;
+    }
+    simplex2_batch(noise, x, z, count, octaves, persistence, 2, value);
+    for (i = 0; i < count; i++) {
+        out[columns[i]] = value[i];
+    }
+}
+
+/* evaluate the 2d decisions of the listed columns */
+static void compute_columns(
+    const Noise *noise, int p, int q, Column *grid, const int *columns,
+    int count)
+{
+    int cols0[GRID_AREA] = {0}, cols1[GRID_AREA] = {0};
+    int plants[GRID_AREA] = {0};
+    float biome[GRID_AREA], f[GRID_AREA], g[GRID_AREA];
+    float grass[GRID_AREA], flower[GRID_AREA], kind[GRID_AREA];
+    int i, n0 = 0, n1 = 0, np = 0;
+    grid_noise(noise, p, q, columns, count, -0.001, -0.001, 8, 0.5, biome);
+    // both biomes start from the same 4 octave field
+    grid_noise(noise, p, q, columns, count, 0.01, 0.01, 4, 0.5, f);
+    for (i = 0; i < count; i++) {
+        int c = columns[i];
+        if ((int)(biome[c] * 2) == 0) cols0[n0++] = c;
+        else cols1[n1++] = c;
+    }
+    grid_noise(noise, p, q, cols0, n0, -0.01, -0.01, 2, 0.9, g);
+    grid_noise(noise, p, q, cols1, n1, -0.01, -0.01, 4, 0.5, g);
+    for (i = 0; i < n1; i++) {
+        int c = cols1[i];
+        grid[c].flags = COLUMN_VALID | COLUMN_BIOME1;
+        grid[c].low = (int)(f[c] * 8 + 8);
+        grid[c].high = (int)(g[c] * 32 + 32);
+        grid[c].flower = 0;
+    }
+    for (i = 0; i < n0; i++) {
+        int c = cols0[i];
+        int mh = g[c] * 32 + 16;
+        int h = f[c] * mh;
+        int w = 1;
+        int t = 12;
+        if (h <= t) {
+            h = t;
+            w = 2;
+        }
+        grid[c].flags = COLUMN_VALID;
+        grid[c].low = h;
+        grid[c].high = w;
+        grid[c].flower = 0;
+        if (w == 1) plants[np++] = c;
+    }
+    if (!SHOW_PLANTS)
+        return;
+    grid_noise(noise, p, q, plants, np, -0.1, 0.1, 4, 0.8, grass);
+    grid_noise(noise, p, q, plants, np, 0.05, -0.05, 4, 0.8, flower);
+    grid_noise(noise, p, q, plants, np, 0.1, 0.1, 4, 0.8, kind);
+    for (i = 0; i < np; i++) {
+        int c = plants[i];
+        if (grass[c] > 0.6) {
+            grid[c].flags |= COLUMN_GRASS;
+        }
+        if (flower[c] > 0.7) {
+            grid[c].flower = 18 + kind[c] * 7;
+        }
+    }
+}
+
+/* emits the 8 cloud cells, merging neighbors into runs */
+static void clouds(
+    const Noise *noise, int x, int z, int flag, world_fill_func fill,
+    void *arg)
+{
+    float px[8], py[8], pz[8], value[8];
+    int i, start = -1;
+    for (i = 0; i < 8; i++) {
+        px[i] = x * 0.01;
+        py[i] = (64 + i) * 0.1;
+        pz[i] = z * 0.01;
+    }
+    simplex3_batch(noise, px, py, pz, 8, 8, 0.5, 2, value);
+    for (i = 0; i <= 8; i++) {
+        int cloud = i < 8 && value[i] > 0.75;
+        if (cloud && start < 0) {
+            start = i;
+        }
+        else if (!cloud && start >= 0) {
+            fill(x, 64 + start, 64 + i, z, 16 * flag, arg);
+            start = -1;
+        }
+    }
+}
+
+static void biome0(
+    const Noise *noise, int x, int z, int flag, const Column *column,
+    world_fill_func fill, void *arg)
+{
+   int h = column->low;
+   int w = column->high;
    // sand and grass terrain
-   for (y = 0; y < h; y++) {
-      func(x, y, z, w * flag, arg);
+   if (h > 0) {
+      fill(x, 0, h, z, w * flag, arg);
    }
-   if (w == 1) {
-      int ok = 0;//SHOW_TREES;
-      if (SHOW_PLANTS) {
-         // grass
-         if (simplex2(-x * 0.1, z * 0.1, 4, 0.8, 2) > 0.6) {
-            func(x, h, z, 17 * flag, arg);
-         }
-         // flowers
-         if (simplex2(x * 0.05, -z * 0.05, 4, 0.8, 2) > 0.7) {
-            int w = 18 + simplex2(x * 0.1, z * 0.1, 4, 0.8, 2) * 7;
-            func(x, h, z, w * flag, arg);
-         }
-      }
-      // trees
-      // if (dx - 4 < 0 || dz - 4 < 0 ||
-      //     dx + 4 >= CHUNK_SIZE || dz + 4 >= CHUNK_SIZE)
-      // {
-      //     ok = 0;
-      // }
-      if (ok && simplex2(x, z, 6, 0.5, 2) > 0.84) {
-         int y;
-         for (y = h + 3; y < h + 8; y++) {
-            int ox;
-            for (ox = -3; ox <= 3; ox++) {
-               int oz;
-               for (oz = -3; oz <= 3; oz++) {
-                  int d = (ox * ox) + (oz * oz) +
-                     (y - (h + 4)) * (y - (h + 4));
-                  if (d < 11) {
-                     func(x + ox, y, z + oz, 15, arg);
-                  }
-               }
-            }
-         }
-
-         for (y = h; y < h + 7; y++)
-            func(x, y, z, 5, arg);
-      }
+   // grass
+   if (column->flags & COLUMN_GRASS) {
+      fill(x, h, h + 1, z, 17 * flag, arg);
+   }
+   // flowers
+   if (column->flower) {
+      fill(x, h, h + 1, z, column->flower * flag, arg);
    }
    // clouds
    if (SHOW_CLOUDS)
-   {
-      int y;
-      for (y = 64; y < 72; y++)
-      {
-         if (simplex3(
-                  x * 0.01, y * 0.1, z * 0.01, 8, 0.5, 2) > 0.75)
-            func(x, y, z, 16 * flag, arg);
-      }
-   }
+      clouds(noise, x, z, flag, fill, arg);
 }
 
-void biome1(int x, int z, int flag, world_func func, void *arg)
+static void biome1(
+    const Noise *noise, int x, int z, int flag, const Column *column,
+    world_fill_func fill, void *arg)
 {
    int y;
-   int lo = simplex2(x * 0.01, z * 0.01, 4, 0.5, 2) * 8 + 8;
-   int hi = simplex2(-x * 0.01, -z * 0.01, 4, 0.5, 2) * 32 + 32;
+   int lo = column->low;
+   int hi = column->high;
    int lookup[] = {3, 6, 11, 12, 13};
-   for (y = 0; y < lo; y++)
-      func(x, y, z, 6 * flag, arg);
-
-   for (y = lo; y < hi; y++)
-   {
-      int i = simplex3(-x * 0.01, -y * 0.01, -z * 0.01, 4, 0.5, 2) * 10;
-      int w = lookup[i % 5];
-      if (simplex3(x * 0.01, y * 0.01, z * 0.01, 4, 0.5, 2) > 0.5)
-         func(x, y, z, w * flag, arg);
-   }
+   if (lo > 0)
+      fill(x, 0, lo, z, 6 * flag, arg);
 
-   if (SHOW_CLOUDS)
+   for (y = lo; y < hi; y += GRID_RUN)
    {
-      for (y = 64; y < 72; y++)
+      float px[GRID_RUN], py[GRID_RUN], pz[GRID_RUN];
+      float kind[GRID_RUN], solid[GRID_RUN];
+      int i, start = 0, run = 0;
+      int n = hi - y < GRID_RUN ? hi - y : GRID_RUN;
+      for (i = 0; i < n; i++)
       {
-         if (simplex3(
-                  x * 0.01, y * 0.1, z * 0.01, 8, 0.5, 2) > 0.75)
-            func(x, y, z, 16 * flag, arg);
+         px[i] = -x * 0.01;
+         py[i] = -(y + i) * 0.01;
+         pz[i] = -z * 0.01;
+      }
+      simplex3_batch(noise, px, py, pz, n, 4, 0.5, 2, kind);
+      for (i = 0; i < n; i++)
+      {
+         px[i] = -px[i];
+         py[i] = -py[i];
+         pz[i] = -pz[i];
+      }
+      simplex3_batch(noise, px, py, pz, n, 4, 0.5, 2, solid);
+      // runs of the same rock
+      for (i = 0; i <= n; i++)
+      {
+         int w = 0;
+         if (i < n && solid[i] > 0.5)
+            w = lookup[(int)(kind[i] * 10) % 5];
+         if (w == run)
+            continue;
+         if (run)
+            fill(x, y + start, y + i, z, run * flag, arg);
+         start = i;
+         run = w;
       }
    }
+
+   if (SHOW_CLOUDS)
+      clouds(noise, x, z, flag, fill, arg);
 }
 
-void create_world2(int p, int q, world_func func, void *arg) {
-   int dx;
-    int pad = 1;
-    for (dx = -pad; dx < CHUNK_SIZE + pad; dx++) {
-       int dz;
-        for (dz = -pad; dz < CHUNK_SIZE + pad; dz++) {
-           int x, z, i;
-            int flag = 1;
-            if (dx < 0 || dz < 0 || dx >= CHUNK_SIZE || dz >= CHUNK_SIZE) {
-                flag = -1;
+/* gen may be null to generate without a cache from the global table;
+ * reserve, if set, is first given an estimate of the blocks to come */
+void create_world_fill(
+    WorldGen *gen, int p, int q, world_reserve_func reserve,
+    world_fill_func fill, void *arg)
+{
+    const Noise *noise = gen ? &gen->noise : 0;
+    Column grid[GRID_AREA];
+    int missing[GRID_AREA];
+    int c, count = 0;
+    memset(grid, 0, sizeof(grid));
+    if (gen) {
+        cache_columns(gen, p, q, grid, 0, GRID_AREA, 0);
+    }
+    for (c = 0; c < GRID_AREA; c++) {
+        if (!(grid[c].flags & COLUMN_VALID)) missing[count++] = c;
+    }
+    if (count) {
+        compute_columns(noise, p, q, grid, missing, count);
+        if (gen) {
+            cache_columns(gen, p, q, grid, missing, count, 1);
+        }
+    }
+    if (reserve) {
+        // about half of the biome1 rock band is solid
+        count = 0;
+        for (c = 0; c < GRID_AREA; c++) {
+            count += grid[c].low + 1;
+            if (grid[c].flags & COLUMN_BIOME1) {
+                count += (grid[c].high - grid[c].low) / 2;
             }
-            x = p * CHUNK_SIZE + dx;
-            z = q * CHUNK_SIZE + dz;
-            i = simplex2(-x * 0.001, -z * 0.001, 8, 0.5, 2) * 2;
-            if (i == 0) biome0(x, z, flag, func, arg);
-            else biome1(x, z, flag, func, arg);
         }
+        reserve(count, arg);
     }
+    for (c = 0; c < GRID_AREA; c++) {
+        int dx = c / GRID_SIZE - 1;
+        int dz = c % GRID_SIZE - 1;
+        int x = p * CHUNK_SIZE + dx;
+        int z = q * CHUNK_SIZE + dz;
+        int flag = 1;
+        if (dx < 0 || dz < 0 || dx >= CHUNK_SIZE || dz >= CHUNK_SIZE) {
+            flag = -1;
+        }
+        if (grid[c].flags & COLUMN_BIOME1) {
+            biome1(noise, x, z, flag, grid + c, fill, arg);
+        }
+        else {
+            biome0(noise, x, z, flag, grid + c, fill, arg);
+        }
+    }
+}
+
+typedef struct {
+    world_func func;
+    void *arg;
+} WorldCallback;
+
+static void callback_fill(int x, int y0, int y1, int z, int w, void *arg) {
+    WorldCallback *callback = (WorldCallback *)arg;
+    int y;
+    for (y = y0; y < y1; y++) {
+        callback->func(x, y, z, w, callback->arg);
+    }
+}
+
+/* one call per block, for world.py */
+void create_world_gen(
+    WorldGen *gen, int p, int q, world_func func, void *arg)
+{
+    WorldCallback callback;
+    callback.func = func;
+    callback.arg = arg;
+    create_world_fill(gen, p, q, 0, callback_fill, &callback);
 }
 
 void create_world(int p, int q, world_func func, void *arg) {
-    create_world2(p, q, func, arg);
+    create_world_gen(0, p, q, func, arg);
 }
@@ -2,6 +2,24 @@
 #define _world_h_
 
 typedef void (*world_func)(int, int, int, int, void *);
+typedef void (*world_fill_func)(int x, int y0, int y1, int z, int w, void *);
+typedef void (*world_reserve_func)(int count, void *);
+
+/* bumped whenever create_world_fill emits other blocks for a seed, so
+ * terrain baked by an older generator is not used */
+#define WORLD_GEN_VERSION 1
+
+typedef struct WorldGen WorldGen;
+
+WorldGen *world_gen_create(void);
+void world_gen_seed(WorldGen *gen, unsigned int seed);
+unsigned int world_gen_get_seed(WorldGen *gen);
+void world_gen_free(WorldGen *gen);
+void create_world_fill(
+    WorldGen *gen, int p, int q, world_reserve_func reserve,
+    world_fill_func fill, void *arg);
+void create_world_gen(
+    WorldGen *gen, int p, int q, world_func func, void *arg);
 
 void create_world(int p, int q, world_func func, void *arg);
 
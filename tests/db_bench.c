@@ -0,0 +1,150 @@
+/* inserts per second for a builder-scale edit, a filled sphere of
+ * radius 30 as /fsphere 30 places it; one prepared insert per block
+ * into the block table as the db worker used to write them, against
+ * db_insert_block through the ring and the batched worker into chunk
+ * blobs and into region files. the blocks are read back afterwards */
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#include "config.h"
+#include "db.h"
+#include "map.h"
+#include "sqlite3.h"
+
+#define RADIUS 30
+#define CENTER_Y 64
+#define PATH "db_bench.db"
+#define AUTH_PATH "db_bench.auth.db"
+
+unsigned BLOCK_REGIONS = 0;
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int chunked(int x) {
+    return (int)floorf((float)x / CHUNK_SIZE);
+}
+
+static void cleanup(void) {
+    char path[64];
+    int i;
+    const char *suffixes[] = {"", "-wal", "-shm", "-journal"};
+    for (i = 0; i < 4; i++) {
+        snprintf(path, sizeof(path), "%s%s", PATH, suffixes[i]);
+        remove(path);
+        snprintf(path, sizeof(path), "%s%s", AUTH_PATH, suffixes[i]);
+        remove(path);
+    }
+    system("rm -f " PATH ".blocks.*");
+}
+
+static int in_sphere(int x, int y, int z) {
+    return x * x + y * y + z * z <= RADIUS * RADIUS;
+}
+
+static double rows(int *count) {
+    static const char *query =
+        "insert or replace into block (p, q, x, y, z, w) "
+        "values (?, ?, ?, ?, ?, ?);";
+    sqlite3 *db;
+    sqlite3_stmt *stmt;
+    double start;
+    int x, y, z;
+    cleanup();
+    sqlite3_open(PATH, &db);
+    sqlite3_exec(db,
+        "create table block (p int not null, q int not null,"
+        " x int not null, y int not null, z int not null, w int not null);"
+        "create unique index block_pqxyz_idx on block (p, q, x, y, z);",
+        NULL, NULL, NULL);
+    sqlite3_prepare_v2(db, query, -1, &stmt, NULL);
+    *count = 0;
+    start = now();
+    sqlite3_exec(db, "begin;", NULL, NULL, NULL);
+    for (x = -RADIUS; x <= RADIUS; x++) {
+        for (y = -RADIUS; y <= RADIUS; y++) {
+            for (z = -RADIUS; z <= RADIUS; z++) {
+                if (!in_sphere(x, y, z))
+                    continue;
+                sqlite3_reset(stmt);
+                sqlite3_bind_int(stmt, 1, chunked(x));
+                sqlite3_bind_int(stmt, 2, chunked(z));
+                sqlite3_bind_int(stmt, 3, x);
+                sqlite3_bind_int(stmt, 4, CENTER_Y + y);
+                sqlite3_bind_int(stmt, 5, z);
+                sqlite3_bind_int(stmt, 6, 1);
+                sqlite3_step(stmt);
+                (*count)++;
+            }
+        }
+    }
+    sqlite3_exec(db, "commit;", NULL, NULL, NULL);
+    start = now() - start;
+    sqlite3_finalize(stmt);
+    sqlite3_close(db);
+    return start;
+}
+
+/* from the first insert until db_close has joined the worker */
+static double batched(int regions, int *count, int *loaded) {
+    double start;
+    int x, y, z, p, q;
+    cleanup();
+    BLOCK_REGIONS = regions;
+    db_enable();
+    if (db_init(PATH, AUTH_PATH, 0)) {
+        fprintf(stderr, "db_init failed\n");
+        exit(1);
+    }
+    *count = 0;
+    start = now();
+    for (x = -RADIUS; x <= RADIUS; x++) {
+        for (y = -RADIUS; y <= RADIUS; y++) {
+            for (z = -RADIUS; z <= RADIUS; z++) {
+                if (!in_sphere(x, y, z))
+                    continue;
+                db_insert_block(chunked(x), chunked(z), x, CENTER_Y + y, z, 1);
+                (*count)++;
+            }
+        }
+    }
+    db_commit();
+    db_close();
+    start = now() - start;
+    *loaded = 0;
+    db_init(PATH, AUTH_PATH, 0);
+    for (p = chunked(-RADIUS); p <= chunked(RADIUS); p++) {
+        for (q = chunked(-RADIUS); q <= chunked(RADIUS); q++) {
+            Map map;
+            map_alloc(&map, p * CHUNK_SIZE - 1, 0, q * CHUNK_SIZE - 1, 0x7fff);
+            db_load_blocks(&map, p, q);
+            *loaded += map.size;
+            map_free(&map);
+        }
+    }
+    db_close();
+    db_disable();
+    return start;
+}
+
+int main(void) {
+    int count, loaded, bad = 0;
+    double elapsed = rows(&count);
+    printf("%-12s %7d blocks %10.0f inserts/s\n",
+        "block rows", count, count / elapsed);
+    elapsed = batched(0, &count, &loaded);
+    printf("%-12s %7d blocks %10.0f inserts/s %7d loaded\n",
+        "chunk_blob", count, count / elapsed, loaded);
+    bad += loaded != count;
+    elapsed = batched(1, &count, &loaded);
+    printf("%-12s %7d blocks %10.0f inserts/s %7d loaded\n",
+        "region", count, count / elapsed, loaded);
+    bad += loaded != count;
+    cleanup();
+    return bad ? 1 : 0;
+}
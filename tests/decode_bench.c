@@ -0,0 +1,194 @@
+/* messages per second decoded from the same stream of block and player
+ * updates, sent as text lines and parsed with sscanf as protocol 1 does,
+ * and sent as frames and read with the frame_* functions */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "client.h"
+#include "config.h"
+
+#define MESSAGES 1000000
+#define PASSES 5
+
+typedef struct {
+    unsigned char *data;
+    int size;
+} Buffer;
+
+static void put_varint(Buffer *b, unsigned int value) {
+    while (value >= 0x80) {
+        b->data[b->size++] = (value & 0x7f) | 0x80;
+        value >>= 7;
+    }
+    b->data[b->size++] = value;
+}
+
+static void put_int(Buffer *b, int value) {
+    put_varint(b, ((unsigned int)value << 1) ^ (unsigned int)(value >> 31));
+}
+
+static void put_float(Buffer *b, float value) {
+    unsigned int bits;
+    int i;
+    memcpy(&bits, &value, sizeof(bits));
+    for (i = 0; i < 4; i++)
+        b->data[b->size++] = bits >> (i * 8);
+}
+
+static void put_frame(Buffer *b, int type, Buffer *payload) {
+    b->data[b->size++] = type | FRAME_BIT;
+    put_varint(b, payload->size);
+    memcpy(b->data + b->size, payload->data, payload->size);
+    b->size += payload->size;
+}
+
+/* every eighth message is a player position, the rest are blocks */
+static void build(Buffer *text, Buffer *frames) {
+    unsigned char scratch[64];
+    int i;
+    srand(1);
+    for (i = 0; i < MESSAGES; i++) {
+        Buffer payload = {scratch, 0};
+        if (i % 8 == 0) {
+            int pid = rand() % 16;
+            float f[5];
+            int k;
+            for (k = 0; k < 5; k++)
+                f[k] = (rand() % 200000 - 100000) / 100.0f;
+            text->size += sprintf((char *)text->data + text->size,
+                "P,%d,%.2f,%.2f,%.2f,%.2f,%.2f\n",
+                pid, f[0], f[1], f[2], f[3], f[4]);
+            put_int(&payload, pid);
+            for (k = 0; k < 5; k++)
+                put_float(&payload, f[k]);
+            put_frame(frames, 'P', &payload);
+        }
+        else {
+            int p = rand() % 64 - 32;
+            int q = rand() % 64 - 32;
+            int x = rand() % CHUNK_SIZE;
+            int y = rand() % 256;
+            int z = rand() % CHUNK_SIZE;
+            int w = rand() % 64;
+            text->size += sprintf((char *)text->data + text->size,
+                "B,%d,%d,%d,%d,%d,%d\n", p, q,
+                p * CHUNK_SIZE + x, y, q * CHUNK_SIZE + z, w);
+            put_int(&payload, p);
+            put_int(&payload, q);
+            put_int(&payload, x);
+            put_int(&payload, y);
+            put_int(&payload, z);
+            put_int(&payload, w);
+            put_frame(frames, 'B', &payload);
+        }
+    }
+}
+
+static double decode_text(Buffer *b, int *count) {
+    double sum = 0;
+    int offset = 0, n;
+    while ((n = client_message_size((char *)b->data + offset,
+        b->size - offset)) > 0)
+    {
+        char line[128];
+        int pid, p, q, x, y, z, w;
+        float f[5];
+        // the client cuts each line out before parsing it
+        memcpy(line, b->data + offset, n - 1);
+        line[n - 1] = '\0';
+        if (sscanf(line, "P,%d,%f,%f,%f,%f,%f",
+            &pid, f, f + 1, f + 2, f + 3, f + 4) == 6)
+        {
+            sum += pid + f[0] + f[4];
+        }
+        else if (sscanf(line, "B,%d,%d,%d,%d,%d,%d",
+            &p, &q, &x, &y, &z, &w) == 6)
+        {
+            sum += x + y + z + w;
+        }
+        (*count)++;
+        offset += n;
+    }
+    return sum;
+}
+
+static double decode_frames(Buffer *b, int *count) {
+    double sum = 0;
+    int offset = 0, n;
+    while ((n = client_message_size((char *)b->data + offset,
+        b->size - offset)) > 0)
+    {
+        FrameReader r;
+        int type = b->data[offset] & ~FRAME_BIT;
+        int header = 2;
+        while (b->data[offset + header - 1] & 0x80)
+            header++;
+        r.data = b->data + offset + header;
+        r.end = b->data + offset + n;
+        r.error = 0;
+        if (type == 'P') {
+            int pid = frame_int(&r);
+            float f[5];
+            int k;
+            for (k = 0; k < 5; k++)
+                f[k] = frame_float(&r);
+            sum += pid + f[0] + f[4];
+        }
+        else {
+            int p = frame_int(&r);
+            int q = frame_int(&r);
+            int x = frame_int(&r) + p * CHUNK_SIZE;
+            int y = frame_int(&r);
+            int z = frame_int(&r) + q * CHUNK_SIZE;
+            int w = frame_int(&r);
+            sum += x + y + z + w;
+        }
+        (*count)++;
+        offset += n;
+    }
+    return sum;
+}
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void report(
+    const char *name, Buffer *b, double (*decode)(Buffer *, int *),
+    double *sum)
+{
+    double best = 0;
+    int i;
+    for (i = 0; i < PASSES; i++) {
+        int count = 0;
+        double start = now();
+        *sum = decode(b, &count);
+        start = now() - start;
+        if (count != MESSAGES) {
+            fprintf(stderr, "%s: decoded %d of %d\n", name, count, MESSAGES);
+            exit(1);
+        }
+        if (!best || start < best)
+            best = start;
+    }
+    printf("%-7s %9d bytes %8.2f M messages/s %8.1f MB/s\n", name, b->size,
+        MESSAGES / best / 1e6, b->size / best / 1e6);
+}
+
+int main(void) {
+    Buffer text, frames;
+    double sums[2];
+    text.data = (unsigned char *)malloc(MESSAGES * 64);
+    frames.data = (unsigned char *)malloc(MESSAGES * 32);
+    text.size = frames.size = 0;
+    build(&text, &frames);
+    report("text", &text, decode_text, sums + 0);
+    report("framed", &frames, decode_frames, sums + 1);
+    free(text.data);
+    free(frames.data);
+    // both carry the same values, the floats are exact in either
+    return sums[0] != sums[1];
+}
@@ -0,0 +1,117 @@
+/* per-frame cost of the ensure_chunks sweep, one find_chunk for each of
+ * the (2r + 1)^2 chunks around a walking player, through a linear scan
+ * of the chunk array as find_chunk used to do and through chunk_index;
+ * the chunks that fall out of range are swap-removed as in
+ * delete_chunks, and both must find the same chunks every frame */
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "chunk_index.h"
+
+#define MAX_CHUNKS 8192
+#define CHUNK_INDEX_SIZE (MAX_CHUNKS * 2)
+#define FRAMES 64
+#define STEP 4
+
+typedef struct {
+    int p;
+    int q;
+} Chunk;
+
+static Chunk chunks[MAX_CHUNKS];
+static int chunk_count;
+static ChunkIndex lookup;
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int find_linear(int p, int q) {
+    int i;
+    for (i = 0; i < chunk_count; i++) {
+        if (chunks[i].p == p && chunks[i].q == q) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+static int find_indexed(int p, int q) {
+    return chunk_index_get(&lookup, p, q);
+}
+
+static void delete_far(int p, int q, int radius) {
+    int i;
+    for (i = 0; i < chunk_count; i++) {
+        Chunk *chunk = chunks + i;
+        int dp = abs(chunk->p - p);
+        int dq = abs(chunk->q - q);
+        if ((dp > dq ? dp : dq) < radius) {
+            continue;
+        }
+        chunk_index_remove(&lookup, chunk->p, chunk->q);
+        if (i != --chunk_count) {
+            *chunk = chunks[chunk_count];
+            chunk_index_set(&lookup, chunk->p, chunk->q, i);
+        }
+    }
+}
+
+/* returns the seconds spent finding, found counts the hits */
+static double run(int radius, int (*find)(int, int), long *found) {
+    double elapsed = 0;
+    int frame;
+    chunk_count = 0;
+    chunk_index_clear(&lookup);
+    *found = 0;
+    for (frame = 0; frame < FRAMES; frame++) {
+        int p = frame / STEP;
+        int q = 0;
+        int dp, dq;
+        double start = now();
+        for (dp = -radius; dp <= radius; dp++) {
+            for (dq = -radius; dq <= radius; dq++) {
+                if (find(p + dp, q + dq) >= 0) {
+                    (*found)++;
+                }
+            }
+        }
+        elapsed += now() - start;
+        // load whatever was missing and drop what is out of range
+        for (dp = -radius; dp <= radius; dp++) {
+            for (dq = -radius; dq <= radius; dq++) {
+                if (find_indexed(p + dp, q + dq) < 0) {
+                    Chunk *chunk = chunks + chunk_count;
+                    chunk->p = p + dp;
+                    chunk->q = q + dq;
+                    chunk_index_set(&lookup, chunk->p, chunk->q,
+                        chunk_count++);
+                }
+            }
+        }
+        delete_far(p, q, radius + 1);
+    }
+    return elapsed;
+}
+
+int main(void) {
+    int radii[] = {10, 24, 32};
+    int i, bad = 0;
+    chunk_index_alloc(&lookup, CHUNK_INDEX_SIZE);
+    printf("%6s %8s %14s %14s\n", "radius", "chunks", "linear", "indexed");
+    for (i = 0; i < 3; i++) {
+        long found[2];
+        double linear = run(radii[i], find_linear, found);
+        double indexed = run(radii[i], find_indexed, found + 1);
+        printf("%6d %8d %11.3f ms %11.3f ms (%.0fx)\n",
+            radii[i], chunk_count, linear * 1000 / FRAMES,
+            indexed * 1000 / FRAMES, linear / indexed);
+        if (found[0] != found[1]) {
+            bad++;
+        }
+    }
+    chunk_index_free(&lookup);
+    return bad ? 1 : 0;
+}
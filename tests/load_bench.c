@@ -0,0 +1,221 @@
+/* load time per chunk of a builder's edits, read back one select per
+ * chunk from the block table as the game used to, and through
+ * db_load_blocks from chunk blobs and from region files after db_init
+ * has migrated the rows into each; region loads are also timed from
+ * several threads at once, and every path must load the same blocks */
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "config.h"
+#include "db.h"
+#include "map.h"
+#include "sqlite3.h"
+#include "tinycthread.h"
+
+#define CHUNKS 12
+#define EDITS 1500
+#define PASSES 3
+#define THREADS 4
+#define PATH "load_bench.db"
+#define AUTH_PATH "load_bench.auth.db"
+
+unsigned BLOCK_REGIONS = 0;
+
+typedef struct {
+    int first;
+    int step;
+    long loaded;
+    thrd_t thrd;
+} Loader;
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void cleanup(void) {
+    char path[64];
+    int i;
+    const char *suffixes[] = {"", "-wal", "-shm", "-journal"};
+    for (i = 0; i < 4; i++) {
+        snprintf(path, sizeof(path), "%s%s", PATH, suffixes[i]);
+        remove(path);
+        snprintf(path, sizeof(path), "%s%s", AUTH_PATH, suffixes[i]);
+        remove(path);
+    }
+    system("rm -f " PATH ".blocks.*");
+}
+
+static int chunk_p(int i) {
+    return i / CHUNKS - CHUNKS / 2;
+}
+
+static int chunk_q(int i) {
+    return i % CHUNKS - CHUNKS / 2;
+}
+
+/* the block table of an older database, EDITS blocks in every chunk */
+static int create_rows(void) {
+    static const char *query =
+        "insert or replace into block (p, q, x, y, z, w) "
+        "values (?, ?, ?, ?, ?, ?);";
+    sqlite3 *db;
+    sqlite3_stmt *stmt;
+    unsigned int seed = 1;
+    int i, j, count = 0;
+    cleanup();
+    sqlite3_open(PATH, &db);
+    sqlite3_exec(db,
+        "create table block (p int not null, q int not null,"
+        " x int not null, y int not null, z int not null, w int not null);"
+        "create unique index block_pqxyz_idx on block (p, q, x, y, z);",
+        NULL, NULL, NULL);
+    sqlite3_prepare_v2(db, query, -1, &stmt, NULL);
+    sqlite3_exec(db, "begin;", NULL, NULL, NULL);
+    for (i = 0; i < CHUNKS * CHUNKS; i++) {
+        int p = chunk_p(i);
+        int q = chunk_q(i);
+        for (j = 0; j < EDITS; j++) {
+            seed = seed * 1103515245 + 12345;
+            sqlite3_reset(stmt);
+            sqlite3_bind_int(stmt, 1, p);
+            sqlite3_bind_int(stmt, 2, q);
+            sqlite3_bind_int(stmt, 3,
+                p * CHUNK_SIZE + (seed >> 8) % CHUNK_SIZE);
+            sqlite3_bind_int(stmt, 4, 1 + (seed >> 16) % 128);
+            sqlite3_bind_int(stmt, 5,
+                q * CHUNK_SIZE + (seed >> 24) % CHUNK_SIZE);
+            sqlite3_bind_int(stmt, 6, 1 + seed % 60);
+            sqlite3_step(stmt);
+        }
+    }
+    sqlite3_exec(db, "commit;", NULL, NULL, NULL);
+    sqlite3_finalize(stmt);
+    sqlite3_prepare_v2(db, "select count(*) from block;", -1, &stmt, NULL);
+    if (sqlite3_step(stmt) == SQLITE_ROW)
+        count = sqlite3_column_int(stmt, 0);
+    sqlite3_finalize(stmt);
+    sqlite3_close(db);
+    return count;
+}
+
+static double load_rows(long *loaded) {
+    static const char *query =
+        "select x, y, z, w from block where p = ? and q = ?;";
+    sqlite3 *db;
+    sqlite3_stmt *stmt;
+    double start;
+    int i;
+    sqlite3_open(PATH, &db);
+    sqlite3_prepare_v2(db, query, -1, &stmt, NULL);
+    *loaded = 0;
+    start = now();
+    for (i = 0; i < CHUNKS * CHUNKS; i++) {
+        int p = chunk_p(i);
+        int q = chunk_q(i);
+        Map map;
+        map_alloc(&map, p * CHUNK_SIZE - 1, 0, q * CHUNK_SIZE - 1, 0x7fff);
+        sqlite3_bind_int(stmt, 1, p);
+        sqlite3_bind_int(stmt, 2, q);
+        while (sqlite3_step(stmt) == SQLITE_ROW) {
+            map_set(&map,
+                sqlite3_column_int(stmt, 0), sqlite3_column_int(stmt, 1),
+                sqlite3_column_int(stmt, 2), sqlite3_column_int(stmt, 3));
+        }
+        sqlite3_reset(stmt);
+        *loaded += map.size;
+        map_free(&map);
+    }
+    start = now() - start;
+    sqlite3_finalize(stmt);
+    sqlite3_close(db);
+    return start;
+}
+
+static int load_run(void *arg) {
+    Loader *loader = (Loader *)arg;
+    int i;
+    loader->loaded = 0;
+    for (i = loader->first; i < CHUNKS * CHUNKS; i += loader->step) {
+        int p = chunk_p(i);
+        int q = chunk_q(i);
+        Map map;
+        map_alloc(&map, p * CHUNK_SIZE - 1, 0, q * CHUNK_SIZE - 1, 0x7fff);
+        db_load_blocks(&map, p, q);
+        loader->loaded += map.size;
+        map_free(&map);
+    }
+    return 0;
+}
+
+/* the best of a few passes over every chunk on that many threads */
+static double load_chunks(int threads, long *loaded) {
+    Loader loaders[THREADS];
+    double best = 0;
+    int i, pass;
+    for (pass = 0; pass < PASSES; pass++) {
+        double start = now();
+        for (i = 0; i < threads; i++) {
+            loaders[i].first = i;
+            loaders[i].step = threads;
+            thrd_create(&loaders[i].thrd, load_run, loaders + i);
+        }
+        *loaded = 0;
+        for (i = 0; i < threads; i++) {
+            thrd_join(loaders[i].thrd, NULL);
+            *loaded += loaders[i].loaded;
+        }
+        start = now() - start;
+        if (!best || start < best)
+            best = start;
+    }
+    return best;
+}
+
+static void report(const char *name, double elapsed, long loaded, int count) {
+    printf("%-16s %8.1f us/chunk %8ld loaded%s\n", name,
+        elapsed * 1e6 / (CHUNKS * CHUNKS), loaded,
+        loaded == count ? "" : " (differs)");
+}
+
+int main(void) {
+    int count = create_rows();
+    int bad = 0;
+    char name[32];
+    long loaded;
+    double elapsed, migrated;
+    elapsed = load_rows(&loaded);
+    report("block rows", elapsed, loaded, count);
+    bad += loaded != count;
+    db_enable();
+    // db_init moves the rows into chunk blobs, then into region files
+    BLOCK_REGIONS = 0;
+    migrated = now();
+    if (db_init(PATH, AUTH_PATH, THREADS)) {
+        fprintf(stderr, "db_init failed\n");
+        return 1;
+    }
+    migrated = now() - migrated;
+    elapsed = load_chunks(1, &loaded);
+    report("chunk_blob", elapsed, loaded, count);
+    bad += loaded != count;
+    db_close();
+    BLOCK_REGIONS = 1;
+    elapsed = now();
+    db_init(PATH, AUTH_PATH, THREADS);
+    elapsed = now() - elapsed;
+    printf("%d blocks migrated to chunk blobs in %.1f ms, "
+        "to regions in %.1f ms\n", count, migrated * 1000, elapsed * 1000);
+    elapsed = load_chunks(1, &loaded);
+    report("region", elapsed, loaded, count);
+    bad += loaded != count;
+    elapsed = load_chunks(THREADS, &loaded);
+    snprintf(name, sizeof(name), "region x%d", THREADS);
+    report(name, elapsed, loaded, count);
+    bad += loaded != count;
+    db_close();
+    db_disable();
+    cleanup();
+    return bad ? 1 : 0;
+}
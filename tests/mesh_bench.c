@@ -0,0 +1,145 @@
+/* allocations and wall time per chunk for mesh_chunk, whose scratch
+ * volume is bounded by the height of the neighborhood, against the same
+ * meshing after allocating and populating the dense XZ_SIZE * XZ_SIZE *
+ * Y_SIZE volumes that compute_chunk used to calloc for every chunk */
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "config.h"
+#include "map.h"
+#include "mesh.h"
+#include "world.h"
+
+#define RADIUS 3
+#define SIZE (RADIUS * 2 + 1)
+#define PASSES 3
+#define XZ_SIZE (CHUNK_SIZE * 3 + 2)
+#define Y_SIZE (MAX_BLOCK_HEIGHT + 2)
+
+/* mesh.c is built with malloc and calloc renamed to these */
+static long allocs;
+static long alloc_bytes;
+
+void *count_malloc(size_t size) {
+    allocs++;
+    alloc_bytes += size;
+    return malloc(size);
+}
+
+void *count_calloc(size_t count, size_t size) {
+    allocs++;
+    alloc_bytes += count * size;
+    return calloc(count, size);
+}
+
+static void reserve(int count, void *arg) {
+    map_reserve((Map *)arg, count);
+}
+
+static void fill(int x, int y0, int y1, int z, int w, void *arg) {
+    map_fill_column((Map *)arg, x, y0, y1, z, w);
+}
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* what the old compute_chunk paid before meshing anything */
+static int dense(int p, int q, Map *block_maps[3][3]) {
+    size_t size = (size_t)XZ_SIZE * XZ_SIZE * Y_SIZE;
+    char *opaque = count_calloc(size, 1);
+    char *light = count_calloc(size, 1);
+    int ox = p * CHUNK_SIZE - CHUNK_SIZE - 1;
+    int oz = q * CHUNK_SIZE - CHUNK_SIZE - 1;
+    int a, b;
+    if (!opaque || !light) {
+        free(opaque);
+        free(light);
+        return -1;
+    }
+    for (a = 0; a < 3; a++) {
+        for (b = 0; b < 3; b++) {
+            Map *map = block_maps[a][b];
+            MAP_FOR_EACH(map, ex, ey, ez, ew) {
+                int x = ex - ox;
+                int y = ey + 1;
+                int z = ez - oz;
+                if (x < 0 || z < 0 || x >= XZ_SIZE || z >= XZ_SIZE)
+                    continue;
+                opaque[(size_t)y * XZ_SIZE * XZ_SIZE + x * XZ_SIZE + z] =
+                    ew > 0;
+            } END_MAP_FOR_EACH;
+        }
+    }
+    free(opaque);
+    free(light);
+    return 0;
+}
+
+int main(void) {
+    static Map maps[SIZE][SIZE];
+    WorldGen *gen = world_gen_create();
+    const char *names[2] = {"dense", "mesh_chunk"};
+    double best[2] = {0, 0};
+    long calls[2], bytes[2];
+    int chunks = (SIZE - 2) * (SIZE - 2);
+    int p, q, i, mode;
+    for (p = 0; p < SIZE; p++) {
+        for (q = 0; q < SIZE; q++) {
+            int cp = p - RADIUS;
+            int cq = q - RADIUS;
+            map_alloc(&maps[p][q], cp * CHUNK_SIZE - 1, 0,
+                cq * CHUNK_SIZE - 1, 0x7fff);
+            create_world_fill(gen, cp, cq, reserve, fill, &maps[p][q]);
+        }
+    }
+    // the best of a few passes over the inner chunks
+    for (i = 0; i < PASSES; i++) {
+        for (mode = 0; mode < 2; mode++) {
+            double start = now();
+            allocs = alloc_bytes = 0;
+            for (p = 1; p < SIZE - 1; p++) {
+                for (q = 1; q < SIZE - 1; q++) {
+                    Map *block_maps[3][3];
+                    Mesh mesh;
+                    int a, b;
+                    for (a = 0; a < 3; a++) {
+                        for (b = 0; b < 3; b++) {
+                            block_maps[a][b] = &maps[p + a - 1][q + b - 1];
+                        }
+                    }
+                    if ((!mode && dense(p - RADIUS, q - RADIUS, block_maps))
+                        || mesh_chunk(&mesh, p - RADIUS, q - RADIUS,
+                        block_maps, NULL, 0))
+                    {
+                        fprintf(stderr, "out of memory\n");
+                        return 1;
+                    }
+                    free(mesh.data);
+                }
+            }
+            start = (now() - start) / chunks;
+            if (!best[mode] || start < best[mode])
+                best[mode] = start;
+            calls[mode] = allocs;
+            bytes[mode] = alloc_bytes;
+        }
+    }
+    for (mode = 0; mode < 2; mode++) {
+        printf("%-12s %8.3f ms/chunk %4ld allocs %12ld bytes/chunk",
+            names[mode], best[mode] * 1000, calls[mode] / chunks,
+            bytes[mode] / chunks);
+        if (mode)
+            printf(" (%.2fx)", best[0] / best[1]);
+        printf("\n");
+    }
+    for (p = 0; p < SIZE; p++) {
+        for (q = 0; q < SIZE; q++) {
+            map_free(&maps[p][q]);
+        }
+    }
+    world_gen_free(gen);
+    return 0;
+}
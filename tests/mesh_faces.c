@@ -0,0 +1,147 @@
+/* meshes generated chunks with and without greedy meshing and reports
+ * the faces and vertex bytes of each; fails if merging ever adds faces
+ * or if the merged quads cover a different area with any one normal,
+ * ao and light than the faces they replace */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "config.h"
+#include "map.h"
+#include "mesh.h"
+#include "world.h"
+
+#define RADIUS 3
+#define SIZE (RADIUS * 2 + 1)
+
+/* the area covered with one normal and one set of per-vertex ao and
+ * light values */
+typedef struct {
+    float key[11];
+    double area;
+} Shade;
+
+static int shade_cmp(const void *a, const void *b) {
+    return memcmp(((const Shade *)a)->key, ((const Shade *)b)->key,
+        sizeof(((const Shade *)a)->key));
+}
+
+/* sorted and summed per key, returns the number of keys */
+static int shades(Mesh *mesh, Shade *out) {
+    int i, j, count = 0;
+    for (i = 0; i < mesh->faces; i++) {
+        float *d = mesh->data + i * 40;
+        float lo[3], hi[3];
+        Shade *shade = out + i;
+        int k;
+        memset(shade, 0, sizeof(Shade));
+        shade->area = 1;
+        for (k = 0; k < 3; k++) {
+            lo[k] = hi[k] = d[k];
+            shade->key[k] = d[3 + k];
+        }
+        for (j = 0; j < 4; j++) {
+            for (k = 0; k < 3; k++) {
+                lo[k] = d[j * 10 + k] < lo[k] ? d[j * 10 + k] : lo[k];
+                hi[k] = d[j * 10 + k] > hi[k] ? d[j * 10 + k] : hi[k];
+            }
+            shade->key[3 + j] = d[j * 10 + 8];
+            shade->key[7 + j] = d[j * 10 + 9];
+        }
+        for (k = 0; k < 3; k++) {
+            if (hi[k] > lo[k])
+                shade->area *= hi[k] - lo[k];
+        }
+    }
+    qsort(out, mesh->faces, sizeof(Shade), shade_cmp);
+    for (i = 0; i < mesh->faces; i++) {
+        if (count && !shade_cmp(out + count - 1, out + i))
+            out[count - 1].area += out[i].area;
+        else
+            out[count++] = out[i];
+    }
+    return count;
+}
+
+static int same_shading(Mesh *plain, Mesh *greedy) {
+    Shade *a = malloc(sizeof(Shade) * plain->faces);
+    Shade *b = malloc(sizeof(Shade) * greedy->faces);
+    int n = shades(plain, a);
+    int same = n == shades(greedy, b);
+    int i;
+    for (i = 0; same && i < n; i++) {
+        same = !shade_cmp(a + i, b + i) && a[i].area == b[i].area;
+    }
+    free(a);
+    free(b);
+    return same;
+}
+
+static void reserve(int count, void *arg) {
+    map_reserve((Map *)arg, count);
+}
+
+static void fill(int x, int y0, int y1, int z, int w, void *arg) {
+    map_fill_column((Map *)arg, x, y0, y1, z, w);
+}
+
+int main(void) {
+    static Map maps[SIZE][SIZE];
+    WorldGen *gen = world_gen_create();
+    long total[2] = {0, 0};
+    int p, q, bad = 0;
+    for (p = 0; p < SIZE; p++) {
+        for (q = 0; q < SIZE; q++) {
+            int cp = p - RADIUS;
+            int cq = q - RADIUS;
+            map_alloc(&maps[p][q], cp * CHUNK_SIZE - 1, 0,
+                cq * CHUNK_SIZE - 1, 0x7fff);
+            create_world_fill(gen, cp, cq, reserve, fill, &maps[p][q]);
+        }
+    }
+    printf("%8s %8s %10s %8s %10s\n",
+        "chunk", "faces", "bytes", "greedy", "bytes");
+    for (p = 1; p < SIZE - 1; p++) {
+        for (q = 1; q < SIZE - 1; q++) {
+            Map *block_maps[3][3];
+            Mesh mesh[2];
+            int faces[2], greedy, a, b;
+            for (a = 0; a < 3; a++) {
+                for (b = 0; b < 3; b++) {
+                    block_maps[a][b] = &maps[p + a - 1][q + b - 1];
+                }
+            }
+            for (greedy = 0; greedy < 2; greedy++) {
+                if (mesh_chunk(mesh + greedy, p - RADIUS, q - RADIUS,
+                    block_maps, NULL, greedy))
+                {
+                    fprintf(stderr, "out of memory\n");
+                    return 1;
+                }
+                faces[greedy] = mesh[greedy].faces;
+                total[greedy] += mesh[greedy].faces;
+            }
+            printf("%3d,%-4d %8d %10d %8d %10d\n",
+                p - RADIUS, q - RADIUS,
+                faces[0], faces[0] * 40 * (int)sizeof(float),
+                faces[1], faces[1] * 40 * (int)sizeof(float));
+            if (faces[1] > faces[0] || !same_shading(mesh, mesh + 1)) {
+                printf("%3d,%-4d merged faces shade differently\n",
+                    p - RADIUS, q - RADIUS);
+                bad++;
+            }
+            free(mesh[0].data);
+            free(mesh[1].data);
+        }
+    }
+    printf("%8s %8ld %10ld %8ld %10ld (%.1f%%)\n", "total",
+        total[0], total[0] * 40 * (long)sizeof(float),
+        total[1], total[1] * 40 * (long)sizeof(float),
+        total[0] ? 100.0 * total[1] / total[0] : 0.0);
+    for (p = 0; p < SIZE; p++) {
+        for (q = 0; q < SIZE; q++) {
+            map_free(&maps[p][q]);
+        }
+    }
+    world_gen_free(gen);
+    return bad ? 1 : 0;
+}
@@ -0,0 +1,103 @@
+/* moves the block rows of a world into region files the way the game
+ * does when it starts with BLOCK_REGIONS set, through the chunk blobs,
+ * and checks that every row arrived:
+ *
+ *     ./migrate_regions craft.db [auth.db]
+ *
+ * the regions are written beside the database as craft.db.blocks.*
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "config.h"
+#include "db.h"
+#include "region.h"
+#include "sqlite3.h"
+
+unsigned BLOCK_REGIONS = 1;
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* the chunks that have rows, as p, q pairs; returns the row count */
+static int read_rows(const char *path, int **chunks, int *size) {
+    sqlite3 *db;
+    sqlite3_stmt *stmt;
+    int count = -1, capacity = 0;
+    *chunks = 0;
+    *size = 0;
+    if (sqlite3_open_v2(path, &db, SQLITE_OPEN_READONLY, NULL)) {
+        sqlite3_close(db);
+        return -1;
+    }
+    if (!sqlite3_prepare_v2(db,
+        "select count(*) from block;", -1, &stmt, NULL))
+    {
+        if (sqlite3_step(stmt) == SQLITE_ROW)
+            count = sqlite3_column_int(stmt, 0);
+        sqlite3_finalize(stmt);
+    }
+    if (count > 0 && !sqlite3_prepare_v2(db,
+        "select distinct p, q from block;", -1, &stmt, NULL))
+    {
+        while (sqlite3_step(stmt) == SQLITE_ROW) {
+            if (*size + 2 > capacity) {
+                capacity = capacity ? capacity * 2 : 64;
+                *chunks = (int *)realloc(*chunks, capacity * sizeof(int));
+            }
+            (*chunks)[(*size)++] = sqlite3_column_int(stmt, 0);
+            (*chunks)[(*size)++] = sqlite3_column_int(stmt, 1);
+        }
+        sqlite3_finalize(stmt);
+    }
+    sqlite3_close(db);
+    return count;
+}
+
+int main(int argc, char **argv) {
+    char prefix[REGION_PREFIX];
+    RegionStore store;
+    int *chunks;
+    int i, size, count, moved = 0;
+    double elapsed;
+    if (argc < 2 || argc > 3) {
+        fprintf(stderr, "usage: %s craft.db [auth.db]\n", argv[0]);
+        return 2;
+    }
+    count = read_rows(argv[1], &chunks, &size);
+    if (count < 0) {
+        fprintf(stderr, "%s has no block table\n", argv[1]);
+        return 1;
+    }
+    if (!count) {
+        printf("%s has no block rows to move\n", argv[1]);
+        return 0;
+    }
+    db_enable();
+    elapsed = now();
+    if (db_init(argv[1], argc > 2 ? argv[2] : DB_AUTH_PATH, 0)) {
+        fprintf(stderr, "cannot open %s\n", argv[1]);
+        free(chunks);
+        return 1;
+    }
+    db_close();
+    elapsed = now() - elapsed;
+    db_disable();
+    snprintf(prefix, sizeof(prefix), "%s.blocks", argv[1]);
+    region_store_open(&store, prefix);
+    for (i = 0; i < size; i += 2) {
+        Map map;
+        map_alloc(&map, chunks[i] * CHUNK_SIZE - 1, 0,
+            chunks[i + 1] * CHUNK_SIZE - 1, 0x7fff);
+        moved += region_store_load(&store, chunks[i], chunks[i + 1], &map);
+        map_free(&map);
+    }
+    region_store_close(&store);
+    free(chunks);
+    printf("%d of %d blocks in %d chunks moved to %s.* in %.1f ms\n",
+        moved, count, size / 2, prefix, elapsed * 1000);
+    return moved == count ? 0 : 1;
+}
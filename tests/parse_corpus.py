@@ -0,0 +1,93 @@
+# Writes parse_corpus.txt for parse_lines: text protocol lines formatted
+# the way server.py's packet() formats them, then mutated copies that
+# probe the edges of each field. Run it with the Python 2 that runs
+# server.py, whose str(float) is what real traffic carries.
+
+import random
+import sys
+
+CHUNK_SIZE = 32
+DAY_LENGTH = 600
+
+def packet(*args):
+    return '%s\n' % ','.join(map(str, args))
+
+def position():
+    return (
+        random.uniform(-5000, 5000), random.uniform(0, 256),
+        random.uniform(-5000, 5000), random.uniform(-6.3, 6.3),
+        random.uniform(-1.6, 1.6))
+
+def block():
+    p, q = random.randint(-200, 200), random.randint(-200, 200)
+    x = p * CHUNK_SIZE + random.randint(-1, CHUNK_SIZE)
+    z = q * CHUNK_SIZE + random.randint(-1, CHUNK_SIZE)
+    return p, q, x, random.randint(0, 255), z
+
+TEXTS = [
+    'Welcome to Craft!', 'Type "/help" for a list of commands.',
+    'guest3> hello, world', 'a,b,,c', '  leading spaces', 'tab\there',
+    'x' * 300, '',
+]
+
+def clean():
+    kind = random.choice('UPBLSDKREVNTN')
+    if kind in 'UP':
+        pos = random.choice([(0, 0, 0, 0, 0), position()])
+        return packet(kind, random.randint(1, 64), *pos)
+    if kind in 'BL':
+        return packet(kind, *(block() + (random.randint(-64, 64),)))
+    if kind == 'S':
+        text = random.choice(TEXTS + ['sign text', 'two  words'])[:63]
+        return packet(kind, *(block() + (random.randint(0, 7), text)))
+    if kind == 'D':
+        return packet(kind, random.randint(1, 64))
+    if kind == 'K':
+        return packet(kind, random.randint(-200, 200),
+            random.randint(-200, 200), random.randint(0, 1 << 30))
+    if kind == 'R':
+        return packet(kind, random.randint(-200, 200),
+            random.randint(-200, 200))
+    if kind == 'E':
+        return packet(kind, random.uniform(1.3e9, 1.8e9), DAY_LENGTH)
+    if kind == 'V':
+        return packet(kind, random.randint(1, 3))
+    if kind == 'N':
+        return packet(kind, random.randint(1, 64), random.choice(
+            ['guest%d' % random.randint(1, 99), 'fogleman', 'a b',
+            'n' * 40]))
+    return packet(kind, random.choice(TEXTS))
+
+PIECES = [
+    ',', ',,', '-', '+', '.', 'e', 'E', 'e+', 'e-', '1e', ' ', '\t',
+    '0', '9', '00', '.5', '5.', 'nan', 'inf', '0x1p3', '2147483647',
+    '2147483648', '-2147483649', '99999999999', '1e40', '1e-50', 'x', 'Z',
+]
+
+def mutate(line):
+    line = line.rstrip('\n')
+    for _ in range(random.randint(1, 3)):
+        i = random.randint(0, len(line))
+        op = random.randint(0, 3)
+        if op == 0:
+            line = line[:i]
+        elif op == 1:
+            line = line[:i] + random.choice(PIECES) + line[i:]
+        elif op == 2 and i < len(line):
+            line = line[:i] + random.choice(PIECES) + line[i + 1:]
+        else:
+            line = line[:i] + line[i + 1:]
+    return line + '\n'
+
+def main():
+    random.seed(1)
+    lines = [clean() for _ in range(2000)]
+    lines += [mutate(random.choice(lines)) for _ in range(6000)]
+    with open(sys.argv[1] if len(sys.argv) > 1 else
+        'parse_corpus.txt', 'w') as f:
+        for line in lines:
+            if '\n' not in line[:-1]:
+                f.write(line)
+
+if __name__ == '__main__':
+    main()
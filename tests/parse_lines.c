@@ -0,0 +1,185 @@
+/* runs every line of a corpus through message_parse and through the
+ * sscanf patterns parse_line used before it, and reports the lines on
+ * which the two disagree */
+#include <ctype.h>
+#include <stdio.h>
+#include <string.h>
+#include "message.h"
+
+/* the old parser, field for field */
+static int reference_parse(char *line, Message *m)
+{
+   char format[64];
+   int *v = m->v;
+   float *f = m->f;
+   m->type = line[0];
+   m->text = m->buffer;
+   m->buffer[0] = '\0';
+   if (sscanf(line, "U,%d,%f,%f,%f,%f,%f",
+      v, f, f + 1, f + 2, f + 3, f + 4) == 6)
+      return 1;
+   if (sscanf(line, "B,%d,%d,%d,%d,%d,%d",
+      v, v + 1, v + 2, v + 3, v + 4, v + 5) == 6)
+      return 1;
+   if (sscanf(line, "L,%d,%d,%d,%d,%d,%d",
+      v, v + 1, v + 2, v + 3, v + 4, v + 5) == 6)
+      return 1;
+   if (sscanf(line, "P,%d,%f,%f,%f,%f,%f",
+      v, f, f + 1, f + 2, f + 3, f + 4) == 6)
+      return 1;
+   if (sscanf(line, "D,%d", v) == 1)
+      return 1;
+   if (sscanf(line, "K,%d,%d,%d", v, v + 1, v + 2) == 3)
+      return 1;
+   if (sscanf(line, "R,%d,%d", v, v + 1) == 2)
+      return 1;
+   if (sscanf(line, "E,%lf,%d", &m->elapsed, v) == 2)
+      return 1;
+   if (line[0] == 'T' && line[1] == ',') {
+      m->text = line + 2;
+      return 1;
+   }
+   if (sscanf(line, "V,%d", v) == 1)
+      return 1;
+   snprintf(format, sizeof(format), "N,%%d,%%%ds", MAX_NAME_LENGTH - 1);
+   if (sscanf(line, format, v, m->buffer) == 2)
+      return 1;
+   snprintf(format, sizeof(format),
+      "S,%%d,%%d,%%d,%%d,%%d,%%d,%%%d[^\n]", MAX_SIGN_LENGTH - 1);
+   if (sscanf(line, format, v, v + 1, v + 2, v + 3, v + 4, v + 5,
+      m->buffer) >= 6)
+      return 1;
+   return 0;
+}
+
+/* the fields a line delivers to its handler, floats bit for bit */
+static void describe(char *out, int size, Message *m, int ok)
+{
+   int *v = m->v;
+   float *f = m->f;
+   if (!ok) {
+      snprintf(out, size, "-");
+      return;
+   }
+   switch (m->type) {
+      case 'U': case 'P':
+         snprintf(out, size, "%c %d %a %a %a %a %a", m->type,
+            v[0], f[0], f[1], f[2], f[3], f[4]);
+         break;
+      case 'B': case 'L':
+         snprintf(out, size, "%c %d %d %d %d %d %d", m->type,
+            v[0], v[1], v[2], v[3], v[4], v[5]);
+         break;
+      case 'S':
+         snprintf(out, size, "S %d %d %d %d %d %d [%s]",
+            v[0], v[1], v[2], v[3], v[4], v[5], m->text);
+         break;
+      case 'D': case 'V':
+         snprintf(out, size, "%c %d", m->type, v[0]);
+         break;
+      case 'K':
+         snprintf(out, size, "K %d %d %d", v[0], v[1], v[2]);
+         break;
+      case 'R':
+         snprintf(out, size, "R %d %d", v[0], v[1]);
+         break;
+      case 'E':
+         snprintf(out, size, "E %a %d", m->elapsed, v[0]);
+         break;
+      case 'T':
+         snprintf(out, size, "T [%s]", m->text);
+         break;
+      case 'N':
+         snprintf(out, size, "N %d [%s]", v[0], m->text);
+         break;
+   }
+}
+
+/* an e or E after a digit with no exponent digits following, which
+ * glibc's scanf consumes and strtof leaves alone */
+static int dangling_exponent(const char *line)
+{
+   const char *p;
+   for (p = line + 1; *p; p++) {
+      const char *q = p + 1;
+      if ((*p != 'e' && *p != 'E') ||
+         (!isdigit((unsigned char)p[-1]) && p[-1] != '.'))
+         continue;
+      if (*q == '+' || *q == '-')
+         q++;
+      if (!isdigit((unsigned char)*q))
+         return 1;
+   }
+   return 0;
+}
+
+/* a digit run past 32 bits, where %d is undefined; glibc clamps it to
+ * a long and scan_int wraps it */
+static int overflowing_int(const char *line)
+{
+   const char *p = line;
+   while (*p) {
+      int length = strspn(p, "0123456789");
+      if (length > 10 || (length == 10 && strncmp(p, "4294967295", 10) > 0))
+         return 1;
+      p += length ? length : 1;
+   }
+   return 0;
+}
+
+/* the documented difference: message_parse rejects these */
+static const char *dangling[] = {
+   "P,1,1e,2,3,4,5",
+   "U,1,0,2.5E+,3,4,5",
+   "E,1392953132.95e,600",
+};
+
+int main(int argc, char **argv)
+{
+   const char *path = argc > 1 ? argv[1] : "parse_corpus.txt";
+   char line[1024];
+   int lines = 0, differ = 0, exponent = 0, overflow = 0, bad = 0;
+   unsigned int i;
+   FILE *file = fopen(path, "r");
+   if (!file) {
+      perror(path);
+      return 1;
+   }
+   while (fgets(line, sizeof(line), file)) {
+      char copy[1024], a[1024], b[1024];
+      Message m1, m2;
+      int ok1, ok2;
+      line[strcspn(line, "\n")] = '\0';
+      strcpy(copy, line);
+      ok1 = message_parse(line, &m1);
+      ok2 = reference_parse(copy, &m2);
+      describe(a, sizeof(a), &m1, ok1);
+      describe(b, sizeof(b), &m2, ok2);
+      lines++;
+      if (!strcmp(a, b))
+         continue;
+      if (dangling_exponent(line)) {
+         exponent++;
+         continue;
+      }
+      if (overflowing_int(line)) {
+         overflow++;
+         continue;
+      }
+      if (differ++ < 20)
+         printf("%s\n  message_parse: %s\n  sscanf:        %s\n", line, a, b);
+   }
+   fclose(file);
+   for (i = 0; i < sizeof(dangling) / sizeof(dangling[0]); i++) {
+      char copy[64];
+      Message m;
+      strcpy(copy, dangling[i]);
+      if (message_parse(copy, &m)) {
+         printf("%s should not parse\n", dangling[i]);
+         bad++;
+      }
+   }
+   printf("%d lines, %d differ; skipped %d with a dangling exponent and "
+      "%d with an int overflow\n", lines, differ, exponent, overflow);
+   return differ || bad;
+}
@@ -0,0 +1,155 @@
+/* chunk loads per second from chunk blobs on THREADS threads at once,
+ * all through the main connection as db_load_blocks used to, and each
+ * through a read-only WAL connection of the reader pool; the main
+ * thread keeps inserting blocks elsewhere and committing meanwhile, as
+ * a builder does, and both must load the same blocks. the pool only
+ * pulls ahead with a core per thread */
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "config.h"
+#include "db.h"
+#include "map.h"
+#include "tinycthread.h"
+
+#define CHUNKS 12
+#define EDITS 1000
+#define PASSES 4
+#define THREADS 4
+#define PATH "read_bench.db"
+#define AUTH_PATH "read_bench.auth.db"
+
+unsigned BLOCK_REGIONS = 0;
+
+typedef struct {
+    int first;
+    long loaded;
+    thrd_t thrd;
+} Loader;
+
+static int done;
+static mtx_t done_mtx;
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void cleanup(void) {
+    char path[64];
+    int i;
+    const char *suffixes[] = {"", "-wal", "-shm", "-journal"};
+    for (i = 0; i < 4; i++) {
+        snprintf(path, sizeof(path), "%s%s", PATH, suffixes[i]);
+        remove(path);
+        snprintf(path, sizeof(path), "%s%s", AUTH_PATH, suffixes[i]);
+        remove(path);
+    }
+}
+
+static int chunk_p(int i) {
+    return i / CHUNKS - CHUNKS / 2;
+}
+
+static int chunk_q(int i) {
+    return i % CHUNKS - CHUNKS / 2;
+}
+
+static int create_blobs(void) {
+    unsigned int seed = 1;
+    int i, j;
+    cleanup();
+    db_init(PATH, AUTH_PATH, 0);
+    for (i = 0; i < CHUNKS * CHUNKS; i++) {
+        int p = chunk_p(i);
+        int q = chunk_q(i);
+        for (j = 0; j < EDITS; j++) {
+            seed = seed * 1103515245 + 12345;
+            db_insert_block(p, q,
+                p * CHUNK_SIZE + (seed >> 8) % CHUNK_SIZE,
+                1 + (seed >> 16) % 128,
+                q * CHUNK_SIZE + (seed >> 24) % CHUNK_SIZE,
+                1 + seed % 60);
+        }
+    }
+    db_commit();
+    db_close();
+    return CHUNKS * CHUNKS;
+}
+
+static int load_run(void *arg) {
+    Loader *loader = (Loader *)arg;
+    int i, pass;
+    loader->loaded = 0;
+    for (pass = 0; pass < PASSES; pass++) {
+        for (i = 0; i < CHUNKS * CHUNKS; i++) {
+            int k = (i + loader->first * CHUNKS) % (CHUNKS * CHUNKS);
+            int p = chunk_p(k);
+            int q = chunk_q(k);
+            Map map;
+            map_alloc(&map, p * CHUNK_SIZE - 1, 0,
+                q * CHUNK_SIZE - 1, 0x7fff);
+            db_load_blocks(&map, p, q);
+            loader->loaded += map.size;
+            map_free(&map);
+        }
+    }
+    mtx_lock(&done_mtx);
+    done++;
+    mtx_unlock(&done_mtx);
+    return 0;
+}
+
+/* returns the chunk loads per second with that many readers */
+static double run(int readers, long *loaded) {
+    Loader loaders[THREADS];
+    double start;
+    int i, finished = 0, x = 0;
+    db_init(PATH, AUTH_PATH, readers);
+    done = 0;
+    start = now();
+    for (i = 0; i < THREADS; i++) {
+        loaders[i].first = i;
+        thrd_create(&loaders[i].thrd, load_run, loaders + i);
+    }
+    // edits far away from the chunks being loaded
+    while (!finished) {
+        int j;
+        for (j = 0; j < 64; j++, x++) {
+            db_insert_block(100, 100, 100 * CHUNK_SIZE + x % CHUNK_SIZE,
+                1 + x / CHUNK_SIZE % 128, 100 * CHUNK_SIZE, 1 + x % 60);
+        }
+        db_commit();
+        thrd_yield();
+        mtx_lock(&done_mtx);
+        finished = done == THREADS;
+        mtx_unlock(&done_mtx);
+    }
+    *loaded = 0;
+    for (i = 0; i < THREADS; i++) {
+        thrd_join(loaders[i].thrd, NULL);
+        *loaded += loaders[i].loaded;
+    }
+    start = now() - start;
+    db_close();
+    return THREADS * PASSES * CHUNKS * CHUNKS / start;
+}
+
+int main(void) {
+    long loaded[2];
+    double shared, pooled;
+    mtx_init(&done_mtx, mtx_plain);
+    db_enable();
+    create_blobs();
+    shared = run(0, loaded);
+    pooled = run(THREADS, loaded + 1);
+    printf("%-16s %d threads %10.0f loads/s %9ld blocks\n",
+        "main connection", THREADS, shared, loaded[0]);
+    printf("%-16s %d threads %10.0f loads/s %9ld blocks (%.2fx)\n",
+        "reader pool", THREADS, pooled, loaded[1], pooled / shared);
+    db_disable();
+    mtx_destroy(&done_mtx);
+    cleanup();
+    return loaded[0] == loaded[1] && loaded[0] ? 0 : 1;
+}
@@ -0,0 +1,118 @@
+/* writes per second through the db write queue: the mutex guarded Ring
+ * with a signal per put that the db worker used to drain, SpscRing with
+ * room to spare, and SpscRing small enough that most writes go through
+ * its overflow; put is the producer's time alone, total lasts until the
+ * consumer has taken the last entry, which must arrive in order */
+#include <stdio.h>
+#include <time.h>
+#include "ring.h"
+#include "tinycthread.h"
+
+#define COUNT (1 << 22)
+#define QUEUE_SIZE 16384
+#define SMALL_SIZE 64
+
+typedef struct {
+    Ring ring;
+    mtx_t mtx;
+    cnd_t cnd;
+} LockedRing;
+
+static LockedRing locked;
+static SpscRing spsc;
+static int bad;
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void check(RingEntry *e, int *expected) {
+    if (e->type == BLOCK && e->x != (*expected)++)
+        bad++;
+}
+
+static int locked_run(void *arg) {
+    int expected = 0;
+    while (1) {
+        RingEntry e;
+        mtx_lock(&locked.mtx);
+        while (!ring_get(&locked.ring, &e))
+            cnd_wait(&locked.cnd, &locked.mtx);
+        mtx_unlock(&locked.mtx);
+        if (e.type == EXIT)
+            break;
+        check(&e, &expected);
+    }
+    bad += expected != COUNT;
+    return 0;
+}
+
+static int spsc_run(void *arg) {
+    int expected = 0, running = 1;
+    while (running) {
+        RingEntry e;
+        spsc_ring_wait(&spsc);
+        while (running && spsc_ring_get(&spsc, &e)) {
+            if (e.type == EXIT)
+                running = 0;
+            else
+                check(&e, &expected);
+        }
+    }
+    bad += expected != COUNT;
+    return 0;
+}
+
+static void locked_put(RingEntry *e) {
+    mtx_lock(&locked.mtx);
+    ring_put(&locked.ring, e);
+    cnd_signal(&locked.cnd);
+    mtx_unlock(&locked.mtx);
+}
+
+static void spsc_put(RingEntry *e) {
+    spsc_ring_put(&spsc, e);
+}
+
+static void run(const char *name, thrd_start_t consume,
+    void (*put)(RingEntry *))
+{
+    RingEntry e = {BLOCK, 0, 0, 0, 64, 0, 1, 0};
+    double start, produced;
+    thrd_t thrd;
+    int i;
+    start = now();
+    thrd_create(&thrd, consume, NULL);
+    for (i = 0; i < COUNT; i++) {
+        e.x = i;
+        put(&e);
+    }
+    e.type = EXIT;
+    put(&e);
+    produced = now() - start;
+    thrd_join(thrd, NULL);
+    start = now() - start;
+    printf("%-14s %7.2f M puts/s %7.2f M/s total\n",
+        name, COUNT / produced / 1e6, COUNT / start / 1e6);
+}
+
+int main(void) {
+    ring_alloc(&locked.ring, 1024);
+    mtx_init(&locked.mtx, mtx_plain);
+    cnd_init(&locked.cnd);
+    run("mutex Ring", locked_run, locked_put);
+    cnd_destroy(&locked.cnd);
+    mtx_destroy(&locked.mtx);
+    ring_free(&locked.ring);
+    spsc_ring_alloc(&spsc, QUEUE_SIZE);
+    run("SpscRing", spsc_run, spsc_put);
+    spsc_ring_free(&spsc);
+    spsc_ring_alloc(&spsc, SMALL_SIZE);
+    run("overflow", spsc_run, spsc_put);
+    spsc_ring_free(&spsc);
+    if (bad)
+        printf("%d entries out of order or missing\n", bad);
+    return bad ? 1 : 0;
+}
@@ -0,0 +1,71 @@
+/* chunks per second generated into a fresh block map, one map_set per
+ * block through create_world_gen against the column runs of
+ * create_world_fill */
+#include <stdio.h>
+#include <time.h>
+#include "config.h"
+#include "map.h"
+#include "world.h"
+
+#define SIDE 16
+#define PASSES 3
+
+static void block_func(int x, int y, int z, int w, void *arg) {
+    map_set((Map *)arg, x, y, z, w);
+}
+
+static void reserve(int count, void *arg) {
+    map_reserve((Map *)arg, count);
+}
+
+static void fill(int x, int y0, int y1, int z, int w, void *arg) {
+    map_fill_column((Map *)arg, x, y0, y1, z, w);
+}
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static double run(int runs, long *blocks) {
+    WorldGen *gen = world_gen_create();
+    double start = now();
+    int p, q;
+    *blocks = 0;
+    for (p = 0; p < SIDE; p++) {
+        for (q = 0; q < SIDE; q++) {
+            Map map;
+            map_alloc(&map, p * CHUNK_SIZE - 1, 0, q * CHUNK_SIZE - 1,
+                0x7fff);
+            if (runs)
+                create_world_fill(gen, p, q, reserve, fill, &map);
+            else
+                create_world_gen(gen, p, q, block_func, &map);
+            *blocks += map.size;
+            map_free(&map);
+        }
+    }
+    start = now() - start;
+    world_gen_free(gen);
+    return SIDE * SIDE / start;
+}
+
+int main(void) {
+    long blocks[2];
+    double rate[2] = {0, 0};
+    int i, runs;
+    // the best of a few passes, each from an empty column cache
+    for (i = 0; i < PASSES; i++) {
+        for (runs = 0; runs < 2; runs++) {
+            double r = run(runs, blocks + runs);
+            if (r > rate[runs])
+                rate[runs] = r;
+        }
+    }
+    printf("%-18s %8.1f chunks/s %9ld blocks\n",
+        "create_world_gen", rate[0], blocks[0]);
+    printf("%-18s %8.1f chunks/s %9ld blocks (%.2fx)\n",
+        "create_world_fill", rate[1], blocks[1], rate[1] / rate[0]);
+    return blocks[0] != blocks[1];
+}
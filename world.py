@@ -1,7 +1,8 @@
-# gcc -std=c99 -O3 -shared -o world \
-#   -I src -I deps/noise deps/noise/noise.c src/world.c
+# gcc -std=c99 -O3 -fPIC -shared -o world \
+#   -I src -I deps/noise -I deps/tinycthread \
+#   deps/noise/noise.c deps/tinycthread/tinycthread.c src/world.c -lpthread
 
-from ctypes import CDLL, CFUNCTYPE, c_float, c_int, c_void_p
+from ctypes import CDLL, CFUNCTYPE, c_float, c_int, c_uint, c_void_p
 from collections import OrderedDict
 
 dll = CDLL('./world')
@@ -11,11 +12,16 @@ WORLD_FUNC = CFUNCTYPE(None, c_int, c_int, c_int, c_int, c_void_p)
 def dll_seed(x):
     dll.seed(x)
 
-def dll_create_world(p, q):
+dll.world_gen_create.restype = c_void_p
+dll.world_gen_seed.argtypes = [c_void_p, c_uint]
+dll.world_gen_free.argtypes = [c_void_p]
+dll.create_world_gen.argtypes = [c_void_p, c_int, c_int, WORLD_FUNC, c_void_p]
+
+def dll_create_world(p, q, gen=None):
     result = {}
     def world_func(x, y, z, w, arg):
         result[(x, y, z)] = w
-    dll.create_world(p, q, WORLD_FUNC(world_func), None)
+    dll.create_world_gen(gen, p, q, WORLD_FUNC(world_func), None)
     return result
 
 dll.simplex2.restype = c_float
@@ -33,10 +39,14 @@ class World(object):
         self.seed = seed
         self.cache = OrderedDict()
         self.cache_size = cache_size
+        self.gen = dll.world_gen_create()
+        if seed is not None:
+            dll.world_gen_seed(self.gen, seed)
+    def __del__(self):
+        if getattr(self, 'gen', None):
+            dll.world_gen_free(self.gen)
     def create_chunk(self, p, q):
-        if self.seed is not None:
-            dll_seed(self.seed)
-        return dll_create_world(p, q)
+        return dll_create_world(p, q, self.gen)
     def get_chunk(self, p, q):
         try:
             chunk = self.cache.pop((p, q))